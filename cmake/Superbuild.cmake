@@ -46,6 +46,7 @@ set(INHERITED_CMAKE_ARGS
   -DCMAKE_PREFIX_PATH=${CMAKE_PREFIX_PATH}
   -DCMAKE_BUILD_TYPE=${CMAKE_BUILD_TYPE}
   -DEP_BASE=${EP_BASE}
+  -DNATIVE_ARCH=${NATIVE_ARCH}
 )
 
 ############################################################
@@ -12,6 +12,9 @@ import os
 import traceback
 import logging
 import pathlib
+import sys
+
+import compare
 
 
 from logging import handlers
@@ -57,9 +60,19 @@ def flush_caches():
 
 @click.command()
 @click.option('--config', required=True, help='Yaml config file for benchmark')
-def run_benchmark(config):
+@click.option('--save-results', default=None,
+              help='Store the results of this run as a JSON baseline')
+@click.option('--baseline', default=None,
+              help='JSON baseline to compare this run against')
+@click.option('--threshold', default=5.0,
+              help='Regression threshold in percent for --baseline')
+@click.option('--alpha', default=0.05,
+              help='Significance level of the t-test for --baseline')
+def run_benchmark(config, save_results, baseline, threshold, alpha):
     """ Benchmark script for tiledb-vcf"""
 
+    regressed = False
+    config_file = config
     # Open yaml config file
     with open(config, 'r') as stream:
         try:
@@ -72,6 +85,7 @@ def run_benchmark(config):
             attribute_results = {}
             suite_index = 0
             suite_names = []
+            all_results = {}
 
             errors = {}
 
@@ -167,6 +181,8 @@ def run_benchmark(config):
                                     test_results[test_name]["file_sizes"][file_name] = []
                                 test_results[test_name]["file_sizes"][file_name].append(size)
 
+                all_results[suite_name] = test_results
+
                 # If there was a store test we should save results for printing table at the end
                 if 'store' in test_results:
                     ingestion_times = test_results["store"]["time"]
@@ -175,14 +191,22 @@ def run_benchmark(config):
                     ingestion_time_std = numpy.std(ingestion_times)
                     export_time_avg = 'N/A'
                     export_time_std = 'N/A'
+                    consolidate_time_avg = 'N/A'
+                    consolidate_time_std = 'N/A'
 
                     if 'export' in test_results:
                         export_times = test_results["export"]["time"]
                         export_time_avg = numpy.average(export_times)
                         export_time_std = numpy.std(export_times)
 
+                    if 'consolidate' in test_results:
+                        consolidate_times = test_results["consolidate"]["time"]
+                        consolidate_time_avg = numpy.average(consolidate_times)
+                        consolidate_time_std = numpy.std(consolidate_times)
+
                     results.append([suite_name, iteration_count, ingestion_time_avg, ingestion_time_std,
-                                    size_avg, ingestion_size, export_time_avg, export_time_std])
+                                    size_avg, ingestion_size, export_time_avg, export_time_std,
+                                    consolidate_time_avg, consolidate_time_std])
 
                     for file_name, file_sizes in test_results['store']["file_sizes"].items():
                         if not file_name in attribute_results:
@@ -205,7 +229,8 @@ def run_benchmark(config):
 
             header = ['Test', 'Iterations', 'Ingestion Time (seconds)',
                       'Ingestion Time (seconds) STDDEV', 'Array Size (MB)', 'Ingestion Size (MB)',
-                      'Export Time (seconds)', 'Export Time STDDEV (seconds)']
+                      'Export Time (seconds)', 'Export Time STDDEV (seconds)',
+                      'Consolidate Time (seconds)', 'Consolidate Time STDDEV (seconds)']
             t = PrettyTable(header)
             for result in results:
                 t.add_row(result)
@@ -254,8 +279,19 @@ def run_benchmark(config):
                 logger.error("Errors detected in run, dumping details:")
                 logger.error(errors)
 
+            current = compare.build_baseline(config_file, ingestion_size, all_results)
+            if save_results is not None:
+                compare.save_baseline(save_results, current)
+                logger.info("Saved results to %s", save_results)
+
+            if baseline is not None:
+                regressed = compare.check_regressions(baseline, current, threshold, alpha)
+
         except yaml.YAMLError as exc:
             print(exc)
 
+    if regressed:
+        sys.exit(1)
+
 if __name__ == '__main__':
     run_benchmark()
\ No newline at end of file
@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+
+"""Versioned benchmark baselines and regression detection.
+
+Results of a benchmark run are stored as JSON with the raw per iteration
+measurements of every test in every suite. A new run is compared against a
+baseline with Welch's t-test per metric; a metric regresses when it got worse
+by more than the threshold and the difference is statistically significant.
+"""
+
+import datetime
+import json
+import math
+import subprocess
+import sys
+
+import click
+
+BASELINE_VERSION = 1
+
+# Tests which ingest the input files, the only ones with a throughput
+INGESTION_TESTS = ("store", "register")
+
+# Metrics compared for each test, and whether a higher value is better
+METRICS = {
+    "time": False,
+    "throughput": True,
+    "size": False,
+}
+
+
+def git_revision():
+    try:
+        return subprocess.check_output(["git", "rev-parse", "HEAD"],
+                                       stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def build_baseline(config_file, ingestion_size, all_results):
+    """Build the JSON document for a run
+
+    all_results maps suite name -> test name -> {"time": [...], "size": [...]}
+    ingestion_size is the size in MB of the ingested files, used to derive
+    throughput of the tests which ingest them.
+    """
+    suites = {}
+    for suite_name, test_results in all_results.items():
+        suites[suite_name] = {}
+        for test_name, result in test_results.items():
+            times = result["time"]
+            entry = {"time": times}
+            if test_name in INGESTION_TESTS:
+                entry["throughput"] = [ingestion_size / t if t > 0 else 0.0
+                                       for t in times]
+            if any(size > 0 for size in result["size"]):
+                entry["size"] = result["size"]
+            suites[suite_name][test_name] = entry
+
+    return {
+        "version": BASELINE_VERSION,
+        "created": datetime.datetime.utcnow().isoformat() + "Z",
+        "git_revision": git_revision(),
+        "config": config_file,
+        "ingestion_size_mb": ingestion_size,
+        "suites": suites,
+    }
+
+
+def save_baseline(path, baseline):
+    with open(path, "w") as stream:
+        json.dump(baseline, stream, indent=2, sort_keys=True)
+
+
+def load_baseline(path):
+    with open(path, "r") as stream:
+        baseline = json.load(stream)
+    if baseline.get("version") != BASELINE_VERSION:
+        raise ValueError("Unsupported baseline version {} in {}".format(
+            baseline.get("version"), path))
+    return baseline
+
+
+def _betacf(a, b, x):
+    """Continued fraction for the incomplete beta function"""
+    max_iterations = 200
+    epsilon = 3.0e-12
+    fpmin = 1.0e-300
+    qab = a + b
+    qap = a + 1.0
+    qam = a - 1.0
+    c = 1.0
+    d = 1.0 - qab * x / qap
+    if abs(d) < fpmin:
+        d = fpmin
+    d = 1.0 / d
+    h = d
+    for m in range(1, max_iterations + 1):
+        m2 = 2 * m
+        aa = m * (b - m) * x / ((qam + m2) * (a + m2))
+        d = 1.0 + aa * d
+        if abs(d) < fpmin:
+            d = fpmin
+        c = 1.0 + aa / c
+        if abs(c) < fpmin:
+            c = fpmin
+        d = 1.0 / d
+        h *= d * c
+        aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2))
+        d = 1.0 + aa * d
+        if abs(d) < fpmin:
+            d = fpmin
+        c = 1.0 + aa / c
+        if abs(c) < fpmin:
+            c = fpmin
+        d = 1.0 / d
+        delta = d * c
+        h *= delta
+        if abs(delta - 1.0) < epsilon:
+            break
+    return h
+
+
+def _betai(a, b, x):
+    """Regularized incomplete beta function I_x(a, b)"""
+    if x <= 0.0:
+        return 0.0
+    if x >= 1.0:
+        return 1.0
+    bt = math.exp(math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b) +
+                  a * math.log(x) + b * math.log(1.0 - x))
+    if x < (a + 1.0) / (a + b + 2.0):
+        return bt * _betacf(a, b, x) / a
+    return 1.0 - bt * _betacf(b, a, 1.0 - x) / b
+
+
+def welch_t_test(a, b):
+    """Two sided Welch's t-test, returns the p-value or None if it cannot be
+    computed (fewer than two samples on either side)"""
+    if len(a) < 2 or len(b) < 2:
+        return None
+    mean_a = sum(a) / len(a)
+    mean_b = sum(b) / len(b)
+    var_a = sum((x - mean_a) ** 2 for x in a) / (len(a) - 1)
+    var_b = sum((x - mean_b) ** 2 for x in b) / (len(b) - 1)
+    se_a = var_a / len(a)
+    se_b = var_b / len(b)
+    if se_a + se_b == 0:
+        return 0.0 if mean_a != mean_b else 1.0
+    t = (mean_a - mean_b) / math.sqrt(se_a + se_b)
+    df = (se_a + se_b) ** 2 / ((se_a ** 2) / (len(a) - 1) + (se_b ** 2) / (len(b) - 1))
+    return _betai(df / 2.0, 0.5, df / (df + t * t))
+
+
+def compare(baseline, current, threshold, alpha):
+    """Compare two runs
+
+    Returns a list of rows (suite, test, metric, baseline mean, current mean,
+    change %, p-value, regressed) for every metric present in both runs.
+    """
+    rows = []
+    for suite_name, tests in sorted(current["suites"].items()):
+        base_tests = baseline["suites"].get(suite_name)
+        if base_tests is None:
+            continue
+        for test_name, metrics in sorted(tests.items()):
+            base_metrics = base_tests.get(test_name)
+            if base_metrics is None:
+                continue
+            for metric, higher_is_better in METRICS.items():
+                if metric not in metrics or metric not in base_metrics:
+                    continue
+                base_values = base_metrics[metric]
+                values = metrics[metric]
+                base_mean = sum(base_values) / len(base_values)
+                mean = sum(values) / len(values)
+                if base_mean == 0:
+                    continue
+                change = (mean - base_mean) / base_mean * 100.0
+                worse = -change if higher_is_better else change
+                p_value = welch_t_test(base_values, values)
+                significant = p_value is None or p_value < alpha
+                regressed = worse > threshold and significant
+                rows.append((suite_name, test_name, metric, base_mean, mean, change,
+                             p_value, regressed))
+    return rows
+
+
+def print_comparison(rows):
+    from prettytable import PrettyTable
+    table = PrettyTable(["Suite", "Test", "Metric", "Baseline", "Current",
+                         "Change (%)", "p-value", "Regression"])
+    for suite_name, test_name, metric, base_mean, mean, change, p_value, regressed in rows:
+        table.add_row([suite_name, test_name, metric, "{:.4g}".format(base_mean),
+                       "{:.4g}".format(mean), "{:+.2f}".format(change),
+                       "N/A" if p_value is None else "{:.4f}".format(p_value),
+                       "YES" if regressed else ""])
+    print("")
+    print(table)
+
+
+def check_regressions(baseline_path, current, threshold, alpha):
+    """Compare a run against a baseline file and print the result
+
+    Returns True if any regression was detected.
+    """
+    baseline = load_baseline(baseline_path)
+    rows = compare(baseline, current, threshold, alpha)
+    print_comparison(rows)
+    regressions = [row for row in rows if row[7]]
+    if regressions:
+        print("")
+        print("{} regression(s) beyond {}% against baseline {}".format(
+            len(regressions), threshold, baseline_path))
+    return len(regressions) > 0
+
+
+@click.command()
+@click.argument('baseline_file')
+@click.argument('current_file')
+@click.option('--threshold', default=5.0, help='Regression threshold in percent')
+@click.option('--alpha', default=0.05, help='Significance level of the t-test')
+def compare_files(baseline_file, current_file, threshold, alpha):
+    """Compare two stored benchmark results, exits non zero on regression"""
+    current = load_baseline(current_file)
+    if check_regressions(baseline_file, current, threshold, alpha):
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    compare_files()
@@ -0,0 +1,571 @@
+/**
+ * @file  Aggregate.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * VWAP, TWAP, volume and quote microstructure metrics per symbol and time
+ * bucket, reduced directly over the typed result buffers of Trade and Quote
+ * reads
+ *
+ */
+
+#include "Aggregate.h"
+#include "CsvWriter.h"
+#include "Nbbo.h"
+#include "Quote.h"
+#include "ResultStream.h"
+#include "Trace.h"
+#include "Trade.h"
+#include "utils.h"
+#include <ThreadPool.h>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+static const uint64_t nanosecondsPerDay = 86400000000000;
+
+const std::vector<std::string> &nyse::metricNames() {
+  static const std::vector<std::string> names = {
+      "count",           "volume",          "vwap",      "twap",
+      "quoted_spread",   "relative_spread", "imbalance", "depth"};
+  return names;
+}
+
+bool nyse::parseMetric(const std::string &name, Metric &metric) {
+  const std::vector<std::string> &names = metricNames();
+  for (size_t m = 0; m < names.size(); m++) {
+    if (names[m] == name) {
+      metric = static_cast<Metric>(m);
+      return true;
+    }
+  }
+  return false;
+}
+
+double nyse::AggregateBucket::value(Metric metric) const {
+  double timeWeight = time > 0 ? 1 / time : 0;
+  switch (metric) {
+  case Metric::Count:
+    return count;
+  case Metric::Volume:
+    return volume;
+  case Metric::Vwap:
+    return vwap();
+  case Metric::Twap:
+    return twap();
+  case Metric::QuotedSpread:
+    return spreadTime * timeWeight;
+  case Metric::RelativeSpread:
+    return relativeSpreadTime * timeWeight;
+  case Metric::Imbalance:
+    return imbalanceTime * timeWeight;
+  case Metric::Depth:
+    return depthTime * timeWeight;
+  }
+  return 0;
+}
+
+namespace {
+/**
+ * Values of one row, invalid rows have all values 0. Spread, imbalance and
+ * depth are only set for quotes.
+ */
+struct Observation {
+  double valid = 0;
+  double price = 0;
+  double weight = 0;
+  double spread = 0;
+  double relativeSpread = 0;
+  double imbalance = 0;
+};
+
+inline Observation observeTrade(float price, uint32_t volume) {
+  Observation observation;
+  observation.valid = 1;
+  observation.price = price;
+  observation.weight = volume;
+  return observation;
+}
+
+/**
+ * Quotes contribute their midpoint weighted by the quoted sizes when both
+ * sides are present. Written without branches so the loops vectorize.
+ */
+inline Observation observeQuote(float bid, uint32_t bidSize, float offer,
+                                uint32_t offerSize) {
+  Observation observation;
+  double valid = (bid > 0) & (offer > 0);
+  double mid = 0.5 * (double(bid) + double(offer));
+  double sizes = double(bidSize) + double(offerSize);
+  observation.valid = valid;
+  observation.price = valid * mid;
+  observation.weight = valid * sizes;
+  observation.spread = valid * (double(offer) - double(bid));
+  observation.relativeSpread = observation.spread / (mid + (1 - valid));
+  observation.imbalance = valid * (double(bidSize) - double(offerSize)) /
+                          (sizes + (sizes == 0));
+  return observation;
+}
+
+/**
+ * Add an observation in effect for dt nanoseconds to a bucket's time weighted
+ * sums
+ */
+inline void addTimeWeighted(nyse::AggregateBucket &bucket,
+                            const Observation &observation, double dt) {
+  dt *= observation.valid;
+  bucket.priceTime += observation.price * dt;
+  bucket.time += dt;
+  bucket.spreadTime += observation.spread * dt;
+  bucket.relativeSpreadTime += observation.relativeSpread * dt;
+  bucket.imbalanceTime += observation.imbalance * dt;
+  bucket.depthTime += observation.weight * dt;
+}
+
+/**
+ * Last observation of a run, its time weight is only known once the next
+ * observation or the end of its bucket is reached
+ */
+struct PendingObservation {
+  bool pending = false;
+  uint64_t key = 0;
+  uint64_t datetime = 0;
+  uint64_t limit = 0;
+  Observation observation;
+};
+
+/**
+ * Accumulate count, volume and notional of n observations, and the time
+ * weighted sums of all but the last one. The value sums and the time
+ * weights are separate loops so the contiguous columns vectorize regardless
+ * of the coordinate stride.
+ * @tparam Stride coordinates per cell, 0 to use ndim
+ * @tparam Quotes whether to accumulate the quote metrics
+ * @param observe callback returning the Observation of a row
+ * @param datetime first datetime of the run, strided by ndim
+ * @param ndim
+ * @param n rows in the run
+ * @param bucket
+ */
+template <uint64_t Stride, bool Quotes, typename Observe>
+void reduceRun(Observe observe, const uint64_t *datetime, uint64_t ndim,
+               uint64_t n, nyse::AggregateBucket &bucket) {
+  const uint64_t stride = Stride != 0 ? Stride : ndim;
+  double count = 0, volume = 0, notional = 0;
+#pragma omp simd reduction(+ : count, volume, notional)
+  for (uint64_t row = 0; row < n; row++) {
+    Observation observation = observe(row);
+    count += observation.valid;
+    volume += observation.weight;
+    notional += observation.price * observation.weight;
+  }
+
+  // The last observation's weight depends on what follows the run
+  double priceTime = 0, time = 0, spreadTime = 0, relativeSpreadTime = 0,
+         imbalanceTime = 0, depthTime = 0;
+  uint64_t weighted = n > 0 ? n - 1 : 0;
+#pragma omp simd reduction(+ : priceTime, time, spreadTime,                  \
+                           relativeSpreadTime, imbalanceTime, depthTime)
+  for (uint64_t row = 0; row < weighted; row++) {
+    Observation observation = observe(row);
+    double dt = observation.valid * double(datetime[(row + 1) * stride] -
+                                           datetime[row * stride]);
+    priceTime += observation.price * dt;
+    time += dt;
+    if (Quotes) {
+      spreadTime += observation.spread * dt;
+      relativeSpreadTime += observation.relativeSpread * dt;
+      imbalanceTime += observation.imbalance * dt;
+      depthTime += observation.weight * dt;
+    }
+  }
+
+  bucket.count += static_cast<uint64_t>(count);
+  bucket.volume += volume;
+  bucket.notional += notional;
+  bucket.priceTime += priceTime;
+  bucket.time += time;
+  bucket.spreadTime += spreadTime;
+  bucket.relativeSpreadTime += relativeSpreadTime;
+  bucket.imbalanceTime += imbalanceTime;
+  bucket.depthTime += depthTime;
+}
+
+/**
+ * Reduce a run, specialized for the three dimensions of the Trade, Quote and
+ * NBBO arrays
+ */
+template <bool Quotes, typename Observe>
+void reduceRun(Observe observe, const uint64_t *datetime, uint64_t ndim,
+               uint64_t n, nyse::AggregateBucket &bucket) {
+  if (ndim == 3)
+    reduceRun<3, Quotes>(observe, datetime, ndim, n, bucket);
+  else
+    reduceRun<0, Quotes>(observe, datetime, ndim, n, bucket);
+}
+
+/**
+ * First row at or after begin whose datetime is not below limit, rows are in
+ * datetime order
+ */
+uint64_t runEnd(const uint64_t *datetime, uint64_t ndim, uint64_t begin,
+                uint64_t rows, uint64_t limit) {
+  uint64_t low = begin, high = rows;
+  while (low < high) {
+    uint64_t middle = low + (high - low) / 2;
+    if (datetime[middle * ndim] < limit)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
+}
+} // namespace
+
+nyse::Aggregation::Aggregation(std::shared_ptr<tiledb::Context> ctx,
+                               std::string uri, FileType type)
+    : ctx(std::move(ctx)), uri(std::move(uri)), type(type) {}
+
+bool nyse::Aggregation::quoteMetrics() const {
+  for (Metric metric : metrics) {
+    if (metric >= Metric::QuotedSpread)
+      return true;
+  }
+  return false;
+}
+
+uint64_t nyse::Aggregation::aggregateSymbol(
+    Array &array, uint64_t symbolId, uint64_t start, uint64_t end,
+    std::map<uint64_t, AggregateBucket> &buckets) {
+  std::vector<uint64_t> subarray =
+      array.symbolSubarray(symbolId, start, end, array.nonEmptyDomain());
+  if (subarray.empty())
+    return 0;
+  uint64_t datetimeIndex =
+      dimensionIndex(array.array->schema().domain().dimensions(), "datetime");
+  uint64_t queryEnd =
+      end == std::numeric_limits<uint64_t>::max() ? end : end + 1;
+  bool quotes = quoteMetrics();
+
+  PendingObservation pending;
+  auto closePending = [&](uint64_t next) {
+    if (!pending.pending)
+      return;
+    addTimeWeighted(buckets[pending.key], pending.observation,
+                    double(next - pending.datetime));
+    pending.pending = false;
+  };
+
+  ResultStream stream(array, subarray);
+  for (const ResultBatch &batch : stream) {
+    uint64_t ndim = batch.dimensions();
+    const uint64_t *datetime =
+        batch.coordinates<uint64_t>().data() + datetimeIndex;
+
+    // Typed columns of the batch, only those of the array's type are read
+    ColumnSpan<float> tradePrice, bidPrice, offerPrice;
+    ColumnSpan<uint32_t> tradeVolume, bidSize, offerSize;
+    if (type == FileType::Trade) {
+      tradePrice = batch.values<float>("Trade_Price");
+      tradeVolume = batch.values<uint32_t>("Trade_Volume");
+    } else {
+      bidPrice = batch.values<float>("Bid_Price");
+      bidSize = batch.values<uint32_t>("Bid_Size");
+      offerPrice = batch.values<float>("Offer_Price");
+      offerSize = batch.values<uint32_t>("Offer_Size");
+    }
+    auto observeRow = [&](uint64_t row) {
+      return type == FileType::Trade
+                 ? observeTrade(tradePrice[row], tradeVolume[row])
+                 : observeQuote(bidPrice[row], bidSize[row], offerPrice[row],
+                                offerSize[row]);
+    };
+
+    uint64_t row = 0;
+    while (row < batch.rows()) {
+      // Key and exclusive end of the bucket the row falls in
+      uint64_t t = datetime[row * ndim];
+      uint64_t key, limit;
+      if (timeOfDay) {
+        uint64_t dayStart = nyse::exchange_day_start(nyse::exchange_day(t));
+        key = (t - dayStart) / width * width;
+        limit = dayStart + std::min(key + width, nanosecondsPerDay);
+      } else {
+        key = t / width * width;
+        limit = key > std::numeric_limits<uint64_t>::max() - width
+                    ? std::numeric_limits<uint64_t>::max()
+                    : key + width;
+      }
+      limit = std::min(limit, queryEnd);
+      uint64_t last = runEnd(datetime, ndim, row, batch.rows(), limit);
+
+      // The previous run's last observation holds until this one when both
+      // are in the same bucket, otherwise until the end of its bucket
+      closePending(pending.pending && pending.limit == limit &&
+                           pending.key == key
+                       ? t
+                       : pending.limit);
+
+      AggregateBucket &bucket = buckets[key];
+      bucket.start = key;
+      uint64_t n = last - row;
+      const uint64_t *runDatetime = datetime + row * ndim;
+      if (type == FileType::Trade) {
+        const float *price = tradePrice.data() + row;
+        const uint32_t *volume = tradeVolume.data() + row;
+        reduceRun<false>(
+            [&](uint64_t i) { return observeTrade(price[i], volume[i]); },
+            runDatetime, ndim, n, bucket);
+      } else {
+        const float *bid = bidPrice.data() + row;
+        const float *offer = offerPrice.data() + row;
+        const uint32_t *bidSz = bidSize.data() + row;
+        const uint32_t *offerSz = offerSize.data() + row;
+        auto observe = [&](uint64_t i) {
+          return observeQuote(bid[i], bidSz[i], offer[i], offerSz[i]);
+        };
+        if (quotes)
+          reduceRun<true>(observe, runDatetime, ndim, n, bucket);
+        else
+          reduceRun<false>(observe, runDatetime, ndim, n, bucket);
+      }
+
+      pending.pending = true;
+      pending.key = key;
+      pending.limit = limit;
+      pending.datetime = datetime[(last - 1) * ndim];
+      pending.observation = observeRow(last - 1);
+      row = last;
+    }
+  }
+  closePending(pending.limit);
+  return stream.rows();
+}
+
+std::vector<std::vector<nyse::AggregateBucket>> nyse::Aggregation::run(
+    const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+    uint64_t start, uint64_t end) {
+  if (type != FileType::Trade && type != FileType::Quote &&
+      type != FileType::Nbbo)
+    throw std::invalid_argument(
+        "Aggregation is only supported for Trade, Quote and NBBO arrays");
+  if (type == FileType::Trade && quoteMetrics())
+    throw std::invalid_argument(
+        "Spread, imbalance and depth need a Quote or NBBO array");
+  std::vector<std::string> columns =
+      type == FileType::Trade
+          ? std::vector<std::string>{"datetime", "Trade_Price",
+                                     "Trade_Volume"}
+          : std::vector<std::string>{"datetime", "Bid_Price", "Bid_Size",
+                                     "Offer_Price", "Offer_Size"};
+
+  std::vector<std::vector<AggregateBucket>> results(symbolIds.size());
+  std::atomic<uint64_t> nextSymbol{0};
+  std::atomic<uint64_t> totalRows{0};
+
+  // Each worker has its own reader, sharing the context and its caches
+  auto worker = [&]() {
+    std::unique_ptr<Array> array;
+    for (uint64_t s = nextSymbol++; s < symbolIds.size(); s = nextSymbol++) {
+      try {
+        if (array == nullptr) {
+          if (type == FileType::Trade)
+            array = std::make_unique<Trade>(uri, "", '|');
+          else if (type == FileType::Quote)
+            array = std::make_unique<Quote>(uri, "", '|');
+          else
+            array = std::make_unique<Nbbo>(uri);
+          array->setCtx(ctx);
+          if (!array->setColumns(columns))
+            throw std::runtime_error("Invalid aggregation columns");
+        }
+        TraceSpan aggregateSpan("aggregate", uri);
+        std::map<uint64_t, AggregateBucket> buckets;
+        uint64_t rows =
+            aggregateSymbol(*array, symbolIds[s].second, start, end, buckets);
+        aggregateSpan.setRows(rows);
+        totalRows += rows;
+        for (const auto &bucket : buckets) {
+          if (bucket.second.count > 0)
+            results[s].push_back(bucket.second);
+        }
+      } catch (const std::exception &e) {
+        std::cerr << "Aggregation of " << symbolIds[s].first
+                  << " failed: " << e.what() << std::endl;
+      }
+    }
+  };
+
+  {
+    ThreadPool pool(std::min<uint64_t>(threads, symbolIds.size() + 1));
+    std::vector<std::future<void>> workers;
+    for (uint32_t t = 0; t < threads && t < symbolIds.size(); t++)
+      workers.emplace_back(pool.enqueue(worker));
+    for (auto &future : workers)
+      future.get();
+  }
+  rowsReduced = totalRows;
+  return results;
+}
+
+void nyse::Aggregation::write(
+    const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+    const std::vector<std::vector<AggregateBucket>> &buckets,
+    std::ostream &output, const std::string &delimiter) const {
+  CsvWriter writer(delimiter);
+  writer.append("symbol", 6);
+  writer.appendDelimiter();
+  writer.append("bucket", 6);
+  for (Metric metric : metrics) {
+    const std::string &name = metricNames()[static_cast<int>(metric)];
+    writer.appendDelimiter();
+    writer.append(name.data(), name.size());
+  }
+  writer.appendNewline();
+
+  for (size_t s = 0; s < symbolIds.size() && s < buckets.size(); s++) {
+    for (const AggregateBucket &bucket : buckets[s]) {
+      writer.append(symbolIds[s].first.data(), symbolIds[s].first.size());
+      writer.appendDelimiter();
+      writer.appendValue(bucket.start);
+      for (Metric metric : metrics) {
+        writer.appendDelimiter();
+        if (metric == Metric::Count)
+          writer.appendValue(bucket.count);
+        else
+          writer.appendValue(bucket.value(metric));
+      }
+      writer.appendNewline();
+    }
+    writer.writeTo(output);
+    writer = CsvWriter(delimiter);
+  }
+}
+
+nyse::Metrics::Metrics(std::string array_name) {
+  this->array_uri = std::move(array_name);
+  this->ctx = std::make_shared<tiledb::Context>();
+  this->type = FileType::Metrics;
+  this->origin = "Metrics are computed by --aggregate";
+}
+
+void nyse::Metrics::createArray(tiledb::FilterList coordinate_filter_list,
+                                tiledb::FilterList offset_filter_list,
+                                tiledb::FilterList attribute_filter_list) {
+  // If the array already exists on disk, return immediately.
+  if (tiledb::Object::object(*ctx, array_uri).type() ==
+      tiledb::Object::Type::Array)
+    return;
+
+  tiledb::Domain domain(*ctx);
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(*ctx, "symbol_id",
+                                                           {{0, 10000}}, 100));
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(
+      *ctx, "datetime", {{0, UINT64_MAX - 60UL * 60 * 1000000000}},
+      60UL * 60 * 1000000000));
+
+  tiledb::ArraySchema schema(*ctx, TILEDB_SPARSE);
+  schema.set_domain(domain).set_order({{TILEDB_ROW_MAJOR, TILEDB_ROW_MAJOR}});
+
+  if (coordinate_filter_list.nfilters() > 0) {
+    schema.set_coords_filter_list(coordinate_filter_list);
+  }
+
+  if (offset_filter_list.nfilters() > 0) {
+    schema.set_offsets_filter_list(offset_filter_list);
+  }
+
+  schema.set_capacity(1000000);
+
+  // Set compression filter to ZSTD if not already set
+  if (attribute_filter_list.nfilters() == 0) {
+    tiledb::Filter compressor(*ctx, TILEDB_FILTER_ZSTD);
+    attribute_filter_list.add_filter(compressor);
+  }
+
+  for (const std::string &name : metricNames()) {
+    if (name == "count")
+      schema.add_attribute(tiledb::Attribute::create<uint64_t>(*ctx, name)
+                               .set_filter_list(attribute_filter_list));
+    else
+      schema.add_attribute(tiledb::Attribute::create<double>(*ctx, name)
+                               .set_filter_list(attribute_filter_list));
+  }
+
+  // Create the (empty) array on disk.
+  tiledb::Array::create(array_uri, schema);
+}
+
+uint64_t nyse::Metrics::write(
+    const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+    const std::vector<std::vector<AggregateBucket>> &buckets,
+    const std::vector<Metric> &metrics) {
+  const std::vector<std::string> &names = metricNames();
+  std::vector<bool> selected(names.size(), false);
+  for (Metric metric : metrics)
+    selected[static_cast<int>(metric)] = true;
+
+  auto coords = std::make_shared<std::vector<uint64_t>>();
+  auto count = std::make_shared<std::vector<uint64_t>>();
+  std::vector<std::shared_ptr<std::vector<double>>> values;
+  for (size_t m = 0; m < names.size(); m++)
+    values.push_back(std::make_shared<std::vector<double>>());
+
+  for (size_t s = 0; s < symbolIds.size() && s < buckets.size(); s++) {
+    for (const AggregateBucket &bucket : buckets[s]) {
+      coords->push_back(symbolIds[s].second);
+      coords->push_back(bucket.start);
+      count->push_back(bucket.count);
+      for (size_t m = 1; m < names.size(); m++)
+        values[m]->push_back(selected[m]
+                                 ? bucket.value(static_cast<Metric>(m))
+                                 : std::numeric_limits<double>::quiet_NaN());
+    }
+  }
+
+  std::unordered_map<std::string, std::shared_ptr<buffer>> buffers;
+  buffers.emplace(TILEDB_COORDS, std::make_shared<buffer>(
+                                     buffer{nullptr, coords, TILEDB_UINT64}));
+  buffers.emplace(names[0], std::make_shared<buffer>(
+                                buffer{nullptr, count, TILEDB_UINT64}));
+  for (size_t m = 1; m < names.size(); m++)
+    buffers.emplace(names[m], std::make_shared<buffer>(buffer{
+                                  nullptr, values[m], TILEDB_FLOAT64}));
+
+  query.reset(nullptr);
+  array = std::make_unique<tiledb::Array>(*ctx, array_uri,
+                                          tiledb_query_type_t::TILEDB_WRITE);
+  openedForRead = false;
+  writeFragment(buffers);
+  array->close();
+  array.reset(nullptr);
+  return count->size();
+}
@@ -0,0 +1,261 @@
+/**
+ * @file  Aggregate.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * VWAP, TWAP, volume and quote microstructure metrics per symbol and time
+ * bucket, reduced directly over the typed result buffers of Trade and Quote
+ * reads
+ *
+ */
+
+#ifndef NYSE_INGESTOR_AGGREGATE_H
+#define NYSE_INGESTOR_AGGREGATE_H
+
+#include "Array.h"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * Metrics computed per bucket. Quoted spread, relative spread, imbalance and
+ * depth are time weighted over two sided quotes and need a Quote or NBBO
+ * array.
+ */
+enum class Metric : int {
+  Count,
+  Volume,
+  Vwap,
+  Twap,
+  QuotedSpread,
+  RelativeSpread,
+  Imbalance,
+  Depth
+};
+
+/**
+ * Names of all metrics in Metric order, as used on the command line and as
+ * attribute names of the metrics array
+ */
+const std::vector<std::string> &metricNames();
+
+/**
+ * Parse a metric name
+ * @param name
+ * @param metric
+ * @return false if the name is unknown
+ */
+bool parseMetric(const std::string &name, Metric &metric);
+
+/**
+ * Sums over the observations of one symbol in one time bucket. For trades
+ * the price is Trade_Price weighted by Trade_Volume. For quotes it is the
+ * midpoint of two sided quotes weighted by Bid_Size + Offer_Size.
+ */
+struct AggregateBucket {
+  // Bucket start, nanoseconds since epoch or since exchange midnight for time
+  // of day
+  // profiles
+  uint64_t start = 0;
+  uint64_t count = 0;
+  double volume = 0;
+  // Sum of price * volume
+  double notional = 0;
+  // Sum of price * nanoseconds the price was in effect within the bucket
+  double priceTime = 0;
+  double time = 0;
+  // Sums of offer - bid, its ratio to the midpoint, (bid size - offer size) /
+  // (bid size + offer size) and bid size + offer size, each multiplied by the
+  // nanoseconds the quote was in effect
+  double spreadTime = 0;
+  double relativeSpreadTime = 0;
+  double imbalanceTime = 0;
+  double depthTime = 0;
+
+  double vwap() const { return volume > 0 ? notional / volume : 0; }
+  double twap() const { return time > 0 ? priceTime / time : 0; }
+
+  /**
+   * Value of a metric, time weighted metrics are 0 without quotes
+   * @param metric
+   * @return value
+   */
+  double value(Metric metric) const;
+
+  void merge(const AggregateBucket &other) {
+    count += other.count;
+    volume += other.volume;
+    notional += other.notional;
+    priceTime += other.priceTime;
+    time += other.time;
+    spreadTime += other.spreadTime;
+    relativeSpreadTime += other.relativeSpreadTime;
+    imbalanceTime += other.imbalanceTime;
+    depthTime += other.depthTime;
+  }
+};
+
+/**
+ * Computes the selected metrics per symbol and time bucket in a single pass.
+ * Each symbol is streamed in datetime order and its rows are reduced in
+ * contiguous runs of the same bucket straight from the read buffers, no rows
+ * are materialized. Symbols are aggregated concurrently, each worker with its
+ * own reader.
+ */
+class Aggregation {
+public:
+  /**
+   * @param ctx context shared by all readers
+   * @param uri Trade, Quote or NBBO array
+   * @param type FileType::Trade, FileType::Quote or FileType::Nbbo
+   */
+  Aggregation(std::shared_ptr<tiledb::Context> ctx, std::string uri,
+              FileType type);
+
+  /**
+   * Bucket width in nanoseconds
+   * @param nanoseconds
+   */
+  void setBucketWidth(uint64_t nanoseconds) {
+    width = std::max<uint64_t>(nanoseconds, 1);
+  }
+
+  /**
+   * Aggregate buckets by time of day across all days in the range, giving an
+   * intraday profile instead of a time series
+   * @param timeOfDay
+   */
+  void setTimeOfDay(bool timeOfDay) { this->timeOfDay = timeOfDay; }
+
+  void setThreads(uint32_t threads) { this->threads = std::max(threads, 1u); }
+
+  /**
+   * Metrics to output, all are computed in the same pass
+   * @param metrics
+   */
+  void setMetrics(std::vector<Metric> metrics) {
+    this->metrics = std::move(metrics);
+  }
+
+  const std::vector<Metric> &selectedMetrics() const { return metrics; }
+
+  /**
+   * Aggregate a set of symbols over a time range
+   * @param symbolIds symbol and its symbol_id
+   * @param start first datetime in nanoseconds since epoch (inclusive)
+   * @param end last datetime in nanoseconds since epoch (inclusive)
+   * @return non empty buckets of each symbol in bucket order, in the order of
+   * symbolIds
+   */
+  std::vector<std::vector<AggregateBucket>>
+  run(const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+      uint64_t start, uint64_t end);
+
+  /**
+   * Write buckets as delimited rows of symbol, bucket start and the selected
+   * metrics
+   * @param symbolIds symbols passed to run
+   * @param buckets result of run
+   * @param output
+   * @param delimiter
+   */
+  void write(const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+             const std::vector<std::vector<AggregateBucket>> &buckets,
+             std::ostream &output, const std::string &delimiter) const;
+
+  /**
+   * Rows reduced by the last run
+   */
+  uint64_t rows() const { return rowsReduced; }
+
+private:
+  /**
+   * Aggregate one symbol
+   * @param array reader with the columns of type projected
+   * @param symbolId
+   * @param start
+   * @param end
+   * @param buckets non empty buckets by key
+   * @return rows reduced
+   */
+  uint64_t aggregateSymbol(Array &array, uint64_t symbolId, uint64_t start,
+                           uint64_t end,
+                           std::map<uint64_t, AggregateBucket> &buckets);
+
+  /**
+   * Whether a quote metric is selected
+   */
+  bool quoteMetrics() const;
+
+  std::shared_ptr<tiledb::Context> ctx;
+  std::string uri;
+  FileType type;
+  uint64_t width = 60000000000;
+  bool timeOfDay = false;
+  uint32_t threads = 1;
+  std::vector<Metric> metrics = {Metric::Count, Metric::Volume, Metric::Vwap,
+                                 Metric::Twap};
+  uint64_t rowsReduced = 0;
+};
+
+/**
+ * Sparse array of aggregated buckets with the dimensions symbol_id and
+ * datetime, the bucket start. Every metric is an attribute, metrics which
+ * were not selected are NaN.
+ */
+class Metrics : public DerivedArray {
+public:
+  explicit Metrics(std::string array_name);
+
+  /**
+   * Create metrics array
+   */
+  void createArray(tiledb::FilterList coordinate_filter_list,
+                   tiledb::FilterList offset_filter_list,
+                   tiledb::FilterList attribute_filter_list) override;
+
+  /**
+   * Write the buckets of a run as one fragment
+   * @param symbolIds symbols passed to run
+   * @param buckets result of run
+   * @param metrics selected metrics
+   * @return buckets written
+   */
+  uint64_t write(const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+                 const std::vector<std::vector<AggregateBucket>> &buckets,
+                 const std::vector<Metric> &metrics);
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_AGGREGATE_H
@@ -32,13 +32,22 @@
  */
 
 #include "Array.h"
+#include "PerfCounters.h"
+#include "ResultCache.h"
+#include "ResultStream.h"
+#include "Trace.h"
 #include "buffer.h"
 #include <CLI11.hpp>
 #include <ProgressBar.hpp>
 #include <ThreadPool.h>
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
 #include <date/tz.h>
+#include <fstream>
+#include <future>
 #include <tiledb/tiledb>
+#include <tuple>
 #include <utils.h>
 
 #ifdef __LINUX__
@@ -115,7 +124,10 @@ nyse::Array::parseFileToBuffer(
         mapColumns,
     std::set<std::string> *dimensionFields, char delimiter,
     tiledb::ArraySchema &arraySchema) {
+  TraceSpan span("parse", file_uri);
   uint64_t totalRowsInFile = 0;
+  uint64_t bytesParsed = 0;
+  uint64_t reservedBytes = 0;
   std::unordered_map<std::string, std::shared_ptr<buffer>> buffers;
   std::ifstream is(file_uri);
   if (!is.good())
@@ -182,19 +194,32 @@ nyse::Array::parseFileToBuffer(
   ProgressBar progressBar(file_uri, linesInFile - 1, windowSize);
 
   int rowsParsed = 0;
+  uint64_t source = source_id(file_uri);
   // unsigned long expectedFields = dimensionFields.size() /*-
   // staticColumns.size()*/ + arraySchema.attribute_num();
   std::cout << "starting parsing for " << file_uri << " which is "
             << linesInFile << " rows using batch size " << std::endl;
   //<< batchSize << std::endl;
+  PerfCounters &perfCounters = PerfCounters::instance();
+  bool perfEnabled = perfCounters.enabled();
   for (std::string line; std::getline(is, line);) {
-    std::vector<std::string> fields = split(line, delimiter);
+    bool sampled =
+        perfEnabled && totalRowsInFile % perfCounters.sampleEvery == 0;
+    std::vector<std::string> fields;
+    {
+      PerfStageScope perfScope(PerfStage::Tokenize, sampled, 1,
+                               line.size() + 1);
+      fields = split(line, delimiter);
+    }
     // Trade and quote have a special end file line
     if (totalRowsInFile == linesInFile - 2 && line.substr(0, 3) == "END") {
       break;
     }
     totalRowsInFile++;
+    bytesParsed += line.size() + 1;
     if (arraySchema.attribute_num() > 0) {
+      PerfStageScope perfScope(PerfStage::Convert, sampled, 1,
+                               line.size() + 1);
       for (size_t fieldNum = 0; fieldNum < fields.size(); fieldNum++) {
         const std::string &fieldName = headerFields[fieldNum];
         // Skip dimensions
@@ -207,6 +232,7 @@ nyse::Array::parseFileToBuffer(
       }
     }
 
+    PerfStageScope perfScope(PerfStage::Coords, sampled, 1, line.size() + 1);
     for (const tiledb::Dimension &dimension :
          arraySchema.domain().dimensions()) {
       std::string value;
@@ -294,15 +320,104 @@ nyse::Array::parseFileToBuffer(
     rowsParsed++;
     ++progressBar;
     progressBar.display();
+
+    if (memoryBudget != nullptr && rowsParsed % memoryCheckRows == 0)
+      enforceMemoryBudget(buffers, reservedBytes, headerFields, staticColumns,
+                          source);
   }
   progressBar.done();
   is.close();
+  span.setRows(rowsParsed);
+  span.setBytes(bytesParsed);
+  buffersParsed(source, buffers);
+
+  // With a memory budget each worker writes its own fragment instead of
+  // handing its buffers to be concatenated, which would double the footprint
+  if (memoryBudget != nullptr) {
+    writeFragment(buffers);
+    memoryBudget->release(reservedBytes);
+    buffers.clear();
+  }
   return buffers;
 }
 
+void nyse::Array::enforceMemoryBudget(
+    std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+    uint64_t &reservedBytes, const std::vector<std::string> &headerFields,
+    const std::unordered_map<std::string, std::string> &staticColumns,
+    uint64_t source) {
+  uint64_t bytes = 0;
+  for (const auto &entry : buffers)
+    bytes += bufferBytes(*entry.second);
+  if (bytes <= reservedBytes)
+    return;
+
+  uint64_t needed = bytes - reservedBytes;
+  if (memoryBudget->tryReserve(needed)) {
+    reservedBytes = bytes;
+    return;
+  }
+
+  // Over budget. A worker holding less than its fair share waits for others
+  // to flush first, otherwise (or if waiting does not help) it writes out
+  // what it has so far as a fragment and starts over with empty buffers.
+  uint64_t fairShare = memoryBudget->limit() / std::max(loadThreads, 1u);
+  if (reservedBytes < fairShare &&
+      memoryBudget->waitReserve(needed, std::chrono::milliseconds(100))) {
+    reservedBytes = bytes;
+    return;
+  }
+
+  buffersParsed(source, buffers);
+  writeFragment(buffers);
+  memoryBudget->release(reservedBytes);
+  reservedBytes = 0;
+  buffers = initBuffers(headerFields, staticColumns);
+}
+
+void nyse::Array::writeFragment(
+    const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers) {
+  auto coords = buffers.find(TILEDB_COORDS);
+  if (coords == buffers.end())
+    return;
+  uint64_t rows =
+      std::static_pointer_cast<std::vector<uint64_t>>(coords->second->values)
+          ->size() /
+      array->schema().domain().ndim();
+  if (rows == 0)
+    return;
+
+  // Writes are serialized so TileDB stats and its internal thread pool are
+  // not shared between fragments
+  std::lock_guard<std::mutex> lock(writeMutex);
+  TileDBStatsScope statsScope(tiledbStats,
+                              "fragment write " +
+                                  std::to_string(fragmentsWritten++) + " of " +
+                                  array_uri);
+  TraceSpan span("submit", array_uri);
+  span.setRows(rows);
+  tiledb::Query fragmentQuery(*ctx, *array);
+  fragmentQuery.set_layout(tiledb_layout_t::TILEDB_UNORDERED);
+  setQueryBuffers(fragmentQuery, buffers);
+  if (fragmentQuery.submit() == tiledb::Query::Status::FAILED) {
+    std::cerr << "Query FAILED!!!!!" << std::endl;
+    writeFailed = true;
+  }
+  fragmentQuery.finalize();
+  rowsFlushed += rows;
+}
+
 int nyse::Array::load(const std::vector<std::string> file_uris, char delimiter,
                       uint64_t batchSize, uint32_t threads) {
   unsigned long totalRows = 0;
+  loadThreads = threads;
+  rowsFlushed = 0;
+  writeFailed = false;
+  {
+    std::lock_guard<std::mutex> lock(loadedMutex);
+    loadedStart = std::numeric_limits<uint64_t>::max();
+    loadedEnd = 0;
+  }
 
   ThreadPool pool(threads);
   std::vector<
@@ -311,6 +426,7 @@ int nyse::Array::load(const std::vector<std::string> file_uris, char delimiter,
 
   array = std::make_unique<tiledb::Array>(*ctx, array_uri,
                                           tiledb_query_type_t::TILEDB_WRITE);
+  openedForRead = false;
   query = std::make_unique<tiledb::Query>(*ctx, *array);
 
   query->set_layout(tiledb_layout_t::TILEDB_UNORDERED);
@@ -322,6 +438,8 @@ int nyse::Array::load(const std::vector<std::string> file_uris, char delimiter,
     dimensionFields.emplace(dimension.name());
   }
 
+  StageTimings timings;
+  bool perfEnabled = PerfCounters::instance().enabled();
   auto startTime = std::chrono::steady_clock::now();
 
   for (const std::string &file_uri : file_uris) {
@@ -350,14 +468,25 @@ int nyse::Array::load(const std::vector<std::string> file_uris, char delimiter,
   }
 
   for (auto &result : results) {
-    auto buffers = result.get();
+    result.wait();
+  }
+  auto parsedTime = std::chrono::steady_clock::now();
+  timings.add("parse", parsedTime - startTime);
+
+  for (size_t fileIndex = 0; fileIndex < results.size(); fileIndex++) {
+    TraceSpan span("merge", file_uris[fileIndex]);
+    PerfStageScope perfScope(PerfStage::Merge, perfEnabled, 0);
+    auto buffers = results[fileIndex].get();
     for (auto entry : buffers) {
       std::string bufferName = entry.first;
       if (bufferName == TILEDB_COORDS) {
-        totalRows += std::static_pointer_cast<std::vector<uint64_t>>(
-                         entry.second->values)
-                         ->size() /
-                     dimensionFields.size();
+        uint64_t rows = std::static_pointer_cast<std::vector<uint64_t>>(
+                            entry.second->values)
+                            ->size() /
+                        dimensionFields.size();
+        totalRows += rows;
+        span.setRows(rows);
+        perfScope.setRows(rows);
       }
       auto globalBuffer = globalBuffers.find(bufferName);
       if (globalBuffer != globalBuffers.end()) {
@@ -377,23 +506,104 @@ int nyse::Array::load(const std::vector<std::string> file_uris, char delimiter,
     }
   }
 
-  if (submit_query() == tiledb::Query::Status::FAILED) {
-    std::cerr << "Query FAILED!!!!!" << std::endl;
-  }
+  auto mergedTime = std::chrono::steady_clock::now();
+  timings.add("merge", mergedTime - parsedTime);
 
-  query->finalize();
+  if (!globalBuffers.empty()) {
+    PerfStageScope perfScope(PerfStage::Submit, perfEnabled, totalRows);
+    if (submit_query() == tiledb::Query::Status::FAILED) {
+      std::cerr << "Query FAILED!!!!!" << std::endl;
+      writeFailed = true;
+    }
+    query->finalize();
+  }
 
   array->close();
+  timings.add("submit", std::chrono::steady_clock::now() - mergedTime);
+  totalRows += rowsFlushed;
 
   auto duration = std::chrono::duration_cast<std::chrono::seconds>(
       std::chrono::steady_clock::now() - startTime);
   printf("loaded %ld rows in %s (%.2f rows/second)\n", totalRows,
          beautify_duration(duration).c_str(),
          (float(totalRows)) / duration.count());
+  timings.print();
+  if (memoryBudget != nullptr) {
+    printf("memory budget %.1f MB, peak reserved %.1f MB, %lu fragments\n",
+           memoryBudget->limit() / (1024.0 * 1024.0),
+           memoryBudget->peak() / (1024.0 * 1024.0), fragmentsWritten);
+  }
+  PerfCounters::instance().report();
+
+  // Derived arrays of a failed load would count rows which were not stored
+  if (writeFailed) {
+    if (!loadObservers.empty())
+      std::cerr << "Load of " << array_uri
+                << " failed, derived arrays are not written" << std::endl;
+    return -1;
+  }
+  for (const std::shared_ptr<DerivedArray> &observer : loadObservers) {
+    auto writeStart = std::chrono::steady_clock::now();
+    observer->createArray(tiledb::FilterList(*observer->getCtx()),
+                          tiledb::FilterList(*observer->getCtx()),
+                          tiledb::FilterList(*observer->getCtx()));
+    uint64_t written = observer->writeParsed();
+    auto writeDuration = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - writeStart);
+    printf("wrote %lu %s in %.3f ms\n", written, observer->contents().c_str(),
+           writeDuration.count());
+  }
 
   return 0;
 }
 
+std::pair<uint64_t, uint64_t> nyse::Array::loadedRange() {
+  std::lock_guard<std::mutex> lock(loadedMutex);
+  return {loadedStart, loadedEnd};
+}
+
+void nyse::Array::buffersParsed(
+    uint64_t source,
+    const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers) {
+  trackLoadedRange(buffers);
+  if (loadObservers.empty())
+    return;
+  std::vector<tiledb::Dimension> dimensions =
+      array->schema().domain().dimensions();
+  for (const std::shared_ptr<DerivedArray> &observer : loadObservers)
+    observer->rowsParsed(source, dimensions, buffers);
+}
+
+void nyse::Array::trackLoadedRange(
+    const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers) {
+  auto coords = buffers.find(TILEDB_COORDS);
+  if (coords == buffers.end())
+    return;
+  std::vector<tiledb::Dimension> dimensions =
+      array->schema().domain().dimensions();
+  auto datetime =
+      std::find_if(dimensions.begin(), dimensions.end(),
+                   [](const tiledb::Dimension &dimension) {
+                     return dimension.name() == "datetime";
+                   });
+  if (datetime == dimensions.end())
+    return;
+  uint64_t ndim = dimensions.size();
+  uint64_t datetimeIndex = datetime - dimensions.begin();
+  const std::vector<uint64_t> &coordValues =
+      *std::static_pointer_cast<std::vector<uint64_t>>(coords->second->values);
+
+  uint64_t first = std::numeric_limits<uint64_t>::max();
+  uint64_t last = 0;
+  for (uint64_t i = datetimeIndex; i < coordValues.size(); i += ndim) {
+    first = std::min(first, coordValues[i]);
+    last = std::max(last, coordValues[i]);
+  }
+  std::lock_guard<std::mutex> lock(loadedMutex);
+  loadedStart = std::min(loadedStart, first);
+  loadedEnd = std::max(loadedEnd, last);
+}
+
 void nyse::Array::appendBuffer(const std::string &fieldName,
                                const std::string &valueConst,
                                std::shared_ptr<buffer> buffer) {
@@ -484,129 +694,152 @@ void nyse::Array::appendBuffer(const std::string &fieldName, const T value,
 }
 
 tiledb::Query::Status nyse::Array::submit_query() {
-  for (auto entry : globalBuffers) {
-    std::shared_ptr<buffer> buffer = entry.second;
-    switch (buffer->datatype) {
-    case tiledb_datatype_t::TILEDB_INT32: {
-      std::shared_ptr<std::vector<int32_t>> values =
-          std::static_pointer_cast<std::vector<int32_t>>(buffer->values);
-      if (buffer->offsets != nullptr) {
-        query->set_buffer(entry.first, *buffer->offsets, *values);
-      } else {
-        query->set_buffer(entry.first, *values);
-      }
-      break;
-    }
-    case tiledb_datatype_t::TILEDB_INT64: {
-      std::shared_ptr<std::vector<int64_t>> values =
-          std::static_pointer_cast<std::vector<int64_t>>(buffer->values);
-      if (buffer->offsets != nullptr) {
-        query->set_buffer(entry.first, *buffer->offsets, *values);
-      } else {
-        query->set_buffer(entry.first, *values);
-      }
-      break;
-    }
-    case tiledb_datatype_t::TILEDB_FLOAT32: {
-      std::shared_ptr<std::vector<float>> values =
-          std::static_pointer_cast<std::vector<float>>(buffer->values);
-      if (buffer->offsets != nullptr) {
-        query->set_buffer(entry.first, *buffer->offsets, *values);
-      } else {
-        query->set_buffer(entry.first, *values);
-      }
-      break;
-    }
-    case tiledb_datatype_t::TILEDB_FLOAT64: {
-      std::shared_ptr<std::vector<double>> values =
-          std::static_pointer_cast<std::vector<double>>(buffer->values);
-      if (buffer->offsets != nullptr) {
-        query->set_buffer(entry.first, *buffer->offsets, *values);
-      } else {
-        query->set_buffer(entry.first, *values);
-      }
-      break;
-    }
-    case tiledb_datatype_t::TILEDB_INT8: {
-      std::shared_ptr<std::vector<int8_t>> values =
-          std::static_pointer_cast<std::vector<int8_t>>(buffer->values);
-      if (buffer->offsets != nullptr) {
-        query->set_buffer(entry.first, *buffer->offsets, *values);
-      } else {
-        query->set_buffer(entry.first, *values);
-      }
-      break;
-    }
-    case tiledb_datatype_t::TILEDB_UINT8: {
-      std::shared_ptr<std::vector<uint8_t>> values =
-          std::static_pointer_cast<std::vector<uint8_t>>(buffer->values);
-      if (buffer->offsets != nullptr) {
-        query->set_buffer(entry.first, *buffer->offsets, *values);
-      } else {
-        query->set_buffer(entry.first, *values);
-      }
-      break;
-    }
-    case tiledb_datatype_t::TILEDB_INT16: {
-      std::shared_ptr<std::vector<int16_t>> values =
-          std::static_pointer_cast<std::vector<int16_t>>(buffer->values);
+  TileDBStatsScope statsScope(tiledbStats,
+                              "fragment write " +
+                                  std::to_string(fragmentsWritten++) + " of " +
+                                  array_uri);
+  TraceSpan span("submit", array_uri);
+  setQueryBuffers(*query, globalBuffers);
+  return query->submit();
+}
+
+void nyse::Array::setQueryBuffers(
+    tiledb::Query &query,
+    const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers) {
+  for (const auto &entry : buffers) {
+    const std::shared_ptr<buffer> &buffer = entry.second;
+    dispatchDatatype(buffer->datatype, [&](auto type) {
+      using T = decltype(type);
+      std::shared_ptr<std::vector<T>> values =
+          std::static_pointer_cast<std::vector<T>>(buffer->values);
       if (buffer->offsets != nullptr) {
-        query->set_buffer(entry.first, *buffer->offsets, *values);
+        query.set_buffer(entry.first, *buffer->offsets, *values);
       } else {
-        query->set_buffer(entry.first, *values);
+        query.set_buffer(entry.first, *values);
       }
-      break;
+    });
+  }
+}
+
+void nyse::setSubarray(tiledb::Query &query, tiledb_datatype_t domainType,
+                       const std::vector<uint64_t> &subarray) {
+  dispatchDatatype(domainType, [&](auto type) {
+    using T = decltype(type);
+    query.set_subarray(std::vector<T>(subarray.begin(), subarray.end()));
+  });
+}
+
+uint64_t nyse::dimensionIndex(const std::vector<tiledb::Dimension> &dimensions,
+                              const std::string &name) {
+  for (uint64_t d = 0; d < dimensions.size(); d++) {
+    if (dimensions[d].name() == name)
+      return d;
+  }
+  throw std::runtime_error("Array has no " + name + " dimension");
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> nyse::Array::nonEmptyDomain() {
+  openForRead();
+  std::vector<std::pair<uint64_t, uint64_t>> domain;
+  dispatchDatatype(array->schema().domain().type(), [&](auto type) {
+    using T = decltype(type);
+    for (const auto &dimension : array->non_empty_domain<T>())
+      domain.emplace_back(dimension.second.first, dimension.second.second);
+  });
+  return domain;
+}
+
+void nyse::Array::allocateReadBuffers(
+    tiledb::Array &array, const std::vector<uint64_t> &subarray,
+    std::unordered_map<std::string, std::shared_ptr<buffer>> &readBuffers) {
+  if (readBuffers.empty()) {
+    tiledb::ArraySchema arraySchema = array.schema();
+    std::set<std::string> projected(columns.begin(), columns.end());
+    bool anyDimension = columns.empty();
+    for (const tiledb::Dimension &dimension :
+         arraySchema.domain().dimensions()) {
+      if (projected.count(dimension.name()))
+        anyDimension = true;
     }
-    case tiledb_datatype_t::TILEDB_UINT16: {
-      std::shared_ptr<std::vector<uint16_t>> values =
-          std::static_pointer_cast<std::vector<uint16_t>>(buffer->values);
-      if (buffer->offsets != nullptr) {
-        query->set_buffer(entry.first, *buffer->offsets, *values);
-      } else {
-        query->set_buffer(entry.first, *values);
-      }
-      break;
+
+    tiledb_datatype_t domainType = arraySchema.domain().type();
+    if (anyDimension)
+      readBuffers.emplace(TILEDB_COORDS,
+                          std::make_shared<buffer>(buffer{
+                              nullptr, createBuffer(domainType), domainType}));
+    for (const auto &entry : arraySchema.attributes()) {
+      if (!columns.empty() && !projected.count(entry.first))
+        continue;
+      tiledb_datatype_t type = entry.second.type();
+      std::shared_ptr<std::vector<uint64_t>> offsets;
+      if (entry.second.variable_sized())
+        offsets = std::static_pointer_cast<std::vector<uint64_t>>(
+            createBuffer(TILEDB_UINT64));
+      readBuffers.emplace(entry.first, std::make_shared<buffer>(buffer{
+                                           offsets, createBuffer(type), type}));
     }
-    case tiledb_datatype_t::TILEDB_UINT32: {
-      std::shared_ptr<std::vector<uint32_t>> values =
-          std::static_pointer_cast<std::vector<uint32_t>>(buffer->values);
-      if (buffer->offsets != nullptr) {
-        query->set_buffer(entry.first, *buffer->offsets, *values);
-      } else {
-        query->set_buffer(entry.first, *values);
+  }
+
+  // The estimates are upper bounds, so large subarrays start at buffer_size
+  // and small ones only allocate what they can return
+  ResultElements estimates;
+  dispatchDatatype(array.schema().domain().type(), [&](auto type) {
+    using T = decltype(type);
+    estimates = array.max_buffer_elements(
+        std::vector<T>(subarray.begin(), subarray.end()));
+  });
+  for (const auto &entry : readBuffers) {
+    const std::shared_ptr<buffer> &buffer = entry.second;
+    uint64_t offsetElements = buffer_size / sizeof(uint64_t);
+    uint64_t valueElements = 0;
+    auto estimate = estimates.find(entry.first);
+
+    dispatchDatatype(buffer->datatype, [&](auto type) {
+      using T = decltype(type);
+      valueElements = buffer_size / sizeof(T);
+      if (estimate != estimates.end()) {
+        offsetElements = std::min(offsetElements, estimate->second.first);
+        valueElements = std::min(valueElements, estimate->second.second);
       }
-      break;
+      valueElements = std::max(valueElements, minReadBufferElements);
+      auto values = std::static_pointer_cast<std::vector<T>>(buffer->values);
+      if (values->size() < valueElements)
+        values->resize(valueElements);
+    });
+
+    if (buffer->offsets != nullptr) {
+      offsetElements = std::max(offsetElements, minReadBufferElements);
+      if (buffer->offsets->size() < offsetElements)
+        buffer->offsets->resize(offsetElements);
     }
-    case tiledb_datatype_t::TILEDB_UINT64: {
-      std::shared_ptr<std::vector<uint64_t>> values =
-          std::static_pointer_cast<std::vector<uint64_t>>(buffer->values);
-      if (buffer->offsets != nullptr) {
-        query->set_buffer(entry.first, *buffer->offsets, *values);
-      } else {
-        query->set_buffer(entry.first, *values);
+  }
+}
+
+bool nyse::Array::growReadBuffers(
+    std::unordered_map<std::string, std::shared_ptr<buffer>> &readBuffers) {
+  bool grown = false;
+  for (const auto &entry : readBuffers) {
+    const std::shared_ptr<buffer> &buffer = entry.second;
+    dispatchDatatype(buffer->datatype, [&](auto type) {
+      using T = decltype(type);
+      auto values = std::static_pointer_cast<std::vector<T>>(buffer->values);
+      uint64_t elements = std::min<uint64_t>(values->size() * 2,
+                                             maxReadBufferSize / sizeof(T));
+      if (elements > values->size()) {
+        values->resize(elements);
+        grown = true;
       }
-      break;
-    }
-    case tiledb_datatype_t::TILEDB_CHAR:
-    case tiledb_datatype_t::TILEDB_STRING_ASCII:
-    case tiledb_datatype_t::TILEDB_STRING_UTF8:
-    case tiledb_datatype_t::TILEDB_STRING_UTF16:
-    case tiledb_datatype_t::TILEDB_STRING_UTF32:
-    case tiledb_datatype_t::TILEDB_STRING_UCS2:
-    case tiledb_datatype_t::TILEDB_STRING_UCS4:
-    case tiledb_datatype_t::TILEDB_ANY: {
-      std::shared_ptr<std::vector<char>> values =
-          std::static_pointer_cast<std::vector<char>>(buffer->values);
-      if (buffer->offsets != nullptr) {
-        query->set_buffer(entry.first, *buffer->offsets, *values);
-      } else {
-        query->set_buffer(entry.first, *values);
+    });
+    if (buffer->offsets != nullptr) {
+      uint64_t elements = std::min<uint64_t>(
+          buffer->offsets->size() * 2, maxReadBufferSize / sizeof(uint64_t));
+      if (elements > buffer->offsets->size()) {
+        buffer->offsets->resize(elements);
+        grown = true;
       }
-      break;
-    }
     }
   }
-  return query->submit();
+  return grown;
 }
 
 std::unordered_map<std::string, std::shared_ptr<nyse::buffer>>
@@ -900,3 +1133,744 @@ void nyse::Array::concatOffsets(
 const std::shared_ptr<tiledb::Context> &nyse::Array::getCtx() const {
   return ctx;
 }
+
+void nyse::Array::setCtx(std::shared_ptr<tiledb::Context> ctx) {
+  query.reset(nullptr);
+  array.reset(nullptr);
+  openedForRead = false;
+  this->ctx = std::move(ctx);
+}
+
+void nyse::Array::openForRead() {
+  if (array != nullptr && openedForRead)
+    return;
+  query.reset(nullptr);
+  array = std::make_unique<tiledb::Array>(*ctx, array_uri,
+                                          tiledb_query_type_t::TILEDB_READ);
+  openedForRead = true;
+}
+
+uint64_t nyse::Array::readSample(std::string outfile, std::string delimiter) {
+  openForRead();
+
+  // Select the entire non-empty domain of every dimension
+  std::vector<uint64_t> subarray;
+  for (const auto &dimension : nonEmptyDomain()) {
+    subarray.push_back(dimension.first);
+    subarray.push_back(dimension.second);
+  }
+
+  std::ofstream output;
+  if (!outfile.empty()) {
+    output.open(outfile, std::ios::binary);
+  }
+  beginExport(output.is_open() ? &output : nullptr);
+  uint64_t rows =
+      read(subarray, output.is_open() ? &output : nullptr, delimiter);
+  endExport();
+  return rows;
+}
+
+std::vector<uint64_t> nyse::Array::symbolSubarray(
+    uint64_t symbolId, uint64_t start, uint64_t end,
+    const std::vector<std::pair<uint64_t, uint64_t>> &nonEmptyDomain) {
+  // Clip the symbol and time range to the data, the subarray must lie within
+  // the domain
+  if (nonEmptyDomain.size() < 2)
+    return {};
+  if (symbolId < nonEmptyDomain[0].first ||
+      symbolId > nonEmptyDomain[0].second)
+    return {};
+  start = std::max(start, nonEmptyDomain[1].first);
+  end = std::min(end, nonEmptyDomain[1].second);
+  if (start > end)
+    return {};
+
+  // symbol_id and datetime are the first two dimensions, any remaining
+  // dimensions are read in full
+  std::vector<uint64_t> subarray = {symbolId, symbolId, start, end};
+  for (size_t i = 2; i < nonEmptyDomain.size(); i++) {
+    subarray.push_back(nonEmptyDomain[i].first);
+    subarray.push_back(nonEmptyDomain[i].second);
+  }
+  return subarray;
+}
+
+uint64_t nyse::Array::querySymbols(
+    const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+    uint64_t start, uint64_t end, const std::string &outfile,
+    const std::string &delimiter) {
+  auto nonEmptyDomain = this->nonEmptyDomain();
+
+  std::ofstream output;
+  if (!outfile.empty()) {
+    output.open(outfile, std::ios::binary);
+  }
+
+  uint64_t totalRows = 0;
+  beginExport(output.is_open() ? &output : nullptr);
+  for (const auto &symbolId : symbolIds) {
+    std::vector<uint64_t> subarray =
+        symbolSubarray(symbolId.second, start, end, nonEmptyDomain);
+    if (subarray.empty()) {
+      printf("query %s (symbol_id %lu): symbol or time range has no "
+             "data\n",
+             symbolId.first.c_str(), symbolId.second);
+      continue;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    uint64_t rows =
+        read(subarray, output.is_open() ? &output : nullptr, delimiter);
+    auto latency = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - startTime);
+    printf("query %s (symbol_id %lu): %lu rows in %.3f ms\n",
+           symbolId.first.c_str(), symbolId.second, rows, latency.count());
+    totalRows += rows;
+  }
+  endExport();
+  return totalRows;
+}
+
+uint64_t nyse::Array::querySymbol(uint64_t symbolId, uint64_t start,
+                                  uint64_t end, std::ostream *output,
+                                  const std::string &delimiter) {
+  std::vector<uint64_t> subarray =
+      symbolSubarray(symbolId, start, end, nonEmptyDomain());
+  uint64_t rows = 0;
+  beginExport(output);
+  if (!subarray.empty())
+    rows = read(subarray, output, delimiter);
+  endExport();
+  return rows;
+}
+
+std::vector<std::string> nyse::Array::outputColumns() {
+  if (!columns.empty())
+    return columns;
+  std::vector<std::string> all;
+  tiledb::ArraySchema arraySchema = array->schema();
+  for (const tiledb::Dimension &dimension : arraySchema.domain().dimensions())
+    all.push_back(dimension.name());
+  for (unsigned i = 0; i < arraySchema.attribute_num(); i++)
+    all.push_back(arraySchema.attribute(i).name());
+  return all;
+}
+
+uint64_t nyse::Array::submitRead(
+    tiledb::Query &query,
+    std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+    const std::string &countColumn, uint64_t ndim,
+    const std::function<void(uint64_t, ResultElements &)> &onBatch) {
+  uint64_t rows_read = 0;
+  tiledb::Query::Status status;
+  do {
+    TraceSpan submitSpan("read", array_uri);
+    query.submit();
+    status = query.query_status();
+
+    // Rows are counted from the coordinates when fetched, otherwise from the
+    // first projected attribute
+    ResultElements resultElements = query.result_buffer_elements();
+    uint64_t result_num;
+    if (countColumn == TILEDB_COORDS)
+      result_num = resultElements[countColumn].second / ndim;
+    else if (buffers.at(countColumn)->offsets != nullptr)
+      result_num = resultElements[countColumn].first;
+    else
+      result_num = resultElements[countColumn].second;
+    rows_read += result_num;
+    submitSpan.setRows(result_num);
+    submitSpan.end();
+
+    if (status == tiledb::Query::Status::INCOMPLETE && result_num == 0) {
+      // Not even one cell fit, grow the buffers and resubmit
+      if (!growReadBuffers(buffers)) {
+        std::cerr << "Read buffers reached their limit without fitting a "
+                     "single cell, aborting after "
+                  << rows_read << " rows" << std::endl;
+        break;
+      }
+      setQueryBuffers(query, buffers);
+      continue;
+    }
+    resultsRead(buffers, resultElements, result_num);
+    onBatch(result_num, resultElements);
+  } while (status == tiledb::Query::Status::INCOMPLETE);
+  return rows_read;
+}
+
+std::vector<std::function<void(nyse::CsvWriter &, uint64_t)>>
+nyse::Array::columnFormatters(
+    const std::vector<std::string> &outputColumns,
+    const std::vector<tiledb::Dimension> &dimensions,
+    const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+    const ResultElements &resultElements, uint64_t rows) {
+  std::vector<std::function<void(CsvWriter &, uint64_t)>> formatters;
+  const uint64_t ndim = dimensions.size();
+  for (const std::string &column : outputColumns) {
+    for (uint64_t d = 0; d < ndim; d++) {
+      if (dimensions[d].name() != column)
+        continue;
+      const std::shared_ptr<buffer> &coords = buffers.at(TILEDB_COORDS);
+      dispatchDatatype(coords->datatype, [&](auto type) {
+        using T = decltype(type);
+        const T *values =
+            std::static_pointer_cast<std::vector<T>>(coords->values)->data();
+        formatters.emplace_back(
+            [values, ndim, d](CsvWriter &writer, uint64_t i) {
+              writer.appendValue(values[i * ndim + d]);
+            });
+      });
+    }
+    auto attribute = buffers.find(column);
+    if (attribute == buffers.end())
+      continue;
+    const std::shared_ptr<buffer> &buf = attribute->second;
+    uint64_t resultValues = resultElements.at(column).second;
+    dispatchDatatype(buf->datatype, [&](auto type) {
+      using T = decltype(type);
+      const T *values =
+          std::static_pointer_cast<std::vector<T>>(buf->values)->data();
+      if (buf->offsets == nullptr) {
+        formatters.emplace_back([values](CsvWriter &writer, uint64_t i) {
+          writer.appendValue(values[i]);
+        });
+        return;
+      }
+      // Offsets are in bytes
+      const uint64_t *offsets = buf->offsets->data();
+      uint64_t valuesBytes = resultValues * sizeof(T);
+      formatters.emplace_back(
+          [values, offsets, valuesBytes, rows](CsvWriter &writer, uint64_t i) {
+            uint64_t end = i + 1 == rows ? valuesBytes : offsets[i + 1];
+            writer.append(reinterpret_cast<const char *>(values) + offsets[i],
+                          end - offsets[i]);
+          });
+    });
+  }
+  return formatters;
+}
+
+/**
+ * Format rows with one formatter per column
+ */
+static void
+formatColumns(nyse::CsvWriter &writer,
+              const std::vector<std::function<void(nyse::CsvWriter &,
+                                                   uint64_t)>> &formatters,
+              uint64_t begin, uint64_t end) {
+  for (uint64_t i = begin; i < end; i++) {
+    for (size_t c = 0; c < formatters.size(); c++) {
+      if (c > 0)
+        writer.appendDelimiter();
+      formatters[c](writer, i);
+    }
+    writer.appendNewline();
+  }
+}
+
+std::string nyse::Array::fragmentSet() {
+  tiledb::VFS vfs(*ctx);
+  std::vector<std::string> fragments;
+  for (std::string uri : vfs.ls(array_uri)) {
+    if (!uri.empty() && uri.back() == '/')
+      uri.pop_back();
+    std::string name = uri.substr(uri.find_last_of('/') + 1);
+    if (name.compare(0, 2, "__") != 0)
+      continue;
+    // A fragment is only visible once its metadata is written, which is
+    // checked once per fragment
+    if (!completeFragments.count(name)) {
+      if (!vfs.is_file(uri + "/__fragment_metadata.tdb"))
+        continue;
+      completeFragments.insert(name);
+    }
+    fragments.push_back(std::move(name));
+  }
+  std::sort(fragments.begin(), fragments.end());
+
+  std::string joined;
+  for (const std::string &fragment : fragments)
+    joined += fragment + "\n";
+  return joined;
+}
+
+std::string nyse::Array::resultCacheKey(const std::vector<uint64_t> &subarray) {
+  // Reopen when fragments were added or consolidated since the array was
+  // opened, so reads and cached results reflect them
+  std::string fragments = fragmentSet();
+  if (fragments != openedFragments) {
+    if (!openedFragments.empty() && openedForRead) {
+      query.reset(nullptr);
+      array.reset(nullptr);
+      openedForRead = false;
+    }
+    openedFragments = fragments;
+    ResultCache::instance().setFragments(array_uri, fragments);
+  }
+  openForRead();
+
+  std::string key = array_uri + "|" +
+                    std::to_string(std::hash<std::string>()(fragments)) + "|";
+  for (uint64_t bound : subarray)
+    key += std::to_string(bound) + ",";
+  key += "|";
+  for (const std::string &column : outputColumns())
+    key += column + ",";
+  return key;
+}
+
+void nyse::Array::writeBatch(
+    const std::vector<std::string> &outputColumns,
+    const std::vector<tiledb::Dimension> &dimensions,
+    const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+    const ResultElements &resultElements, uint64_t rows, std::ostream &output,
+    const std::string &delimiter) {
+  TraceSpan formatSpan("format", array_uri);
+  formatSpan.setRows(rows);
+  if (arrowWriter != nullptr) {
+    writeArrowBatch(outputColumns, dimensions, buffers, resultElements, rows);
+    return;
+  }
+  auto formatters = columnFormatters(outputColumns, dimensions, buffers,
+                                     resultElements, rows);
+  writeRows(rows, output, delimiter,
+            [&formatters](CsvWriter &writer, uint64_t begin, uint64_t end) {
+              formatColumns(writer, formatters, begin, end);
+            });
+}
+
+uint64_t nyse::Array::read(const std::vector<uint64_t> &subarray,
+                           std::ostream *output,
+                           const std::string &delimiter) {
+  ResultCache &cache = ResultCache::instance();
+  std::string cacheKey;
+  std::shared_ptr<CachedResult> record;
+  if (cache.enabled()) {
+    cacheKey = resultCacheKey(subarray);
+    std::shared_ptr<const CachedResult> cached = cache.find(cacheKey);
+    if (cached != nullptr) {
+      if (output == nullptr)
+        return cached->rows;
+      std::vector<tiledb::Dimension> dimensions =
+          array->schema().domain().dimensions();
+      std::vector<std::string> outputColumns = this->outputColumns();
+      for (const CachedBatch &batch : cached->batches)
+        writeBatch(outputColumns, dimensions, batch.buffers,
+                   batch.resultElements, batch.rows, *output, delimiter);
+      return cached->rows;
+    }
+    record = std::make_shared<CachedResult>();
+  }
+
+  // Arrow batches are written from a single query so they stay in order.
+  // Partitioned reads are not cached.
+  if (parallelRead && readThreads > 1 && arrowWriter == nullptr)
+    return readPartitioned(subarray, output, delimiter);
+
+  openForRead();
+  std::vector<tiledb::Dimension> dimensions =
+      array->schema().domain().dimensions();
+  std::vector<std::string> outputColumns = this->outputColumns();
+
+  // Each batch is formatted while the stream fetches the next one
+  ResultStream stream(*this, subarray);
+  for (const ResultBatch &batch : stream) {
+    // Results larger than the whole cache are not kept
+    if (record != nullptr &&
+        !record->append(batch.buffers(), batch.resultElements(), batch.rows(),
+                        cache.capacity()))
+      record.reset();
+    if (output != nullptr)
+      writeBatch(outputColumns, dimensions, batch.buffers(),
+                 batch.resultElements(), batch.rows(), *output, delimiter);
+  }
+  if (record != nullptr)
+    cache.insert(array_uri, cacheKey, std::move(record));
+  return stream.rows();
+}
+
+void nyse::Array::writeArrowBatch(
+    const std::vector<std::string> &outputColumns,
+    const std::vector<tiledb::Dimension> &dimensions,
+    const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+    const ResultElements &resultElements, uint64_t rows) {
+  const uint64_t ndim = dimensions.size();
+  std::vector<ArrowColumn> columns;
+  // Dimensions are interleaved in the coordinates and have to be copied out,
+  // attributes are written straight from the read buffers
+  arrowScratch.resize(ndim);
+  for (const std::string &column : outputColumns) {
+    for (uint64_t d = 0; d < ndim; d++) {
+      if (dimensions[d].name() != column)
+        continue;
+      const std::shared_ptr<buffer> &coords = buffers.at(TILEDB_COORDS);
+      dispatchDatatype(coords->datatype, [&](auto type) {
+        using T = decltype(type);
+        const T *values =
+            std::static_pointer_cast<std::vector<T>>(coords->values)->data();
+        arrowScratch[d].resize(rows * sizeof(T));
+        T *dimension = reinterpret_cast<T *>(arrowScratch[d].data());
+        for (uint64_t i = 0; i < rows; i++)
+          dimension[i] = values[i * ndim + d];
+        columns.push_back({dimension, rows * sizeof(T), nullptr});
+      });
+    }
+    auto attribute = buffers.find(column);
+    if (attribute == buffers.end())
+      continue;
+    const std::shared_ptr<buffer> &buf = attribute->second;
+    dispatchDatatype(buf->datatype, [&](auto type) {
+      using T = decltype(type);
+      const T *values =
+          std::static_pointer_cast<std::vector<T>>(buf->values)->data();
+      uint64_t valuesBytes = resultElements.at(column).second * sizeof(T);
+      columns.push_back({values, valuesBytes,
+                         buf->offsets != nullptr ? buf->offsets->data()
+                                                 : nullptr});
+    });
+  }
+  arrowWriter->writeBatch(rows, columns);
+}
+
+void nyse::Array::beginExport(std::ostream *output) {
+  if (output == nullptr || exportFormat == ExportFormat::Csv)
+    return;
+
+  openForRead();
+  tiledb::ArraySchema arraySchema = array->schema();
+  auto attributes = arraySchema.attributes();
+  std::vector<ArrowField> fields;
+  for (const std::string &column : outputColumns()) {
+    auto attribute = attributes.find(column);
+    if (attribute != attributes.end()) {
+      fields.push_back({column, attribute->second.type(),
+                        attribute->second.variable_sized()});
+    } else {
+      fields.push_back({column, arraySchema.domain().type(), false});
+    }
+  }
+  arrowWriter = std::make_unique<ArrowWriter>(
+      *output, exportFormat == ExportFormat::ArrowFile);
+  arrowWriter->writeSchema(fields);
+}
+
+void nyse::Array::endExport() {
+  if (arrowWriter == nullptr)
+    return;
+  arrowWriter->finish();
+  arrowWriter.reset();
+}
+
+std::vector<std::vector<uint64_t>>
+nyse::partitionSubarray(const std::vector<uint64_t> &subarray,
+                        const std::vector<tiledb::Dimension> &dimensions,
+                        uint64_t partitions) {
+  std::vector<std::vector<uint64_t>> result;
+  if (dimensions.empty() || partitions <= 1) {
+    result.push_back(subarray);
+    return result;
+  }
+
+  // Tile index range a dimension's subarray range covers
+  auto tileRange = [&](size_t d) {
+    uint64_t low = 0;
+    uint64_t extent = 1;
+    dispatchDatatype(dimensions[d].type(), [&](auto type) {
+      using T = decltype(type);
+      low = static_cast<uint64_t>(dimensions[d].domain<T>().first);
+      extent = std::max<uint64_t>(dimensions[d].tile_extent<T>(), 1);
+    });
+    return std::make_tuple(low, extent, (subarray[2 * d] - low) / extent,
+                           (subarray[2 * d + 1] - low) / extent);
+  };
+  // Split tiles [first, last] into at most groups ranges of whole tiles,
+  // clipped to the subarray
+  auto splitTiles = [&](size_t d, uint64_t groups) {
+    uint64_t low, extent, first, last;
+    std::tie(low, extent, first, last) = tileRange(d);
+    uint64_t tiles = last - first + 1;
+    groups = std::min(groups, tiles);
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    for (uint64_t g = 0; g < groups; g++) {
+      uint64_t beginTile = first + tiles * g / groups;
+      uint64_t endTile = first + tiles * (g + 1) / groups - 1;
+      uint64_t begin = std::max(subarray[2 * d], low + beginTile * extent);
+      uint64_t end = endTile == last ? subarray[2 * d + 1]
+                                     : low + (endTile + 1) * extent - 1;
+      ranges.emplace_back(begin, end);
+    }
+    return ranges;
+  };
+
+  // Partitions are generated in tile order so that concatenating their global
+  // order results gives the global order of the whole subarray. Whole rows of
+  // first dimension tiles are used when there are enough of them, otherwise
+  // each is split further along the second dimension.
+  auto firstRanges = splitTiles(0, partitions);
+  uint64_t secondGroups = 1;
+  if (firstRanges.size() < partitions && dimensions.size() > 1)
+    secondGroups = (partitions + firstRanges.size() - 1) / firstRanges.size();
+
+  for (const auto &first : firstRanges) {
+    std::vector<std::pair<uint64_t, uint64_t>> secondRanges;
+    if (secondGroups > 1)
+      secondRanges = splitTiles(1, secondGroups);
+    else if (dimensions.size() > 1)
+      secondRanges.emplace_back(subarray[2], subarray[3]);
+
+    if (secondRanges.empty()) {
+      result.push_back({first.first, first.second});
+      continue;
+    }
+    for (const auto &second : secondRanges) {
+      std::vector<uint64_t> partition = subarray;
+      partition[0] = first.first;
+      partition[1] = first.second;
+      partition[2] = second.first;
+      partition[3] = second.second;
+      result.push_back(partition);
+    }
+  }
+  return result;
+}
+
+uint64_t nyse::Array::readPartitioned(const std::vector<uint64_t> &subarray,
+                                      std::ostream *output,
+                                      const std::string &delimiter) {
+  openForRead();
+  tiledb::ArraySchema arraySchema = array->schema();
+  std::vector<tiledb::Dimension> dimensions =
+      arraySchema.domain().dimensions();
+  std::vector<std::string> outputColumns = this->outputColumns();
+
+  // Several partitions per thread to balance uneven tiles
+  std::vector<std::vector<uint64_t>> partitions =
+      partitionSubarray(subarray, dimensions, uint64_t(readThreads) * 4);
+
+  // In ordered mode each partition is formatted into its own writer and
+  // written once all earlier partitions are out. Workers may only run
+  // readThreads partitions ahead of the writer, bounding the formatted
+  // output held in memory.
+  bool buffered = readOrdered && output != nullptr;
+  std::vector<CsvWriter> partitionOutput(
+      readOrdered ? partitions.size() : 0, CsvWriter(delimiter));
+  std::vector<std::promise<void>> partitionDone(partitions.size());
+  std::mutex outputMutex;
+  std::mutex progressMutex;
+  std::condition_variable progress;
+  uint64_t writtenPartitions = 0;
+  bool aborted = false;
+  std::atomic<uint64_t> nextPartition{0};
+  std::atomic<uint64_t> totalRows{0};
+
+  // Each worker has its own array handle, query and buffers
+  auto worker = [&]() {
+    std::unique_ptr<tiledb::Array> workerArray;
+    std::unordered_map<std::string, std::shared_ptr<buffer>> buffers;
+    CsvWriter unorderedWriter(delimiter);
+
+    for (uint64_t p = nextPartition++; p < partitions.size();
+         p = nextPartition++) {
+      if (buffered) {
+        std::unique_lock<std::mutex> lock(progressMutex);
+        progress.wait(lock, [&]() {
+          return aborted || p < writtenPartitions + readThreads;
+        });
+        if (aborted)
+          return;
+      }
+      try {
+        if (workerArray == nullptr)
+          workerArray =
+              std::make_unique<tiledb::Array>(*ctx, array_uri, TILEDB_READ);
+        tiledb::Query partitionQuery(*ctx, *workerArray);
+        partitionQuery.set_layout(tiledb_layout_t::TILEDB_GLOBAL_ORDER);
+        setSubarray(partitionQuery, arraySchema.domain().type(),
+                    partitions[p]);
+        allocateReadBuffers(*workerArray, partitions[p], buffers);
+        setQueryBuffers(partitionQuery, buffers);
+        std::string countColumn = buffers.count(TILEDB_COORDS)
+                                      ? std::string(TILEDB_COORDS)
+                                      : outputColumns.front();
+
+        CsvWriter &writer =
+            readOrdered ? partitionOutput[p] : unorderedWriter;
+        totalRows += submitRead(
+            partitionQuery, buffers, countColumn, dimensions.size(),
+            [&](uint64_t rows, ResultElements &resultElements) {
+              if (output == nullptr)
+                return;
+              TraceSpan formatSpan("format", array_uri);
+              formatSpan.setRows(rows);
+              auto formatters = columnFormatters(
+                  outputColumns, dimensions, buffers, resultElements, rows);
+              if (!readOrdered)
+                writer.clear();
+              formatColumns(writer, formatters, 0, rows);
+              if (!readOrdered) {
+                std::lock_guard<std::mutex> lock(outputMutex);
+                writer.writeTo(*output);
+              }
+            });
+        partitionDone[p].set_value();
+      } catch (...) {
+        partitionDone[p].set_exception(std::current_exception());
+      }
+    }
+  };
+
+  if (formatPool == nullptr)
+    formatPool = std::make_unique<ThreadPool>(readThreads);
+  std::vector<std::future<void>> workers;
+  for (uint32_t t = 0; t < readThreads; t++)
+    workers.emplace_back(formatPool->enqueue(worker));
+
+  // Workers reference this frame, a failed partition stops the others and
+  // is only rethrown once all of them returned
+  std::exception_ptr error;
+  for (size_t p = 0; p < partitions.size(); p++) {
+    try {
+      partitionDone[p].get_future().get();
+    } catch (...) {
+      error = std::current_exception();
+      break;
+    }
+    if (buffered) {
+      partitionOutput[p].writeTo(*output);
+      // Release the partition's memory once written
+      partitionOutput[p] = CsvWriter();
+      {
+        std::lock_guard<std::mutex> lock(progressMutex);
+        writtenPartitions = p + 1;
+      }
+      progress.notify_all();
+    }
+  }
+  if (error != nullptr) {
+    {
+      std::lock_guard<std::mutex> lock(progressMutex);
+      aborted = true;
+    }
+    progress.notify_all();
+  }
+  for (auto &future : workers)
+    future.get();
+  if (error != nullptr)
+    std::rethrow_exception(error);
+
+  return totalRows;
+}
+
+void nyse::Array::writeRows(
+    uint64_t rows, std::ostream &output, const std::string &delimiter,
+    const std::function<void(CsvWriter &, uint64_t, uint64_t)> &formatRows) {
+  uint64_t chunks = (rows + formatChunkRows - 1) / formatChunkRows;
+  // Keep every worker busy while the oldest chunk is written out
+  size_t slots = std::min<uint64_t>(chunks, uint64_t(readThreads) * 2);
+  if (slots == 0)
+    return;
+  if (formatWriters.size() < slots)
+    formatWriters.resize(slots);
+  for (CsvWriter &writer : formatWriters)
+    writer.setDelimiter(delimiter);
+
+  if (chunks == 1 || readThreads <= 1) {
+    CsvWriter &writer = formatWriters[0];
+    for (uint64_t begin = 0; begin < rows; begin += formatChunkRows) {
+      writer.clear();
+      formatRows(writer, begin, std::min(rows, begin + formatChunkRows));
+      writer.writeTo(output);
+    }
+    return;
+  }
+
+  if (formatPool == nullptr)
+    formatPool = std::make_unique<ThreadPool>(readThreads);
+
+  auto enqueueChunk = [&](uint64_t chunk) {
+    CsvWriter &writer = formatWriters[chunk % slots];
+    uint64_t begin = chunk * formatChunkRows;
+    uint64_t end = std::min(rows, begin + formatChunkRows);
+    return formatPool->enqueue([&writer, &formatRows, begin, end]() {
+      writer.clear();
+      formatRows(writer, begin, end);
+    });
+  };
+
+  std::vector<std::future<void>> pending(slots);
+  for (uint64_t chunk = 0; chunk < slots; chunk++)
+    pending[chunk] = enqueueChunk(chunk);
+
+  // Write chunks in order, reusing each slot for the chunk `slots` ahead
+  for (uint64_t chunk = 0; chunk < chunks; chunk++) {
+    pending[chunk % slots].get();
+    formatWriters[chunk % slots].writeTo(output);
+    if (chunk + slots < chunks)
+      pending[chunk % slots] = enqueueChunk(chunk + slots);
+  }
+}
+
+void nyse::Array::consolidate() {
+  TileDBStatsScope statsScope(tiledbStats, "consolidate of " + array_uri);
+  TraceSpan span("consolidate", array_uri);
+  tiledb::Array::consolidate(*ctx, array_uri);
+}
+
+void nyse::Array::setTileDBStats(bool enabled) { tiledbStats = enabled; }
+
+bool nyse::Array::setColumns(const std::vector<std::string> &columns) {
+  if (columns == this->columns)
+    return true;
+  tiledb::ArraySchema arraySchema(*ctx, array_uri);
+  std::set<std::string> known;
+  for (const tiledb::Dimension &dimension : arraySchema.domain().dimensions())
+    known.emplace(dimension.name());
+  for (const auto &entry : arraySchema.attributes())
+    known.emplace(entry.first);
+
+  for (const std::string &column : columns) {
+    if (known.find(column) == known.end()) {
+      std::cerr << "Column " << column << " is not in array " << array_uri
+                << std::endl;
+      return false;
+    }
+  }
+  this->columns = columns;
+  readBuffers.clear();
+  prefetchBuffers.clear();
+  return true;
+}
+
+void nyse::Array::setExportFormat(ExportFormat format) {
+  exportFormat = format;
+}
+
+void nyse::Array::setParallelRead(bool enabled, bool ordered) {
+  parallelRead = enabled;
+  readOrdered = ordered;
+}
+
+void nyse::Array::setReadThreads(uint32_t threads) {
+  readThreads = std::max<uint32_t>(threads, 1);
+  formatPool.reset();
+}
+
+void nyse::Array::addLoadObserver(std::shared_ptr<DerivedArray> observer) {
+  loadObservers.push_back(std::move(observer));
+}
+
+int nyse::DerivedArray::load(const std::vector<std::string>, char, uint64_t,
+                             uint32_t) {
+  std::cerr << origin << ", " << array_uri << " can not be loaded from files"
+            << std::endl;
+  return -1;
+}
+
+void nyse::Array::setMaxMemory(uint64_t bytes) {
+  if (bytes == 0)
+    memoryBudget.reset();
+  else
+    memoryBudget = std::make_shared<MemoryBudget>(bytes);
+}
@@ -34,18 +34,47 @@
 #ifndef NYSE_INGESTOR_ARRAY_H
 #define NYSE_INGESTOR_ARRAY_H
 
+#include "ArrowWriter.h"
+#include "CsvWriter.h"
+#include "MemoryBudget.h"
+#include "Stats.h"
 #include "buffer.h"
+#include <ThreadPool.h>
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <iomanip>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <shared_mutex>
 #include <string>
 #include <tiledb/tiledb>
 
-enum class FileType : int { UNKNOWN, Master, Quote, Trade };
+enum class FileType : int {
+  UNKNOWN,
+  Master,
+  Quote,
+  Trade,
+  Bars,
+  Nbbo,
+  Metrics,
+  Pyramid,
+  Summary,
+  Sketch
+};
 
 namespace nyse {
+/**
+ * Output formats for reads
+ */
+enum class ExportFormat : int {
+  Csv,         // delimited text
+  ArrowFile,   // Arrow IPC random access file
+  ArrowStream, // Arrow IPC stream
+};
+
 /**
  * Helper function for splitting a string on a delimiter
  * @param s string
@@ -73,6 +102,52 @@ static std::vector<std::string> split(const std::string &s, char delim) {
  */
 std::shared_ptr<void> createBuffer(tiledb_datatype_t datatype);
 
+/**
+ * Split a subarray into disjoint subarrays aligned to tile extents, ordered so
+ * that concatenating their global order results gives the global order of the
+ * whole subarray. Requires row-major tile order and uint64 dimensions.
+ * @param subarray low/high pair for each dimension
+ * @param dimensions
+ * @param partitions approximate number of partitions wanted, fewer are
+ * returned when the subarray covers fewer tiles
+ * @return partition subarrays
+ */
+std::vector<std::vector<uint64_t>>
+partitionSubarray(const std::vector<uint64_t> &subarray,
+                  const std::vector<tiledb::Dimension> &dimensions,
+                  uint64_t partitions);
+
+/**
+ * Set a subarray on a query, converting it to the domain's type
+ * @param query
+ * @param domainType
+ * @param subarray low/high pair for each dimension
+ */
+void setSubarray(tiledb::Query &query, tiledb_datatype_t domainType,
+                 const std::vector<uint64_t> &subarray);
+
+/**
+ * Index of a dimension by name
+ * @param dimensions
+ * @param name
+ * @return index, throws std::runtime_error if there is no such dimension
+ */
+uint64_t dimensionIndex(const std::vector<tiledb::Dimension> &dimensions,
+                        const std::string &name);
+
+// Result elements of a query per buffer, as offsets and values
+typedef std::unordered_map<std::string, std::pair<uint64_t, uint64_t>>
+    ResultElements;
+
+class Aggregation;
+class AsOfJoin;
+class DerivedArray;
+class Nbbo;
+class Pyramid;
+class RealizedVolatility;
+class Replay;
+class ResultStream;
+
 class Array {
 public:
   ~Array() {
@@ -151,16 +226,364 @@ public:
    */
   const std::shared_ptr<tiledb::Context> &getCtx() const;
 
-  // void read(void *subarray);
-  virtual uint64_t readSample(std::string outfile, std::string delimiter) = 0;
+  /**
+   * Open the array for reading unless it is already open for reading
+   */
+  void openForRead();
+
+  /**
+   * Use a context shared with other arrays, closing the array if it is open
+   * @param ctx
+   */
+  void setCtx(std::shared_ptr<tiledb::Context> ctx);
+
+  /**
+   * Read the whole non-empty domain of the array
+   * @param outfile file to write delimited rows to, empty for no output
+   * @param delimiter
+   * @return rows read
+   */
+  virtual uint64_t readSample(std::string outfile, std::string delimiter);
+
+  /**
+   * Read all cells in a subarray, streaming the projected columns to an
+   * output. Buffers and formatting are driven by the array schema so any
+   * array, dense or sparse, can be read.
+   * @param subarray low/high pair for each dimension
+   * @param output stream to write delimited rows to, nullptr for no output
+   * @param delimiter
+   * @return rows read
+   */
+  virtual uint64_t read(const std::vector<uint64_t> &subarray,
+                        std::ostream *output, const std::string &delimiter);
+
+  /**
+   * Query a set of symbols over a time range, one read per symbol. The
+   * latency of each query is reported.
+   * @param symbolIds symbol and its symbol_id
+   * @param start first datetime in nanoseconds since epoch (inclusive)
+   * @param end last datetime in nanoseconds since epoch (inclusive)
+   * @param outfile file to write delimited rows to, empty for no output
+   * @param delimiter
+   * @return total rows read
+   */
+  uint64_t
+  querySymbols(const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+               uint64_t start, uint64_t end, const std::string &outfile,
+               const std::string &delimiter);
+
+  /**
+   * Query a single symbol over a time range, writing it as a complete export
+   * in the export format
+   * @param symbolId
+   * @param start first datetime in nanoseconds since epoch (inclusive)
+   * @param end last datetime in nanoseconds since epoch (inclusive)
+   * @param output stream to write to, nullptr for no output
+   * @param delimiter
+   * @return rows read
+   */
+  uint64_t querySymbol(uint64_t symbolId, uint64_t start, uint64_t end,
+                       std::ostream *output, const std::string &delimiter);
+
+  /**
+   * Consolidate all fragments of the array
+   */
+  void consolidate();
+
+  /**
+   * Enable capturing TileDB internal statistics around each fragment write,
+   * read and consolidation
+   * @param enabled
+   */
+  void setTileDBStats(bool enabled);
+
+  /**
+   * Limit the memory used by column buffers across all load workers. When a
+   * worker would exceed the budget it waits for others to release memory or
+   * writes its buffers out as a separate fragment.
+   * @param bytes budget, 0 for unlimited
+   */
+  void setMaxMemory(uint64_t bytes);
+
+  /**
+   * Datetimes of the first and last row parsed by the last load, for arrays
+   * with a datetime dimension
+   * @return first/last pair, first > last if nothing was loaded
+   */
+  std::pair<uint64_t, uint64_t> loadedRange();
+
+  /**
+   * Feed the rows parsed by loads to a derived array, such as bars, summaries
+   * or sketches, which writes what it accumulated once a load succeeded. The
+   * derived array is created if it does not exist.
+   * @param observer
+   */
+  void addLoadObserver(std::shared_ptr<DerivedArray> observer);
+
+  /**
+   * Restrict reads and exports to a subset of attributes and dimensions,
+   * output in the given order. Only the requested attributes are attached to
+   * read queries, and coordinates only when a dimension is requested.
+   * @param columns attribute or dimension names, empty for all
+   * @return false if a column is not in the array schema
+   */
+  bool setColumns(const std::vector<std::string> &columns);
+
+  /**
+   * Format of exported read results
+   * @param format
+   */
+  void setExportFormat(ExportFormat format);
+
+  /**
+   * Read with one query per tile aligned partition of the subarray, running
+   * readThreads partitions concurrently
+   * @param enabled
+   * @param ordered write results in global order, otherwise in completion
+   * order
+   */
+  void setParallelRead(bool enabled, bool ordered = true);
+
+  /**
+   * Number of threads used to format read results for export
+   * @param threads
+   */
+  void setReadThreads(uint32_t threads);
 
 protected:
+  friend class Aggregation;
+  friend class AsOfJoin;
+  friend class Nbbo;
+  friend class Pyramid;
+  friend class RealizedVolatility;
+  friend class Replay;
+  friend class ResultStream;
+
   /**
    * Submit query to tiledb for writing
    * @return status
    */
   tiledb::Query::Status submit_query();
 
+  /**
+   * Non-empty domain of every dimension, converted to uint64
+   * @return low/high pair for each dimension
+   */
+  std::vector<std::pair<uint64_t, uint64_t>> nonEmptyDomain();
+
+  /**
+   * Subarray of one symbol over a time range, clipped to the non-empty domain
+   * @param symbolId
+   * @param start
+   * @param end
+   * @param nonEmptyDomain
+   * @return subarray, empty when the range holds no data
+   */
+  virtual std::vector<uint64_t> symbolSubarray(
+      uint64_t symbolId, uint64_t start, uint64_t end,
+      const std::vector<std::pair<uint64_t, uint64_t>> &nonEmptyDomain);
+
+  /**
+   * Start an export to an output, writing the Arrow schema when exporting to
+   * Arrow
+   * @param output nullptr when not exporting
+   */
+  void beginExport(std::ostream *output);
+
+  /**
+   * Finish the export started by beginExport
+   */
+  void endExport();
+
+  /**
+   * Names of the array's complete fragments, sorted and newline separated
+   * @return fragment set
+   */
+  std::string fragmentSet();
+
+  /**
+   * Key of a read in the result cache. Reopens the array first when its
+   * fragments changed, which also invalidates its cached results.
+   * @param subarray
+   * @return key
+   */
+  std::string resultCacheKey(const std::vector<uint64_t> &subarray);
+
+  /**
+   * Write a result batch to an output in the export format
+   * @param outputColumns
+   * @param dimensions
+   * @param buffers buffers the batch was read into
+   * @param resultElements
+   * @param rows
+   * @param output
+   * @param delimiter
+   */
+  void writeBatch(
+      const std::vector<std::string> &outputColumns,
+      const std::vector<tiledb::Dimension> &dimensions,
+      const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+      const ResultElements &resultElements, uint64_t rows,
+      std::ostream &output, const std::string &delimiter);
+
+  /**
+   * Write a result batch as an Arrow record batch
+   * @param outputColumns
+   * @param dimensions
+   * @param buffers buffers the batch was read into
+   * @param resultElements
+   * @param rows
+   */
+  void writeArrowBatch(
+      const std::vector<std::string> &outputColumns,
+      const std::vector<tiledb::Dimension> &dimensions,
+      const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+      const ResultElements &resultElements, uint64_t rows);
+
+  /**
+   * read over the tile aligned partitions of a subarray, each read by
+   * its own query on a worker thread
+   * @param subarray low/high pair for each dimension
+   * @param output stream to write delimited rows to, nullptr for no output
+   * @param delimiter
+   * @return rows read
+   */
+  uint64_t readPartitioned(const std::vector<uint64_t> &subarray,
+                           std::ostream *output, const std::string &delimiter);
+
+  /**
+   * Columns to output, the projection or else all dimensions followed by all
+   * attributes in schema order
+   * @return column names
+   */
+  std::vector<std::string> outputColumns();
+
+  /**
+   * Submit a read query until it completes, growing buffers when needed
+   * @param query query with subarray and buffers set
+   * @param buffers
+   * @param countColumn buffer results are counted from
+   * @param ndim
+   * @param onBatch called with the row count and result elements of each
+   * non empty submission
+   * @return rows read
+   */
+  uint64_t
+  submitRead(tiledb::Query &query,
+             std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+             const std::string &countColumn, uint64_t ndim,
+             const std::function<void(uint64_t, ResultElements &)> &onBatch);
+
+  /**
+   * Build a typed formatter for each output column of a result batch
+   * @param outputColumns
+   * @param dimensions
+   * @param buffers
+   * @param resultElements
+   * @param rows rows in the batch
+   * @return formatters writing row i of their column
+   */
+  std::vector<std::function<void(CsvWriter &, uint64_t)>> columnFormatters(
+      const std::vector<std::string> &outputColumns,
+      const std::vector<tiledb::Dimension> &dimensions,
+      const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+      const ResultElements &resultElements, uint64_t rows);
+
+  /**
+   * Allocate read buffers for the coordinates and every attribute, sized from
+   * TileDB's estimate of the result for the subarray and capped at
+   * buffer_size. Existing buffers are reused and only ever grow.
+   * @param array array open for reading
+   * @param subarray
+   * @param readBuffers
+   */
+  void allocateReadBuffers(
+      tiledb::Array &array, const std::vector<uint64_t> &subarray,
+      std::unordered_map<std::string, std::shared_ptr<buffer>> &readBuffers);
+
+  /**
+   * Double all read buffers after a submission returned no results because a
+   * single cell did not fit
+   * @param readBuffers
+   * @return false if every buffer is already at maxReadBufferSize
+   */
+  bool growReadBuffers(
+      std::unordered_map<std::string, std::shared_ptr<buffer>> &readBuffers);
+
+  /**
+   * Format result rows into delimited text and write them to an output.
+   * Rows are split into chunks of formatChunkRows which are formatted
+   * concurrently into reusable writers and written in order.
+   * @param rows number of result rows
+   * @param output
+   * @param delimiter
+   * @param formatRows formats the rows [begin, end) into a writer
+   */
+  void writeRows(
+      uint64_t rows, std::ostream &output, const std::string &delimiter,
+      const std::function<void(CsvWriter &, uint64_t, uint64_t)> &formatRows);
+
+  /**
+   * Set all buffers on a query
+   * @param query
+   * @param buffers
+   */
+  void setQueryBuffers(
+      tiledb::Query &query,
+      const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers);
+
+  /**
+   * Called on a load worker with its parsed buffers before they are flushed
+   * to a fragment or returned for merging, so every parsed row is seen once.
+   * Tracks the loaded range and passes the rows to the load observers.
+   * @param source id of the file parsed
+   * @param buffers
+   */
+  void buffersParsed(
+      uint64_t source,
+      const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers);
+
+  /**
+   * Called with each batch of read results before it is formatted, cached or
+   * returned by a stream, to fix up values in place
+   * @param buffers
+   * @param resultElements
+   * @param rows
+   */
+  virtual void resultsRead(
+      const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+      const ResultElements &resultElements, uint64_t rows) {}
+
+  /**
+   * Extend the loaded datetime range with a worker's parsed rows
+   * @param buffers
+   */
+  void trackLoadedRange(
+      const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers);
+
+  /**
+   * Write a worker's buffers as their own fragment, used when a memory budget
+   * is set
+   * @param buffers
+   */
+  void writeFragment(
+      const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers);
+
+  /**
+   * Account a worker's buffer growth against the memory budget, waiting for
+   * memory or flushing the buffers to a fragment when over budget
+   * @param buffers worker buffers, replaced with empty buffers on flush
+   * @param reservedBytes bytes currently reserved by the worker
+   * @param headerFields
+   * @param staticColumns
+   * @param source id of the file parsed
+   */
+  void enforceMemoryBudget(
+      std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+      uint64_t &reservedBytes, const std::vector<std::string> &headerFields,
+      const std::unordered_map<std::string, std::string> &staticColumns,
+      uint64_t source);
+
   /**
    * Function to initialize all empty buffers for writting
    * @param headerFields
@@ -191,6 +614,78 @@ protected:
 
   uint64_t buffer_size = 10 * 1024 * 1024;
 
+  // Projected columns for reads, empty for all
+  std::vector<std::string> columns;
+
+  // Buffers for reads, kept across submissions and queries. Streams fetch
+  // alternately into both sets.
+  std::unordered_map<std::string, std::shared_ptr<buffer>> readBuffers;
+  std::unordered_map<std::string, std::shared_ptr<buffer>> prefetchBuffers;
+
+  // Smallest read buffer allocated, in elements
+  uint64_t minReadBufferElements = 1024;
+
+  // Read buffers are not grown past this size in bytes
+  uint64_t maxReadBufferSize = 4ULL * 1024 * 1024 * 1024;
+
+  uint32_t readThreads = 1;
+
+  ExportFormat exportFormat = ExportFormat::Csv;
+
+  // Writer of the current Arrow export and per dimension buffers used to
+  // split the coordinates into columns
+  std::unique_ptr<ArrowWriter> arrowWriter;
+  std::vector<std::vector<uint8_t>> arrowScratch;
+
+  // Partitioned parallel reads, and whether their output keeps global order
+  bool parallelRead = false;
+  bool readOrdered = true;
+
+  // Rows formatted per export task
+  uint64_t formatChunkRows = 16384;
+
+  // Export formatting workers and their output buffers, created on first use
+  std::unique_ptr<ThreadPool> formatPool;
+  std::vector<CsvWriter> formatWriters;
+
+  // Whether array is currently open in read mode
+  bool openedForRead = false;
+
+  // Fragment set the array was opened with when the result cache is used,
+  // and fragments known to be complete
+  std::string openedFragments;
+  std::set<std::string> completeFragments;
+
+  // Dump TileDB internal statistics for each phase
+  bool tiledbStats = false;
+
+  // Number of fragments written by this instance, used for labeling stats
+  uint64_t fragmentsWritten = 0;
+
+  // Optional limit on memory held by column buffers during load
+  std::shared_ptr<MemoryBudget> memoryBudget;
+
+  // Datetime range parsed by the current or last load
+  std::mutex loadedMutex;
+  uint64_t loadedStart = std::numeric_limits<uint64_t>::max();
+  uint64_t loadedEnd = 0;
+
+  // Derived arrays computed from the rows parsed by loads
+  std::vector<std::shared_ptr<DerivedArray>> loadObservers;
+
+  // Set when a fragment write of the current load failed
+  std::atomic<bool> writeFailed{false};
+
+  // How often, in rows, workers check their buffers against the budget
+  uint64_t memoryCheckRows = 4096;
+
+  uint32_t loadThreads = 1;
+
+  std::mutex writeMutex;
+
+  // Rows written by workers directly as their own fragments
+  std::atomic<uint64_t> rowsFlushed{0};
+
   char delimiter;
 
   FileType type;
@@ -204,6 +699,45 @@ protected:
                     std::unordered_map<std::string, std::string> *>>>>
       mapColumnsForFiles;
 };
+
+/**
+ * Array computed from Quote and Trade data rather than loaded from files
+ */
+class DerivedArray : public Array {
+public:
+  /**
+   * Derived arrays can not be loaded from files
+   * @return -1
+   */
+  int load(const std::vector<std::string>, char, uint64_t, uint32_t) override;
+
+  /**
+   * Accumulate the rows parsed by a load worker of the observed array, called
+   * concurrently by all workers
+   * @param source id of the file the rows were parsed from
+   * @param dimensions of the observed array
+   * @param buffers parsed coordinates and attributes
+   */
+  virtual void
+  rowsParsed(uint64_t source, const std::vector<tiledb::Dimension> &dimensions,
+             const std::unordered_map<std::string, std::shared_ptr<buffer>>
+                 &buffers) {}
+
+  /**
+   * Write what was accumulated from the rows parsed
+   * @return cells written
+   */
+  virtual uint64_t writeParsed() { return 0; }
+
+  /**
+   * What writeParsed() writes, for the load report
+   */
+  virtual std::string contents() const { return "cells"; }
+
+protected:
+  // How the array is computed, printed when a load is attempted
+  std::string origin;
+};
 } // namespace nyse
 
 #endif // NYSE_INGESTOR_ARRAY_H
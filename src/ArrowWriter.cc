@@ -0,0 +1,414 @@
+/**
+ * @file  ArrowWriter.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Apache Arrow IPC writer for query results, producing the stream or file
+ * format without depending on the Arrow libraries
+ *
+ */
+
+#include "ArrowWriter.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// Arrow format constants from Schema.fbs and Message.fbs
+const int16_t metadataVersionV5 = 4;
+const uint8_t headerSchema = 1;
+const uint8_t headerRecordBatch = 3;
+const uint8_t typeInt = 2;
+const uint8_t typeFloatingPoint = 3;
+const uint8_t typeBinary = 4;
+const uint8_t typeFixedSizeBinary = 15;
+const uint8_t typeLargeBinary = 19;
+const uint8_t typeLargeUtf8 = 20;
+const int16_t precisionSingle = 1;
+const int16_t precisionDouble = 2;
+const char arrowMagic[] = "ARROW1";
+
+/**
+ * Minimal flatbuffer builder. Like the reference implementation the buffer
+ * is built back to front so that objects are created before the tables
+ * referencing them. Offsets are tracked as distances from the end of the
+ * buffer.
+ */
+class FlatBufferBuilder {
+public:
+  uint32_t size() const { return static_cast<uint32_t>(bytes.size()); }
+
+  /**
+   * Pad so that after writing length more bytes the size is a multiple of
+   * alignment
+   */
+  void align(size_t length, size_t alignment) {
+    size_t padding = (alignment - (bytes.size() + length) % alignment) %
+                     alignment;
+    bytes.insert(bytes.begin(), padding, 0);
+  }
+
+  void prependBytes(const void *data, size_t length) {
+    const uint8_t *begin = static_cast<const uint8_t *>(data);
+    bytes.insert(bytes.begin(), begin, begin + length);
+  }
+
+  template <typename T> uint32_t prepend(T value) {
+    align(sizeof(T), sizeof(T));
+    prependBytes(&value, sizeof(T));
+    return size();
+  }
+
+  /**
+   * Prepend an offset to an object created earlier
+   */
+  uint32_t prependOffset(uint32_t target) {
+    align(sizeof(uint32_t), sizeof(uint32_t));
+    return prepend<uint32_t>(size() + sizeof(uint32_t) - target);
+  }
+
+  uint32_t createString(const std::string &s) {
+    align(s.size() + 1, sizeof(uint32_t));
+    bytes.insert(bytes.begin(), 0);
+    prependBytes(s.data(), s.size());
+    return prepend<uint32_t>(static_cast<uint32_t>(s.size()));
+  }
+
+  uint32_t createOffsetVector(const std::vector<uint32_t> &offsets) {
+    align(offsets.size() * sizeof(uint32_t), sizeof(uint32_t));
+    for (auto it = offsets.rbegin(); it != offsets.rend(); ++it)
+      prependOffset(*it);
+    return prepend<uint32_t>(static_cast<uint32_t>(offsets.size()));
+  }
+
+  /**
+   * Vector of structs made of 64 bit fields
+   */
+  uint32_t createStructVector(const std::vector<int64_t> &values,
+                              size_t fieldsPerStruct) {
+    align(values.size() * sizeof(int64_t), sizeof(uint32_t));
+    align(values.size() * sizeof(int64_t), sizeof(int64_t));
+    prependBytes(values.data(), values.size() * sizeof(int64_t));
+    return prepend<uint32_t>(
+        static_cast<uint32_t>(values.size() / fieldsPerStruct));
+  }
+
+  void startTable() {
+    tableEnd = size();
+    fieldPositions.clear();
+  }
+
+  template <typename T> void addField(uint16_t id, T value) {
+    setField(id, prepend<T>(value));
+  }
+
+  void addOffset(uint16_t id, uint32_t target) {
+    setField(id, prependOffset(target));
+  }
+
+  uint32_t endTable() {
+    uint32_t table = prepend<int32_t>(0);
+    std::vector<uint16_t> vtable(2 + fieldPositions.size(), 0);
+    vtable[0] = static_cast<uint16_t>(vtable.size() * sizeof(uint16_t));
+    vtable[1] = static_cast<uint16_t>(table - tableEnd);
+    for (size_t id = 0; id < fieldPositions.size(); id++) {
+      if (fieldPositions[id] != 0)
+        vtable[2 + id] = static_cast<uint16_t>(table - fieldPositions[id]);
+    }
+    align(vtable.size() * sizeof(uint16_t), sizeof(uint16_t));
+    prependBytes(vtable.data(), vtable.size() * sizeof(uint16_t));
+
+    // The table starts with the signed distance back to its vtable
+    int32_t vtableOffset = static_cast<int32_t>(size() - table);
+    memcpy(&bytes[size() - table], &vtableOffset, sizeof(vtableOffset));
+    return table;
+  }
+
+  /**
+   * Finish with the root table offset, the result is 8 byte aligned
+   */
+  std::vector<uint8_t> finish(uint32_t root) {
+    align(sizeof(uint32_t), sizeof(int64_t));
+    prependOffset(root);
+    return bytes;
+  }
+
+private:
+  void setField(uint16_t id, uint32_t position) {
+    if (fieldPositions.size() <= id)
+      fieldPositions.resize(id + 1, 0);
+    fieldPositions[id] = position;
+  }
+
+  std::vector<uint8_t> bytes;
+  uint32_t tableEnd = 0;
+  std::vector<uint32_t> fieldPositions;
+};
+
+/**
+ * Create the Type table of a field
+ * @param builder
+ * @param field
+ * @param typeId set to the Type union member
+ * @return type table
+ */
+uint32_t createType(FlatBufferBuilder &builder, const nyse::ArrowField &field,
+                    uint8_t &typeId) {
+  int32_t bitWidth = 0;
+  bool isSigned = false;
+  switch (field.datatype) {
+  case TILEDB_INT8:
+    bitWidth = 8, isSigned = true;
+    break;
+  case TILEDB_UINT8:
+    bitWidth = 8;
+    break;
+  case TILEDB_INT16:
+    bitWidth = 16, isSigned = true;
+    break;
+  case TILEDB_UINT16:
+    bitWidth = 16;
+    break;
+  case TILEDB_INT32:
+    bitWidth = 32, isSigned = true;
+    break;
+  case TILEDB_UINT32:
+    bitWidth = 32;
+    break;
+  case TILEDB_INT64:
+    bitWidth = 64, isSigned = true;
+    break;
+  case TILEDB_UINT64:
+    bitWidth = 64;
+    break;
+  case TILEDB_FLOAT32:
+  case TILEDB_FLOAT64:
+    typeId = typeFloatingPoint;
+    builder.startTable();
+    builder.addField<int16_t>(0, field.datatype == TILEDB_FLOAT32
+                                     ? precisionSingle
+                                     : precisionDouble);
+    return builder.endTable();
+  case TILEDB_CHAR:
+  case TILEDB_STRING_ASCII:
+  case TILEDB_STRING_UTF8:
+    if (field.variableSized) {
+      typeId = typeLargeUtf8;
+      builder.startTable();
+      return builder.endTable();
+    }
+    typeId = typeFixedSizeBinary;
+    builder.startTable();
+    builder.addField<int32_t>(0, 1);
+    return builder.endTable();
+  default:
+    break;
+  }
+
+  if (bitWidth > 0 && !field.variableSized) {
+    typeId = typeInt;
+    builder.startTable();
+    builder.addField<int32_t>(0, bitWidth);
+    builder.addField<uint8_t>(1, isSigned);
+    return builder.endTable();
+  }
+
+  // Anything else is passed through as raw bytes
+  typeId = field.variableSized ? typeLargeBinary : typeBinary;
+  builder.startTable();
+  return builder.endTable();
+}
+
+/**
+ * Create a Schema table
+ * @param builder
+ * @param fields
+ * @return schema table
+ */
+uint32_t createSchema(FlatBufferBuilder &builder,
+                      const std::vector<nyse::ArrowField> &fields) {
+  std::vector<uint32_t> fieldTables;
+  for (const nyse::ArrowField &field : fields) {
+    uint32_t name = builder.createString(field.name);
+    uint8_t typeId = 0;
+    uint32_t type = createType(builder, field, typeId);
+    uint32_t children = builder.createOffsetVector({});
+    builder.startTable();
+    builder.addOffset(0, name);
+    builder.addField<uint8_t>(1, 0); // not nullable
+    builder.addField<uint8_t>(2, typeId);
+    builder.addOffset(3, type);
+    builder.addOffset(5, children);
+    fieldTables.push_back(builder.endTable());
+  }
+  uint32_t fieldVector = builder.createOffsetVector(fieldTables);
+  builder.startTable();
+  builder.addOffset(1, fieldVector);
+  return builder.endTable();
+}
+
+/**
+ * Create a Message table around a header
+ */
+uint32_t createMessage(FlatBufferBuilder &builder, uint8_t headerType,
+                       uint32_t header, int64_t bodyLength) {
+  builder.startTable();
+  builder.addField<int64_t>(3, bodyLength);
+  builder.addOffset(2, header);
+  builder.addField<int16_t>(0, metadataVersionV5);
+  builder.addField<uint8_t>(1, headerType);
+  return builder.endTable();
+}
+
+/**
+ * Round up to a multiple of 8
+ */
+uint64_t padded(uint64_t bytes) { return (bytes + 7) & ~uint64_t(7); }
+} // namespace
+
+nyse::ArrowWriter::ArrowWriter(std::ostream &output, bool fileFormat)
+    : output(output), fileFormat(fileFormat) {
+  if (fileFormat) {
+    output.write(arrowMagic, 6);
+    writePadding(2);
+    position = 8;
+  }
+}
+
+void nyse::ArrowWriter::writePadding(uint64_t bytes) {
+  static const char zeros[8] = {0};
+  output.write(zeros, bytes);
+}
+
+int32_t nyse::ArrowWriter::writeMessage(const std::vector<uint8_t> &metadata) {
+  const uint32_t continuation = 0xFFFFFFFF;
+  int32_t length = static_cast<int32_t>(padded(8 + metadata.size()) - 8);
+  output.write(reinterpret_cast<const char *>(&continuation), 4);
+  output.write(reinterpret_cast<const char *>(&length), 4);
+  output.write(reinterpret_cast<const char *>(metadata.data()),
+               metadata.size());
+  writePadding(length - metadata.size());
+  position += 8 + length;
+  return 8 + length;
+}
+
+void nyse::ArrowWriter::writeSchema(const std::vector<ArrowField> &fields) {
+  this->fields = fields;
+  FlatBufferBuilder builder;
+  uint32_t schema = createSchema(builder, fields);
+  writeMessage(
+      builder.finish(createMessage(builder, headerSchema, schema, 0)));
+}
+
+void nyse::ArrowWriter::writeBatch(uint64_t rows,
+                                   const std::vector<ArrowColumn> &columns) {
+  if (columns.size() != fields.size())
+    throw std::runtime_error("Arrow batch does not match the schema");
+
+  // Lay out validity (always empty, there are no nulls), offsets and values
+  // buffers of every column in the body
+  std::vector<int64_t> nodes;
+  std::vector<int64_t> buffers;
+  uint64_t bodyLength = 0;
+  for (const ArrowColumn &column : columns) {
+    nodes.push_back(static_cast<int64_t>(rows));
+    nodes.push_back(0);
+    buffers.push_back(static_cast<int64_t>(bodyLength));
+    buffers.push_back(0);
+    if (column.offsets != nullptr) {
+      uint64_t offsetsBytes = (rows + 1) * sizeof(uint64_t);
+      buffers.push_back(static_cast<int64_t>(bodyLength));
+      buffers.push_back(static_cast<int64_t>(offsetsBytes));
+      bodyLength += padded(offsetsBytes);
+    }
+    buffers.push_back(static_cast<int64_t>(bodyLength));
+    buffers.push_back(static_cast<int64_t>(column.valuesBytes));
+    bodyLength += padded(column.valuesBytes);
+  }
+
+  FlatBufferBuilder builder;
+  uint32_t bufferVector = builder.createStructVector(buffers, 2);
+  uint32_t nodeVector = builder.createStructVector(nodes, 2);
+  builder.startTable();
+  builder.addField<int64_t>(0, static_cast<int64_t>(rows));
+  builder.addOffset(1, nodeVector);
+  builder.addOffset(2, bufferVector);
+  uint32_t recordBatch = builder.endTable();
+
+  int64_t offset = static_cast<int64_t>(position);
+  int32_t metaDataLength = writeMessage(builder.finish(createMessage(
+      builder, headerRecordBatch, recordBatch, bodyLength)));
+  blocks.push_back({offset, metaDataLength, static_cast<int64_t>(bodyLength)});
+
+  for (const ArrowColumn &column : columns) {
+    if (column.offsets != nullptr) {
+      uint64_t offsetsBytes = (rows + 1) * sizeof(uint64_t);
+      output.write(reinterpret_cast<const char *>(column.offsets),
+                   rows * sizeof(uint64_t));
+      output.write(reinterpret_cast<const char *>(&column.valuesBytes),
+                   sizeof(uint64_t));
+      writePadding(padded(offsetsBytes) - offsetsBytes);
+    }
+    output.write(static_cast<const char *>(column.values), column.valuesBytes);
+    writePadding(padded(column.valuesBytes) - column.valuesBytes);
+  }
+  position += bodyLength;
+}
+
+void nyse::ArrowWriter::finish() {
+  const uint32_t endOfStream[2] = {0xFFFFFFFF, 0};
+  output.write(reinterpret_cast<const char *>(endOfStream),
+               sizeof(endOfStream));
+  position += sizeof(endOfStream);
+  if (!fileFormat)
+    return;
+
+  FlatBufferBuilder builder;
+  std::vector<int64_t> blockValues;
+  for (const Block &block : blocks) {
+    // Block is {offset: long, metaDataLength: int, bodyLength: long} with the
+    // int padded to 8 bytes
+    blockValues.push_back(block.offset);
+    blockValues.push_back(static_cast<uint32_t>(block.metaDataLength));
+    blockValues.push_back(block.bodyLength);
+  }
+  uint32_t recordBatches = builder.createStructVector(blockValues, 3);
+  uint32_t dictionaries = builder.createStructVector({}, 3);
+  uint32_t schema = createSchema(builder, fields);
+  builder.startTable();
+  builder.addOffset(1, schema);
+  builder.addOffset(2, dictionaries);
+  builder.addOffset(3, recordBatches);
+  builder.addField<int16_t>(0, metadataVersionV5);
+  std::vector<uint8_t> footer = builder.finish(builder.endTable());
+
+  output.write(reinterpret_cast<const char *>(footer.data()), footer.size());
+  int32_t footerLength = static_cast<int32_t>(footer.size());
+  output.write(reinterpret_cast<const char *>(&footerLength),
+               sizeof(footerLength));
+  output.write(arrowMagic, 6);
+}
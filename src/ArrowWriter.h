@@ -0,0 +1,124 @@
+/**
+ * @file  ArrowWriter.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Apache Arrow IPC writer for query results, producing the stream or file
+ * format without depending on the Arrow libraries
+ *
+ */
+
+#ifndef NYSE_INGESTOR_ARROWWRITER_H
+#define NYSE_INGESTOR_ARROWWRITER_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <tiledb/tiledb.h>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * A column of the Arrow schema
+ */
+struct ArrowField {
+  std::string name;
+  tiledb_datatype_t datatype;
+  bool variableSized;
+};
+
+/**
+ * Buffers of one column of a record batch. Fixed sized columns point at
+ * rows values. Variable sized columns also point at rows TileDB byte
+ * offsets, the closing offset is valuesBytes.
+ */
+struct ArrowColumn {
+  const void *values;
+  uint64_t valuesBytes;
+  const uint64_t *offsets;
+};
+
+/**
+ * Writes record batches in the Arrow IPC stream or file format. Buffers are
+ * written as is after 8 byte alignment so the file can be memory mapped by
+ * consumers. Single characters are written as fixed size binary of width 1,
+ * variable sized strings as large utf8 and dimensions as 64 bit integers.
+ */
+class ArrowWriter {
+public:
+  /**
+   * @param output
+   * @param fileFormat write the random access file format instead of the
+   * stream format
+   */
+  ArrowWriter(std::ostream &output, bool fileFormat);
+
+  /**
+   * Write the schema, must be called before any batch
+   * @param fields
+   */
+  void writeSchema(const std::vector<ArrowField> &fields);
+
+  /**
+   * Write a record batch
+   * @param rows
+   * @param columns one per schema field
+   */
+  void writeBatch(uint64_t rows, const std::vector<ArrowColumn> &columns);
+
+  /**
+   * Write the end of stream marker and for the file format the footer
+   */
+  void finish();
+
+private:
+  /**
+   * Write an encapsulated message's metadata
+   * @param metadata flatbuffer Message
+   * @return bytes written including prefix and padding
+   */
+  int32_t writeMessage(const std::vector<uint8_t> &metadata);
+
+  void writePadding(uint64_t bytes);
+
+  // File offset, metadata length and body length of each batch for the footer
+  struct Block {
+    int64_t offset;
+    int32_t metaDataLength;
+    int64_t bodyLength;
+  };
+
+  std::ostream &output;
+  bool fileFormat;
+  uint64_t position = 0;
+  std::vector<ArrowField> fields;
+  std::vector<Block> blocks;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_ARROWWRITER_H
@@ -0,0 +1,281 @@
+/**
+ * @file  AsOfJoin.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * As-of join attaching the prevailing quote to each trade, merging per symbol
+ * streams of the Trade and Quote arrays in a single pass
+ *
+ */
+
+#include "AsOfJoin.h"
+#include "Quote.h"
+#include "ResultStream.h"
+#include "Trace.h"
+#include "Trade.h"
+#include <ThreadPool.h>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+static const std::vector<std::string> quoteColumns = {
+    "datetime", "Bid_Price", "Bid_Size", "Offer_Price", "Offer_Size"};
+
+namespace {
+/**
+ * Position in a stream of quotes, with the spans of the current batch
+ */
+class QuoteCursor {
+public:
+  QuoteCursor(nyse::ResultStream *stream, uint64_t datetimeIndex)
+      : stream(stream), datetimeIndex(datetimeIndex) {
+    advance();
+  }
+
+  bool valid() const { return isValid; }
+
+  /**
+   * Datetime of the current quote, moving to the next batch when the current
+   * one is exhausted
+   * @param datetime
+   * @return false once all quotes were consumed
+   */
+  bool peek(uint64_t &datetime) {
+    while (isValid && row == rows)
+      advance();
+    if (!isValid)
+      return false;
+    datetime = coords[row * ndim + datetimeIndex];
+    return true;
+  }
+
+  /**
+   * Take the current quote
+   */
+  nyse::PrevailingQuote take() {
+    nyse::PrevailingQuote quote{coords[row * ndim + datetimeIndex],
+                                bidPrice[row], bidSize[row], offerPrice[row],
+                                offerSize[row]};
+    row++;
+    return quote;
+  }
+
+private:
+  void advance() {
+    isValid = stream != nullptr && stream->next();
+    row = 0;
+    if (!isValid) {
+      rows = 0;
+      return;
+    }
+    const nyse::ResultBatch &batch = stream->batch();
+    rows = batch.rows();
+    ndim = batch.dimensions();
+    coords = batch.coordinates<uint64_t>();
+    bidPrice = batch.values<float>("Bid_Price");
+    bidSize = batch.values<uint32_t>("Bid_Size");
+    offerPrice = batch.values<float>("Offer_Price");
+    offerSize = batch.values<uint32_t>("Offer_Size");
+  }
+
+  nyse::ResultStream *stream;
+  uint64_t datetimeIndex;
+  bool isValid = false;
+  uint64_t row = 0;
+  uint64_t rows = 0;
+  uint64_t ndim = 0;
+  nyse::ColumnSpan<uint64_t> coords;
+  nyse::ColumnSpan<float> bidPrice;
+  nyse::ColumnSpan<uint32_t> bidSize;
+  nyse::ColumnSpan<float> offerPrice;
+  nyse::ColumnSpan<uint32_t> offerSize;
+};
+} // namespace
+
+nyse::AsOfJoin::AsOfJoin(std::shared_ptr<tiledb::Context> ctx,
+                         std::string tradeUri, std::string quoteUri)
+    : ctx(std::move(ctx)), tradeUri(std::move(tradeUri)),
+      quoteUri(std::move(quoteUri)) {}
+
+uint64_t nyse::AsOfJoin::joinSymbol(Array &trades, Array &quotes,
+                                    uint64_t symbolId, uint64_t start,
+                                    uint64_t end, CsvWriter *writer) {
+  std::vector<uint64_t> tradeSubarray =
+      trades.symbolSubarray(symbolId, start, end, trades.nonEmptyDomain());
+  if (tradeSubarray.empty())
+    return 0;
+
+  // Quotes from before the first trade are needed for its prevailing quote,
+  // and a negative latency reaches past the last trade
+  uint64_t quoteStart = quoteLookback == 0 || start < quoteLookback
+                            ? 0
+                            : start - quoteLookback;
+  uint64_t quoteEnd = end;
+  if (latency < 0)
+    quoteEnd = end > std::numeric_limits<uint64_t>::max() - uint64_t(-latency)
+                   ? std::numeric_limits<uint64_t>::max()
+                   : end + uint64_t(-latency);
+  std::vector<uint64_t> quoteSubarray = quotes.symbolSubarray(
+      symbolId, quoteStart, quoteEnd, quotes.nonEmptyDomain());
+
+  std::vector<tiledb::Dimension> tradeDimensions =
+      trades.array->schema().domain().dimensions();
+  uint64_t tradeDatetime = dimensionIndex(tradeDimensions, "datetime");
+  std::vector<std::string> outputColumns =
+      tradeColumns.empty() ? trades.outputColumns() : tradeColumns;
+
+  std::unique_ptr<ResultStream> quoteStream;
+  if (!quoteSubarray.empty())
+    quoteStream = std::make_unique<ResultStream>(quotes, quoteSubarray);
+  QuoteCursor cursor(
+      quoteStream.get(),
+      dimensionIndex(quotes.array->schema().domain().dimensions(),
+                     "datetime"));
+
+  PrevailingQuote prevailing{};
+  bool havePrevailing = false;
+  ResultStream tradeStream(trades, tradeSubarray);
+  for (const ResultBatch &batch : tradeStream) {
+    ColumnSpan<uint64_t> coords = batch.coordinates<uint64_t>();
+    uint64_t ndim = batch.dimensions();
+    std::vector<std::function<void(CsvWriter &, uint64_t)>> formatters;
+    if (writer != nullptr)
+      formatters =
+          trades.columnFormatters(outputColumns, tradeDimensions,
+                                  batch.buffers(), batch.resultElements(),
+                                  batch.rows());
+
+    for (uint64_t i = 0; i < batch.rows(); i++) {
+      // Both streams are in datetime order so quotes are only ever consumed
+      // once
+      int64_t cutoff = int64_t(coords[i * ndim + tradeDatetime]) - latency;
+      uint64_t quoteDatetime;
+      while (cursor.peek(quoteDatetime) && int64_t(quoteDatetime) <= cutoff) {
+        prevailing = cursor.take();
+        havePrevailing = true;
+      }
+      if (writer == nullptr)
+        continue;
+
+      for (size_t c = 0; c < formatters.size(); c++) {
+        if (c > 0)
+          writer->appendDelimiter();
+        formatters[c](*writer, i);
+      }
+      if (havePrevailing) {
+        writer->appendDelimiter();
+        writer->appendValue(prevailing.datetime);
+        writer->appendDelimiter();
+        writer->appendValue(prevailing.bidPrice);
+        writer->appendDelimiter();
+        writer->appendValue(prevailing.bidSize);
+        writer->appendDelimiter();
+        writer->appendValue(prevailing.offerPrice);
+        writer->appendDelimiter();
+        writer->appendValue(prevailing.offerSize);
+      } else {
+        for (size_t c = 0; c < quoteColumns.size(); c++)
+          writer->appendDelimiter();
+      }
+      writer->appendNewline();
+    }
+  }
+  return tradeStream.rows();
+}
+
+uint64_t nyse::AsOfJoin::run(
+    const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+    uint64_t start, uint64_t end, std::ostream *output,
+    const std::string &delimiter) {
+  // Trade coordinates are always read for their datetime
+  std::vector<std::string> tradeProjection = tradeColumns;
+  if (!tradeProjection.empty() &&
+      std::find(tradeProjection.begin(), tradeProjection.end(), "datetime") ==
+          tradeProjection.end())
+    tradeProjection.push_back("datetime");
+
+  std::vector<CsvWriter> symbolOutput(symbolIds.size(), CsvWriter(delimiter));
+  std::vector<std::promise<void>> symbolDone(symbolIds.size());
+  std::atomic<uint64_t> nextSymbol{0};
+  std::atomic<uint64_t> totalRows{0};
+
+  // Each worker has its own readers, sharing the context and its caches
+  auto worker = [&]() {
+    std::unique_ptr<Trade> trades;
+    std::unique_ptr<Quote> quotes;
+    for (uint64_t s = nextSymbol++; s < symbolIds.size(); s = nextSymbol++) {
+      try {
+        if (trades == nullptr) {
+          trades = std::make_unique<Trade>(tradeUri, "", delimiter[0]);
+          trades->setCtx(ctx);
+          quotes = std::make_unique<Quote>(quoteUri, "", delimiter[0]);
+          quotes->setCtx(ctx);
+          if (!trades->setColumns(tradeProjection) ||
+              !quotes->setColumns(quoteColumns))
+            throw std::runtime_error("Invalid join columns");
+        }
+        TraceSpan joinSpan("join", tradeUri);
+        uint64_t rows =
+            joinSymbol(*trades, *quotes, symbolIds[s].second, start, end,
+                       output != nullptr ? &symbolOutput[s] : nullptr);
+        joinSpan.setRows(rows);
+        totalRows += rows;
+        symbolDone[s].set_value();
+      } catch (...) {
+        symbolDone[s].set_exception(std::current_exception());
+      }
+    }
+  };
+
+  std::vector<std::future<void>> workers;
+  {
+    ThreadPool pool(std::min<uint64_t>(threads, symbolIds.size() + 1));
+    for (uint32_t t = 0; t < threads && t < symbolIds.size(); t++)
+      workers.emplace_back(pool.enqueue(worker));
+
+    // Symbols are written in order as they complete
+    for (size_t s = 0; s < symbolIds.size(); s++) {
+      try {
+        symbolDone[s].get_future().get();
+      } catch (const std::exception &e) {
+        std::cerr << "Join of " << symbolIds[s].first
+                  << " failed: " << e.what() << std::endl;
+        continue;
+      }
+      if (output != nullptr) {
+        symbolOutput[s].writeTo(*output);
+        symbolOutput[s] = CsvWriter();
+      }
+    }
+    for (auto &future : workers)
+      future.get();
+  }
+  return totalRows;
+}
@@ -0,0 +1,140 @@
+/**
+ * @file  AsOfJoin.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * As-of join attaching the prevailing quote to each trade, merging per symbol
+ * streams of the Trade and Quote arrays in a single pass
+ *
+ */
+
+#ifndef NYSE_INGESTOR_ASOFJOIN_H
+#define NYSE_INGESTOR_ASOFJOIN_H
+
+#include "Array.h"
+#include "CsvWriter.h"
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * Quote values carried forward to the trades that follow it
+ */
+struct PrevailingQuote {
+  uint64_t datetime;
+  float bidPrice;
+  uint32_t bidSize;
+  float offerPrice;
+  uint32_t offerSize;
+};
+
+/**
+ * Joins each trade to the last quote of the same symbol at least latency
+ * nanoseconds older than the trade. Symbols are joined concurrently, each by
+ * a worker with its own Trade and Quote readers, and written in the order
+ * given.
+ *
+ * Each output row holds the trade columns followed by the quote's datetime,
+ * Bid_Price, Bid_Size, Offer_Price and Offer_Size, which are left empty when
+ * no quote precedes the trade.
+ */
+class AsOfJoin {
+public:
+  /**
+   * @param ctx context shared by all readers
+   * @param tradeUri
+   * @param quoteUri
+   */
+  AsOfJoin(std::shared_ptr<tiledb::Context> ctx, std::string tradeUri,
+           std::string quoteUri);
+
+  /**
+   * Minimum age of a quote relative to the trade, in nanoseconds. Negative
+   * values allow quotes published after the trade.
+   * @param nanoseconds
+   */
+  void setLatency(int64_t nanoseconds) { latency = nanoseconds; }
+
+  /**
+   * How far before the start of the time range quotes are read to find the
+   * quote prevailing at the first trade
+   * @param nanoseconds 0 to read from the start of the quote data
+   */
+  void setQuoteLookback(uint64_t nanoseconds) { quoteLookback = nanoseconds; }
+
+  /**
+   * Trade columns to output, in order
+   * @param columns empty for all trade columns
+   */
+  void setTradeColumns(std::vector<std::string> columns) {
+    tradeColumns = std::move(columns);
+  }
+
+  void setThreads(uint32_t threads) { this->threads = std::max(threads, 1u); }
+
+  /**
+   * Join a set of symbols over a time range
+   * @param symbolIds symbol and its symbol_id
+   * @param start first trade datetime in nanoseconds since epoch (inclusive)
+   * @param end last trade datetime in nanoseconds since epoch (inclusive)
+   * @param output stream to write delimited rows to, nullptr for no output
+   * @param delimiter
+   * @return trades joined
+   */
+  uint64_t run(const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+               uint64_t start, uint64_t end, std::ostream *output,
+               const std::string &delimiter);
+
+private:
+  /**
+   * Join one symbol, appending its rows to a writer
+   * @param trades reader of the Trade array
+   * @param quotes reader of the Quote array
+   * @param symbolId
+   * @param start
+   * @param end
+   * @param writer
+   * @return trades joined
+   */
+  uint64_t joinSymbol(Array &trades, Array &quotes, uint64_t symbolId,
+                      uint64_t start, uint64_t end, CsvWriter *writer);
+
+  std::shared_ptr<tiledb::Context> ctx;
+  std::string tradeUri;
+  std::string quoteUri;
+  int64_t latency = 0;
+  uint64_t quoteLookback = 0;
+  std::vector<std::string> tradeColumns;
+  uint32_t threads = 1;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_ASOFJOIN_H
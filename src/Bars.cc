@@ -0,0 +1,358 @@
+/**
+ * @file  Bars.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Open, high, low, close, volume and VWAP bars of trades, accumulated while
+ * trades are loaded and stored in a dense companion array
+ *
+ */
+
+#include "Bars.h"
+#include "Trace.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+// Bars are written in blocks of this many symbol ids, the symbol tile extent
+static const uint64_t symbolTile = 100;
+
+nyse::Bar &nyse::BarSet::bar(uint64_t symbolId, uint64_t index) {
+  if (symbolId >= bySymbol.size())
+    bySymbol.resize(symbolId + 1);
+  std::vector<Bar> &bars = bySymbol[symbolId].bars;
+  if (bars.empty() || bars.back().index < index) {
+    bars.emplace_back();
+    bars.back().index = index;
+    return bars.back();
+  }
+  if (bars.back().index == index)
+    return bars.back();
+  // Trades are mostly in time order so this is rare
+  auto position = std::lower_bound(
+      bars.begin(), bars.end(), index,
+      [](const Bar &bar, uint64_t index) { return bar.index < index; });
+  if (position == bars.end() || position->index != index) {
+    position = bars.insert(position, Bar());
+    position->index = index;
+  }
+  return *position;
+}
+
+void nyse::BarSet::add(uint64_t symbolId, uint64_t datetime, float price,
+                       uint32_t volume) {
+  Bar &bar = this->bar(symbolId, datetime / barWidth);
+  if (bar.trades == 0) {
+    bar.open = bar.high = bar.low = bar.close = price;
+    bar.openTime = bar.closeTime = datetime;
+  } else {
+    bar.high = std::max(bar.high, price);
+    bar.low = std::min(bar.low, price);
+    // Trades at the same time keep file order
+    if (datetime < bar.openTime) {
+      bar.open = price;
+      bar.openTime = datetime;
+    }
+    if (datetime >= bar.closeTime) {
+      bar.close = price;
+      bar.closeTime = datetime;
+    }
+  }
+  bar.volume += volume;
+  bar.notional += double(price) * volume;
+  bar.trades++;
+}
+
+/**
+ * Combine the trades of a bar into another bar of the same index
+ * @param into
+ * @param from
+ */
+static void mergeBar(nyse::Bar &into, const nyse::Bar &from) {
+  if (into.trades == 0) {
+    into = from;
+    return;
+  }
+  into.high = std::max(into.high, from.high);
+  into.low = std::min(into.low, from.low);
+  if (from.openTime < into.openTime) {
+    into.open = from.open;
+    into.openTime = from.openTime;
+  }
+  if (from.closeTime > into.closeTime) {
+    into.close = from.close;
+    into.closeTime = from.closeTime;
+  }
+  into.volume += from.volume;
+  into.notional += from.notional;
+  into.trades += from.trades;
+}
+
+void nyse::BarSet::merge(const BarSet &other) {
+  const std::vector<SymbolBars> &symbols = other.symbols();
+  if (symbols.size() > bySymbol.size())
+    bySymbol.resize(symbols.size());
+  std::vector<Bar> merged;
+  for (uint64_t symbolId = 0; symbolId < symbols.size(); symbolId++) {
+    const std::vector<Bar> &from = symbols[symbolId].bars;
+    std::vector<Bar> &into = bySymbol[symbolId].bars;
+    if (from.empty())
+      continue;
+    if (into.empty() || into.back().index < from.front().index) {
+      into.insert(into.end(), from.begin(), from.end());
+      continue;
+    }
+
+    // Both are sorted by index, bars of the same index are combined
+    merged.clear();
+    merged.reserve(into.size() + from.size());
+    auto a = into.begin();
+    auto b = from.begin();
+    while (a != into.end() || b != from.end()) {
+      if (b == from.end() || (a != into.end() && a->index < b->index)) {
+        merged.push_back(*a++);
+      } else if (a == into.end() || b->index < a->index) {
+        merged.push_back(*b++);
+      } else {
+        merged.push_back(*a++);
+        mergeBar(merged.back(), *b++);
+      }
+    }
+    into.swap(merged);
+  }
+}
+
+nyse::Bars::Bars(std::string array_name, uint64_t barSeconds)
+    : accumulated(std::max<uint64_t>(barSeconds, 1) * 1000000000UL) {
+  this->array_uri = std::move(array_name);
+  this->ctx = std::make_shared<tiledb::Context>();
+  this->type = FileType::Bars;
+  this->origin = "Bars are computed by Trade loads with --bars";
+}
+
+void nyse::Bars::createArray(tiledb::FilterList coordinate_filter_list,
+                             tiledb::FilterList offset_filter_list,
+                             tiledb::FilterList attribute_filter_list) {
+  // If the array already exists on disk, return immediately.
+  if (tiledb::Object::object(*ctx, array_uri).type() ==
+      tiledb::Object::Type::Array)
+    return;
+
+  // An hour of bars per tile
+  uint64_t barsPerTile = std::max<uint64_t>(3600000000000UL / width(), 1);
+  uint64_t maxBar = std::numeric_limits<uint64_t>::max() / width();
+
+  tiledb::Domain domain(*ctx);
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(
+      *ctx, "symbol_id", {{0, 10000}}, symbolTile));
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(
+      *ctx, "bar", {{0, maxBar - barsPerTile}}, barsPerTile));
+
+  tiledb::ArraySchema schema(*ctx, TILEDB_DENSE);
+  schema.set_domain(domain).set_order({{TILEDB_ROW_MAJOR, TILEDB_ROW_MAJOR}});
+
+  if (coordinate_filter_list.nfilters() > 0) {
+    schema.set_coords_filter_list(coordinate_filter_list);
+  }
+
+  if (offset_filter_list.nfilters() > 0) {
+    schema.set_offsets_filter_list(offset_filter_list);
+  }
+
+  // Set compression filter to ZSTD if not already set
+  if (attribute_filter_list.nfilters() == 0) {
+    tiledb::Filter compressor(*ctx, TILEDB_FILTER_ZSTD);
+    attribute_filter_list.add_filter(compressor);
+  }
+
+  tiledb::Attribute open = tiledb::Attribute::create<float>(*ctx, "open")
+                               .set_filter_list(attribute_filter_list);
+  tiledb::Attribute high = tiledb::Attribute::create<float>(*ctx, "high")
+                               .set_filter_list(attribute_filter_list);
+  tiledb::Attribute low = tiledb::Attribute::create<float>(*ctx, "low")
+                              .set_filter_list(attribute_filter_list);
+  tiledb::Attribute close = tiledb::Attribute::create<float>(*ctx, "close")
+                                .set_filter_list(attribute_filter_list);
+  tiledb::Attribute volume =
+      tiledb::Attribute::create<uint64_t>(*ctx, "volume")
+          .set_filter_list(attribute_filter_list);
+  tiledb::Attribute vwap = tiledb::Attribute::create<double>(*ctx, "vwap")
+                               .set_filter_list(attribute_filter_list);
+  tiledb::Attribute trade_count =
+      tiledb::Attribute::create<uint32_t>(*ctx, "trade_count")
+          .set_filter_list(attribute_filter_list);
+  schema.add_attributes(open, high, low, close, volume, vwap, trade_count);
+
+  // Create the (empty) array on disk.
+  tiledb::Array::create(array_uri, schema);
+}
+
+void nyse::Bars::rowsParsed(
+    uint64_t source, const std::vector<tiledb::Dimension> &dimensions,
+    const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers) {
+  auto coords = buffers.find(TILEDB_COORDS);
+  auto price = buffers.find("Trade_Price");
+  auto volume = buffers.find("Trade_Volume");
+  if (coords == buffers.end() || price == buffers.end() ||
+      volume == buffers.end())
+    return;
+
+  const std::vector<uint64_t> &coordValues =
+      *std::static_pointer_cast<std::vector<uint64_t>>(coords->second->values);
+  const std::vector<float> &prices =
+      *std::static_pointer_cast<std::vector<float>>(price->second->values);
+  const std::vector<uint32_t> &volumes =
+      *std::static_pointer_cast<std::vector<uint32_t>>(volume->second->values);
+  uint64_t rows = std::min(prices.size(), volumes.size());
+  if (rows == 0)
+    return;
+  uint64_t ndim = dimensions.size();
+  uint64_t symbolIndex = dimensionIndex(dimensions, "symbol_id");
+  uint64_t datetimeIndex = dimensionIndex(dimensions, "datetime");
+
+  // Accumulated locally and merged once so workers rarely contend
+  BarSet workerBars(width());
+  for (uint64_t i = 0; i < rows; i++)
+    workerBars.add(coordValues[i * ndim + symbolIndex],
+                   coordValues[i * ndim + datetimeIndex], prices[i],
+                   volumes[i]);
+  merge(workerBars);
+}
+
+void nyse::Bars::merge(const BarSet &bars) {
+  std::lock_guard<std::mutex> lock(barsMutex);
+  accumulated.merge(bars);
+}
+
+std::string nyse::Bars::contents() const {
+  return "bars of " + std::to_string(width() / 1000000000UL) + " seconds";
+}
+
+uint64_t nyse::Bars::writeParsed() {
+  std::lock_guard<std::mutex> lock(barsMutex);
+  const std::vector<SymbolBars> &symbols = accumulated.symbols();
+  query.reset(nullptr);
+  array = std::make_unique<tiledb::Array>(*ctx, array_uri,
+                                          tiledb_query_type_t::TILEDB_WRITE);
+  openedForRead = false;
+
+  std::vector<uint64_t> coords;
+  std::vector<float> open, high, low, close;
+  std::vector<uint64_t> volume;
+  std::vector<double> vwap;
+  std::vector<uint32_t> tradeCount;
+  uint64_t written = 0;
+
+  // Only the cells of bars with trades are written, a rectangle over the
+  // block's bar range would overwrite bars of earlier loads and span every
+  // bar between the first and last day loaded
+  for (uint64_t blockStart = 0; blockStart < symbols.size();
+       blockStart += symbolTile) {
+    uint64_t blockEnd =
+        std::min<uint64_t>(blockStart + symbolTile, symbols.size());
+    coords.clear();
+    open.clear();
+    high.clear();
+    low.clear();
+    close.clear();
+    volume.clear();
+    vwap.clear();
+    tradeCount.clear();
+    for (uint64_t s = blockStart; s < blockEnd; s++) {
+      for (const Bar &bar : symbols[s].bars) {
+        coords.push_back(s);
+        coords.push_back(bar.index);
+        open.push_back(bar.open);
+        high.push_back(bar.high);
+        low.push_back(bar.low);
+        close.push_back(bar.close);
+        volume.push_back(bar.volume);
+        vwap.push_back(bar.volume > 0
+                           ? bar.notional / bar.volume
+                           : std::numeric_limits<double>::quiet_NaN());
+        tradeCount.push_back(bar.trades);
+      }
+    }
+    if (open.empty())
+      continue;
+
+    TraceSpan span("submit", array_uri);
+    span.setRows(open.size());
+    tiledb::Query blockQuery(*ctx, *array);
+    blockQuery.set_layout(tiledb_layout_t::TILEDB_UNORDERED);
+    blockQuery.set_coordinates(coords)
+        .set_buffer("open", open)
+        .set_buffer("high", high)
+        .set_buffer("low", low)
+        .set_buffer("close", close)
+        .set_buffer("volume", volume)
+        .set_buffer("vwap", vwap)
+        .set_buffer("trade_count", tradeCount);
+    if (blockQuery.submit() == tiledb::Query::Status::FAILED) {
+      std::cerr << "Writing bars of symbols " << blockStart << " to "
+                << blockEnd - 1 << " failed" << std::endl;
+    } else {
+      written += open.size();
+    }
+    blockQuery.finalize();
+  }
+
+  array->close();
+  array.reset(nullptr);
+  return written;
+}
+
+void nyse::Bars::resultsRead(
+    const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+    const ResultElements &resultElements, uint64_t rows) {
+  auto replace = [&](const char *column, auto fill, auto value) {
+    using T = decltype(fill);
+    auto buf = buffers.find(column);
+    if (buf == buffers.end())
+      return;
+    T *values = std::static_pointer_cast<std::vector<T>>(buf->second->values)
+                    ->data();
+    for (uint64_t i = 0; i < rows; i++) {
+      if (values[i] == fill)
+        values[i] = value;
+    }
+  };
+  const float missing = std::numeric_limits<float>::quiet_NaN();
+  for (const char *column : {"open", "high", "low", "close"})
+    replace(column, std::numeric_limits<float>::max(), missing);
+  replace("vwap", std::numeric_limits<double>::max(),
+          std::numeric_limits<double>::quiet_NaN());
+  replace("volume", std::numeric_limits<uint64_t>::max(), uint64_t(0));
+  replace("trade_count", std::numeric_limits<uint32_t>::max(), uint32_t(0));
+}
+
+std::vector<uint64_t> nyse::Bars::symbolSubarray(
+    uint64_t symbolId, uint64_t start, uint64_t end,
+    const std::vector<std::pair<uint64_t, uint64_t>> &nonEmptyDomain) {
+  return Array::symbolSubarray(symbolId, start / width(), end / width(),
+                               nonEmptyDomain);
+}
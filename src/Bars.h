@@ -0,0 +1,190 @@
+/**
+ * @file  Bars.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Open, high, low, close, volume and VWAP bars of trades, accumulated while
+ * trades are loaded and stored in a dense companion array
+ *
+ */
+
+#ifndef NYSE_INGESTOR_BARS_H
+#define NYSE_INGESTOR_BARS_H
+
+#include "Array.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * Aggregate of the trades in one bar
+ */
+struct Bar {
+  // datetime / width
+  uint64_t index = 0;
+  float open = 0;
+  float high = 0;
+  float low = 0;
+  float close = 0;
+  uint64_t volume = 0;
+  double notional = 0;
+  uint32_t trades = 0;
+  // Datetimes of the open and close trades
+  uint64_t openTime = 0;
+  uint64_t closeTime = 0;
+};
+
+/**
+ * Bars of one symbol with at least one trade, sorted by index. Only bars with
+ * trades are kept, so memory does not grow with the time spanned by a load.
+ */
+struct SymbolBars {
+  std::vector<Bar> bars;
+};
+
+/**
+ * Bars of all symbols, indexed directly by symbol_id so accumulating a trade
+ * does no hashing. Trades mostly arrive in time order and land in the last
+ * bar of their symbol.
+ */
+class BarSet {
+public:
+  /**
+   * @param width bar width in nanoseconds
+   */
+  explicit BarSet(uint64_t width) : barWidth(width) {}
+
+  /**
+   * Add a trade to its bar
+   * @param symbolId
+   * @param datetime nanoseconds since epoch
+   * @param price
+   * @param volume
+   */
+  void add(uint64_t symbolId, uint64_t datetime, float price, uint32_t volume);
+
+  /**
+   * Combine the bars of another set into this one
+   * @param other set of the same width
+   */
+  void merge(const BarSet &other);
+
+  uint64_t width() const { return barWidth; }
+
+  const std::vector<SymbolBars> &symbols() const { return bySymbol; }
+
+private:
+  /**
+   * Bar of a symbol, inserting an empty one if the symbol has none at index
+   * @param symbolId
+   * @param index bar index
+   * @return bar
+   */
+  Bar &bar(uint64_t symbolId, uint64_t index);
+
+  uint64_t barWidth;
+  std::vector<SymbolBars> bySymbol;
+};
+
+/**
+ * Dense array of bars with dimensions symbol_id and bar, the bar index being
+ * datetime / width. Bars are written by Trade loads, reads and queries work
+ * like those of any other array with query time ranges mapped to bars. Only
+ * bars with trades are written, cells never written read back as bars
+ * without trades.
+ */
+class Bars : public DerivedArray {
+public:
+  /**
+   * @param array_name
+   * @param barSeconds bar width in seconds
+   */
+  Bars(std::string array_name, uint64_t barSeconds);
+
+  /**
+   * Create bars array
+   */
+  void createArray(tiledb::FilterList coordinate_filter_list,
+                   tiledb::FilterList offset_filter_list,
+                   tiledb::FilterList attribute_filter_list) override;
+
+  /**
+   * Bar width in nanoseconds
+   */
+  uint64_t width() const { return accumulated.width(); }
+
+  /**
+   * Add the trades parsed by a load worker to their bars
+   */
+  void rowsParsed(uint64_t source,
+                  const std::vector<tiledb::Dimension> &dimensions,
+                  const std::unordered_map<std::string, std::shared_ptr<buffer>>
+                      &buffers) override;
+
+  /**
+   * Add bars accumulated by a load worker, safe to call concurrently
+   * @param bars
+   */
+  void merge(const BarSet &bars);
+
+  /**
+   * Write all accumulated bars, one write of the bars with trades per block
+   * of symbols. Other cells, including bars written by earlier loads, are
+   * left as they are.
+   * @return bars with trades written
+   */
+  uint64_t writeParsed() override;
+
+  std::string contents() const override;
+
+protected:
+  /**
+   * Map TileDB's fill values of cells never written to a bar without trades:
+   * NaN prices and zero volume and trade count
+   */
+  void resultsRead(
+      const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+      const ResultElements &resultElements, uint64_t rows) override;
+
+  /**
+   * Subarray of the bars of one symbol covering a time range
+   */
+  std::vector<uint64_t> symbolSubarray(
+      uint64_t symbolId, uint64_t start, uint64_t end,
+      const std::vector<std::pair<uint64_t, uint64_t>> &nonEmptyDomain)
+      override;
+
+private:
+  std::mutex barsMutex;
+  BarSet accumulated;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_BARS_H
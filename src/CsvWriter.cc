@@ -0,0 +1,116 @@
+/**
+ * @file  CsvWriter.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Delimited text output buffer with allocation free integer and float
+ * formatting, used for exporting query results
+ *
+ */
+
+#include "CsvWriter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+static const char digitPairs[] = "00010203040506070809"
+                                 "10111213141516171819"
+                                 "20212223242526272829"
+                                 "30313233343536373839"
+                                 "40414243444546474849"
+                                 "50515253545556575859"
+                                 "60616263646566676869"
+                                 "70717273747576777879"
+                                 "80818283848586878889"
+                                 "90919293949596979899";
+
+/**
+ * Write the decimal digits of a value ending just before end
+ * @param value
+ * @param end
+ * @return pointer to the first digit
+ */
+static char *formatDigits(uint64_t value, char *end) {
+  while (value >= 100) {
+    uint64_t pair = (value % 100) * 2;
+    value /= 100;
+    *--end = digitPairs[pair + 1];
+    *--end = digitPairs[pair];
+  }
+  if (value >= 10) {
+    *--end = digitPairs[value * 2 + 1];
+    *--end = digitPairs[value * 2];
+  } else {
+    *--end = static_cast<char>('0' + value);
+  }
+  return end;
+}
+
+void nyse::CsvWriter::appendUnsigned(uint64_t value) {
+  char digits[20];
+  char *end = digits + sizeof(digits);
+  char *begin = formatDigits(value, end);
+  append(begin, end - begin);
+}
+
+void nyse::CsvWriter::appendSigned(int64_t value) {
+  uint64_t magnitude = static_cast<uint64_t>(value);
+  if (value < 0) {
+    appendChar('-');
+    magnitude = 0 - magnitude;
+  }
+  appendUnsigned(magnitude);
+}
+
+void nyse::CsvWriter::appendFloat(double value) {
+  // Attributes are single precision, for which value * 1e6 is exact in a
+  // double (24 + 14 significant bits). Rounding that to an integer in the
+  // default round to nearest even mode matches %f exactly. Doubles which are
+  // not floats, non finite values and large magnitudes use snprintf.
+  if (std::isfinite(value) && std::fabs(value) < 1e12 &&
+      static_cast<double>(static_cast<float>(value)) == value) {
+    double scaled = std::nearbyint(std::fabs(value) * 1e6);
+    uint64_t micros = static_cast<uint64_t>(scaled);
+    if (std::signbit(value))
+      appendChar('-');
+    appendUnsigned(micros / 1000000);
+    appendChar('.');
+    char fraction[6];
+    uint64_t remainder = micros % 1000000;
+    for (int i = 5; i >= 0; i--) {
+      fraction[i] = static_cast<char>('0' + remainder % 10);
+      remainder /= 10;
+    }
+    append(fraction, sizeof(fraction));
+    return;
+  }
+
+  char formatted[352];
+  int size = snprintf(formatted, sizeof(formatted), "%f", value);
+  if (size > 0)
+    append(formatted, std::min<size_t>(size, sizeof(formatted) - 1));
+}
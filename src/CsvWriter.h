@@ -0,0 +1,135 @@
+/**
+ * @file  CsvWriter.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Delimited text output buffer with allocation free integer and float
+ * formatting, used for exporting query results
+ *
+ */
+
+#ifndef NYSE_INGESTOR_CSVWRITER_H
+#define NYSE_INGESTOR_CSVWRITER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * Growable output buffer rows are formatted into. The buffer is kept between
+ * uses so steady state formatting does not allocate. Numbers are formatted
+ * exactly as std::to_string does so output is unchanged from the stringstream
+ * based export.
+ */
+class CsvWriter {
+public:
+  explicit CsvWriter(std::string delimiter = "|")
+      : delimiter(std::move(delimiter)) {}
+
+  /**
+   * Discard the contents, keeping the allocation
+   */
+  void clear() { length = 0; }
+
+  const char *data() const { return buffer.data(); }
+  size_t size() const { return length; }
+
+  /**
+   * Write the contents to a stream
+   * @param output
+   */
+  void writeTo(std::ostream &output) const {
+    output.write(buffer.data(), length);
+  }
+
+  void setDelimiter(const std::string &delimiter) {
+    this->delimiter = delimiter;
+  }
+
+  void appendDelimiter() { append(delimiter.data(), delimiter.size()); }
+
+  void appendNewline() { appendChar('\n'); }
+
+  void appendChar(char c) {
+    reserve(1);
+    buffer[length++] = c;
+  }
+
+  void append(const char *data, size_t size) {
+    reserve(size);
+    memcpy(&buffer[length], data, size);
+    length += size;
+  }
+
+  void appendUnsigned(uint64_t value);
+
+  void appendSigned(int64_t value);
+
+  /**
+   * Format with six decimals, identical to std::to_string and printf's %f
+   * @param value
+   */
+  void appendFloat(double value);
+
+  /**
+   * Format a value the way std::to_string would, except char which is written
+   * as a single character
+   */
+  void appendValue(char value) { appendChar(value); }
+  void appendValue(int8_t value) { appendSigned(value); }
+  void appendValue(uint8_t value) { appendUnsigned(value); }
+  void appendValue(int16_t value) { appendSigned(value); }
+  void appendValue(uint16_t value) { appendUnsigned(value); }
+  void appendValue(int32_t value) { appendSigned(value); }
+  void appendValue(uint32_t value) { appendUnsigned(value); }
+  void appendValue(int64_t value) { appendSigned(value); }
+  void appendValue(uint64_t value) { appendUnsigned(value); }
+  void appendValue(float value) { appendFloat(value); }
+  void appendValue(double value) { appendFloat(value); }
+
+private:
+  /**
+   * Make room for at least bytes more, growing geometrically
+   * @param bytes
+   */
+  void reserve(size_t bytes) {
+    if (length + bytes > buffer.size())
+      buffer.resize(std::max(buffer.size() * 2, length + bytes + 4096));
+  }
+
+  std::vector<char> buffer;
+  size_t length = 0;
+  std::string delimiter;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_CSVWRITER_H
@@ -0,0 +1,76 @@
+/**
+ * @file  MemoryBudget.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Process wide memory budget shared by all load workers
+ *
+ */
+
+#include "MemoryBudget.h"
+#include <algorithm>
+
+nyse::MemoryBudget::MemoryBudget(uint64_t limit) : maxBytes(limit) {}
+
+bool nyse::MemoryBudget::tryReserve(uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (usedBytes + bytes > maxBytes)
+    return false;
+  usedBytes += bytes;
+  peakBytes = std::max(peakBytes, usedBytes);
+  return true;
+}
+
+bool nyse::MemoryBudget::waitReserve(uint64_t bytes,
+                                     std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!released.wait_for(lock, timeout, [this, bytes] {
+        return usedBytes + bytes <= maxBytes;
+      }))
+    return false;
+  usedBytes += bytes;
+  peakBytes = std::max(peakBytes, usedBytes);
+  return true;
+}
+
+void nyse::MemoryBudget::release(uint64_t bytes) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    usedBytes -= std::min(bytes, usedBytes);
+  }
+  released.notify_all();
+}
+
+uint64_t nyse::MemoryBudget::used() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return usedBytes;
+}
+
+uint64_t nyse::MemoryBudget::peak() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return peakBytes;
+}
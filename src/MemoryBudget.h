@@ -0,0 +1,95 @@
+/**
+ * @file  MemoryBudget.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Process wide memory budget shared by all load workers
+ *
+ */
+
+#ifndef NYSE_INGESTOR_MEMORYBUDGET_H
+#define NYSE_INGESTOR_MEMORYBUDGET_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace nyse {
+
+/**
+ * Tracks bytes reserved by all workers against a fixed limit. Workers reserve
+ * memory as their column buffers grow and release it once the buffers have
+ * been written out.
+ */
+class MemoryBudget {
+public:
+  /**
+   * @param limit maximum number of bytes which may be reserved
+   */
+  explicit MemoryBudget(uint64_t limit);
+
+  /**
+   * Reserve bytes if they fit in the budget
+   * @param bytes
+   * @return true if reserved
+   */
+  bool tryReserve(uint64_t bytes);
+
+  /**
+   * Block until bytes can be reserved or the timeout expires
+   * @param bytes
+   * @param timeout
+   * @return true if reserved
+   */
+  bool waitReserve(uint64_t bytes, std::chrono::milliseconds timeout);
+
+  /**
+   * Return previously reserved bytes to the budget and wake any waiters
+   * @param bytes
+   */
+  void release(uint64_t bytes);
+
+  uint64_t limit() const { return maxBytes; }
+
+  uint64_t used();
+
+  /**
+   * Highest number of bytes reserved at any time
+   */
+  uint64_t peak();
+
+private:
+  const uint64_t maxBytes;
+  uint64_t usedBytes = 0;
+  uint64_t peakBytes = 0;
+  std::mutex mutex;
+  std::condition_variable released;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_MEMORYBUDGET_H
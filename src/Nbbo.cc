@@ -0,0 +1,371 @@
+/**
+ * @file  Nbbo.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * National best bid and offer reconstructed from per exchange quotes and stored
+ * as a sparse array of NBBO changes
+ *
+ */
+
+#include "Nbbo.h"
+#include "Quote.h"
+#include "ResultStream.h"
+#include "Trace.h"
+#include "utils.h"
+#include <ThreadPool.h>
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+static const std::vector<std::string> quoteColumns = {
+    "datetime",  "Exchange",    "Bid_Price",
+    "Bid_Size",  "Offer_Price", "Offer_Size"};
+
+/**
+ * Empty buffers for NBBO changes
+ */
+static std::unordered_map<std::string, std::shared_ptr<nyse::buffer>>
+changeBuffers() {
+  std::unordered_map<std::string, std::shared_ptr<nyse::buffer>> buffers;
+  auto add = [&](const std::string &name, tiledb_datatype_t datatype) {
+    buffers.emplace(name, std::make_shared<nyse::buffer>(nyse::buffer{
+                              nullptr, nyse::createBuffer(datatype), datatype}));
+  };
+  add(TILEDB_COORDS, TILEDB_UINT64);
+  add("Bid_Price", TILEDB_FLOAT32);
+  add("Bid_Size", TILEDB_UINT32);
+  add("Bid_Exchange", TILEDB_CHAR);
+  add("Offer_Price", TILEDB_FLOAT32);
+  add("Offer_Size", TILEDB_UINT32);
+  add("Offer_Exchange", TILEDB_CHAR);
+  return buffers;
+}
+
+/**
+ * Typed values of a change buffer
+ */
+template <typename T>
+static std::vector<T> &
+values(std::unordered_map<std::string, std::shared_ptr<nyse::buffer>> &buffers,
+       const std::string &name) {
+  return *std::static_pointer_cast<std::vector<T>>(buffers.at(name)->values);
+}
+
+bool nyse::ConsolidatedBook::update(char exchange, uint64_t datetime,
+                                    float bidPrice, uint32_t bidSize,
+                                    float offerPrice, uint32_t offerSize) {
+  if (exchange < 'A' || exchange > 'Z')
+    return false;
+  ExchangeBook &book = books[exchange - 'A'];
+  // The time at a price only restarts when the price changes
+  if (bidPrice != book.bidPrice)
+    book.bidTime = datetime;
+  if (offerPrice != book.offerPrice)
+    book.offerTime = datetime;
+  book.bidPrice = bidPrice;
+  book.bidSize = bidSize;
+  book.offerPrice = offerPrice;
+  book.offerSize = offerSize;
+  return true;
+}
+
+nyse::NbboQuote nyse::ConsolidatedBook::nbbo() const {
+  NbboQuote nbbo;
+  uint64_t bidTime = std::numeric_limits<uint64_t>::max();
+  uint64_t offerTime = std::numeric_limits<uint64_t>::max();
+  for (int e = 0; e < exchanges; e++) {
+    const ExchangeBook &book = books[e];
+    if (book.bidPrice > 0 && book.bidSize > 0) {
+      if (nbbo.bidExchange == 0 || book.bidPrice > nbbo.bidPrice) {
+        nbbo.bidPrice = book.bidPrice;
+        nbbo.bidSize = book.bidSize;
+        nbbo.bidExchange = char('A' + e);
+        bidTime = book.bidTime;
+      } else if (book.bidPrice == nbbo.bidPrice) {
+        nbbo.bidSize += book.bidSize;
+        if (book.bidTime < bidTime) {
+          nbbo.bidExchange = char('A' + e);
+          bidTime = book.bidTime;
+        }
+      }
+    }
+    if (book.offerPrice > 0 && book.offerSize > 0) {
+      if (nbbo.offerExchange == 0 || book.offerPrice < nbbo.offerPrice) {
+        nbbo.offerPrice = book.offerPrice;
+        nbbo.offerSize = book.offerSize;
+        nbbo.offerExchange = char('A' + e);
+        offerTime = book.offerTime;
+      } else if (book.offerPrice == nbbo.offerPrice) {
+        nbbo.offerSize += book.offerSize;
+        if (book.offerTime < offerTime) {
+          nbbo.offerExchange = char('A' + e);
+          offerTime = book.offerTime;
+        }
+      }
+    }
+  }
+  return nbbo;
+}
+
+void nyse::ConsolidatedBook::clear() {
+  for (ExchangeBook &book : books)
+    book = ExchangeBook();
+}
+
+nyse::Nbbo::Nbbo(std::string array_name) {
+  this->array_uri = std::move(array_name);
+  this->ctx = std::make_shared<tiledb::Context>();
+  this->type = FileType::Nbbo;
+  this->origin = "The NBBO is built from a Quote array with --nbbo";
+}
+
+void nyse::Nbbo::createArray(tiledb::FilterList coordinate_filter_list,
+                             tiledb::FilterList offset_filter_list,
+                             tiledb::FilterList attribute_filter_list) {
+  // If the array already exists on disk, return immediately.
+  if (tiledb::Object::object(*ctx, array_uri).type() ==
+      tiledb::Object::Type::Array)
+    return;
+
+  // Same dimensions as the Quote array
+  tiledb::Domain domain(*ctx);
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(*ctx, "symbol_id",
+                                                           {{0, 10000}}, 100));
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(
+      *ctx, "datetime", {{0, UINT64_MAX - 60UL * 60 * 1000000000}},
+      60UL * 60 * 1000000000));
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(
+      *ctx, "Sequence_Number", {{0, UINT64_MAX - 1}}, UINT64_MAX));
+
+  tiledb::ArraySchema schema(*ctx, TILEDB_SPARSE);
+  schema.set_domain(domain).set_order({{TILEDB_ROW_MAJOR, TILEDB_ROW_MAJOR}});
+
+  if (coordinate_filter_list.nfilters() > 0) {
+    schema.set_coords_filter_list(coordinate_filter_list);
+  }
+
+  if (offset_filter_list.nfilters() > 0) {
+    schema.set_offsets_filter_list(offset_filter_list);
+  }
+
+  schema.set_capacity(10000000);
+
+  // Set compression filter to ZSTD if not already set
+  if (attribute_filter_list.nfilters() == 0) {
+    tiledb::Filter compressor(*ctx, TILEDB_FILTER_ZSTD);
+    attribute_filter_list.add_filter(compressor);
+  }
+
+  tiledb::Attribute Bid_Price =
+      tiledb::Attribute::create<float>(*ctx, "Bid_Price")
+          .set_filter_list(attribute_filter_list);
+  tiledb::Attribute Bid_Size =
+      tiledb::Attribute::create<uint32_t>(*ctx, "Bid_Size")
+          .set_filter_list(attribute_filter_list);
+  tiledb::Attribute Bid_Exchange =
+      tiledb::Attribute::create<char>(*ctx, "Bid_Exchange")
+          .set_filter_list(attribute_filter_list);
+  tiledb::Attribute Offer_Price =
+      tiledb::Attribute::create<float>(*ctx, "Offer_Price")
+          .set_filter_list(attribute_filter_list);
+  tiledb::Attribute Offer_Size =
+      tiledb::Attribute::create<uint32_t>(*ctx, "Offer_Size")
+          .set_filter_list(attribute_filter_list);
+  tiledb::Attribute Offer_Exchange =
+      tiledb::Attribute::create<char>(*ctx, "Offer_Exchange")
+          .set_filter_list(attribute_filter_list);
+  schema.add_attributes(Bid_Price, Bid_Size, Bid_Exchange, Offer_Price,
+                        Offer_Size, Offer_Exchange);
+
+  // Create the (empty) array on disk.
+  tiledb::Array::create(array_uri, schema);
+}
+
+void nyse::Nbbo::buildSymbol(
+    Array &quotes, uint64_t symbolId, uint64_t start, uint64_t end,
+    std::unordered_map<std::string, std::shared_ptr<buffer>> &changes) {
+  // Quotes still standing at start were sent earlier in its exchange day, so
+  // the book is built from the start of that day and changes before start
+  // are not written
+  uint64_t dayStart = std::min(start, exchange_day_start(exchange_day(start)));
+  std::vector<uint64_t> subarray =
+      quotes.symbolSubarray(symbolId, dayStart, end, quotes.nonEmptyDomain());
+  if (subarray.empty())
+    return;
+  std::vector<tiledb::Dimension> dimensions =
+      quotes.array->schema().domain().dimensions();
+  uint64_t datetimeIndex = dimensionIndex(dimensions, "datetime");
+  uint64_t sequenceIndex = dimensionIndex(dimensions, "Sequence_Number");
+
+  std::vector<uint64_t> &coords = values<uint64_t>(changes, TILEDB_COORDS);
+  std::vector<float> &bidPrices = values<float>(changes, "Bid_Price");
+  std::vector<uint32_t> &bidSizes = values<uint32_t>(changes, "Bid_Size");
+  std::vector<char> &bidExchanges = values<char>(changes, "Bid_Exchange");
+  std::vector<float> &offerPrices = values<float>(changes, "Offer_Price");
+  std::vector<uint32_t> &offerSizes = values<uint32_t>(changes, "Offer_Size");
+  std::vector<char> &offerExchanges = values<char>(changes, "Offer_Exchange");
+
+  ConsolidatedBook book;
+  NbboQuote current;
+  uint64_t day = std::numeric_limits<uint64_t>::max();
+  ResultStream stream(quotes, subarray);
+  for (const ResultBatch &batch : stream) {
+    uint64_t ndim = batch.dimensions();
+    ColumnSpan<uint64_t> coordinates = batch.coordinates<uint64_t>();
+    ColumnSpan<char> exchange = batch.values<char>("Exchange");
+    ColumnSpan<float> bidPrice = batch.values<float>("Bid_Price");
+    ColumnSpan<uint32_t> bidSize = batch.values<uint32_t>("Bid_Size");
+    ColumnSpan<float> offerPrice = batch.values<float>("Offer_Price");
+    ColumnSpan<uint32_t> offerSize = batch.values<uint32_t>("Offer_Size");
+
+    for (uint64_t i = 0; i < batch.rows(); i++) {
+      uint64_t datetime = coordinates[i * ndim + datetimeIndex];
+      // Quotes of the previous day do not carry over the close
+      if (exchange_day(datetime) != day) {
+        day = exchange_day(datetime);
+        book.clear();
+        current = NbboQuote();
+      }
+      if (!book.update(exchange[i], datetime, bidPrice[i], bidSize[i],
+                       offerPrice[i], offerSize[i]))
+        continue;
+
+      NbboQuote nbbo = book.nbbo();
+      if (nbbo == current)
+        continue;
+      current = nbbo;
+      if (datetime < start)
+        continue;
+      coords.push_back(symbolId);
+      coords.push_back(datetime);
+      coords.push_back(coordinates[i * ndim + sequenceIndex]);
+      bidPrices.push_back(nbbo.bidPrice);
+      bidSizes.push_back(nbbo.bidSize);
+      bidExchanges.push_back(nbbo.bidExchange);
+      offerPrices.push_back(nbbo.offerPrice);
+      offerSizes.push_back(nbbo.offerSize);
+      offerExchanges.push_back(nbbo.offerExchange);
+    }
+  }
+}
+
+void nyse::Nbbo::append(
+    std::unordered_map<std::string, std::shared_ptr<buffer>> &changes,
+    bool force) {
+  std::lock_guard<std::mutex> lock(pendingMutex);
+  for (auto &entry : changes) {
+    buffer &target = *pending.at(entry.first);
+    dispatchDatatype(entry.second->datatype, [&](auto type) {
+      using T = decltype(type);
+      std::vector<T> &from =
+          *std::static_pointer_cast<std::vector<T>>(entry.second->values);
+      std::vector<T> &to =
+          *std::static_pointer_cast<std::vector<T>>(target.values);
+      to.insert(to.end(), from.begin(), from.end());
+      from.clear();
+    });
+  }
+  pendingRows = values<float>(pending, "Bid_Price").size();
+  if (pendingRows == 0 || (!force && pendingRows < flushRows))
+    return;
+
+  writeFragment(pending);
+  changesWritten += pendingRows;
+  pending = changeBuffers();
+  pendingRows = 0;
+}
+
+uint64_t nyse::Nbbo::build(const std::string &quoteUri,
+                           std::vector<uint64_t> symbolIds, uint64_t start,
+                           uint64_t end, uint32_t threads) {
+  threads = std::max(threads, 1u);
+  if (symbolIds.empty()) {
+    Quote quotes(quoteUri, "", '|');
+    quotes.setCtx(ctx);
+    std::vector<std::pair<uint64_t, uint64_t>> domain =
+        quotes.nonEmptyDomain();
+    uint64_t symbolIndex = dimensionIndex(
+        quotes.array->schema().domain().dimensions(), "symbol_id");
+    if (domain.empty())
+      return 0;
+    for (uint64_t s = domain[symbolIndex].first;
+         s <= domain[symbolIndex].second; s++)
+      symbolIds.push_back(s);
+  }
+
+  query.reset(nullptr);
+  array = std::make_unique<tiledb::Array>(*ctx, array_uri,
+                                          tiledb_query_type_t::TILEDB_WRITE);
+  openedForRead = false;
+  pending = changeBuffers();
+  pendingRows = 0;
+  changesWritten = 0;
+
+  std::atomic<uint64_t> nextSymbol{0};
+  auto worker = [&]() {
+    std::unique_ptr<Quote> quotes;
+    auto changes = changeBuffers();
+    for (uint64_t s = nextSymbol++; s < symbolIds.size(); s = nextSymbol++) {
+      try {
+        if (quotes == nullptr) {
+          quotes = std::make_unique<Quote>(quoteUri, "", '|');
+          quotes->setCtx(ctx);
+          if (!quotes->setColumns(quoteColumns))
+            throw std::runtime_error("Invalid NBBO columns");
+        }
+        TraceSpan span("nbbo", quoteUri);
+        buildSymbol(*quotes, symbolIds[s], start, end, changes);
+        span.setRows(values<float>(changes, "Bid_Price").size());
+        append(changes, false);
+      } catch (const std::exception &e) {
+        std::cerr << "NBBO of symbol_id " << symbolIds[s]
+                  << " failed: " << e.what() << std::endl;
+        // Drop the symbol's partial changes
+        changes = changeBuffers();
+      }
+    }
+  };
+
+  {
+    ThreadPool pool(std::min<uint64_t>(threads, symbolIds.size() + 1));
+    std::vector<std::future<void>> workers;
+    for (uint32_t t = 0; t < threads && t < symbolIds.size(); t++)
+      workers.emplace_back(pool.enqueue(worker));
+    for (auto &future : workers)
+      future.get();
+  }
+
+  std::unordered_map<std::string, std::shared_ptr<buffer>> none =
+      changeBuffers();
+  append(none, true);
+  array->close();
+  array.reset(nullptr);
+  return changesWritten;
+}
@@ -0,0 +1,185 @@
+/**
+ * @file  Nbbo.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * National best bid and offer reconstructed from per exchange quotes and stored
+ * as a sparse array of NBBO changes
+ *
+ */
+
+#ifndef NYSE_INGESTOR_NBBO_H
+#define NYSE_INGESTOR_NBBO_H
+
+#include "Array.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * Top of book of one exchange, a side with a zero price or size is not
+ * quoted
+ */
+struct ExchangeBook {
+  float bidPrice = 0;
+  uint32_t bidSize = 0;
+  uint64_t bidTime = 0;
+  float offerPrice = 0;
+  uint32_t offerSize = 0;
+  uint64_t offerTime = 0;
+};
+
+/**
+ * Consolidated best bid and offer. Sizes are summed over all exchanges at the
+ * best price, the exchange is the one which has been at that price longest.
+ * An exchange of 0 means the side is not quoted.
+ */
+struct NbboQuote {
+  float bidPrice = 0;
+  uint32_t bidSize = 0;
+  char bidExchange = 0;
+  float offerPrice = 0;
+  uint32_t offerSize = 0;
+  char offerExchange = 0;
+
+  bool operator==(const NbboQuote &other) const {
+    return bidPrice == other.bidPrice && bidSize == other.bidSize &&
+           bidExchange == other.bidExchange &&
+           offerPrice == other.offerPrice && offerSize == other.offerSize &&
+           offerExchange == other.offerExchange;
+  }
+  bool operator!=(const NbboQuote &other) const { return !(*this == other); }
+};
+
+/**
+ * Per exchange top of book of one symbol, indexed directly by the exchange
+ * code 'A' to 'Z'
+ */
+class ConsolidatedBook {
+public:
+  static const int exchanges = 26;
+
+  /**
+   * Apply a quote of an exchange
+   * @param exchange exchange code
+   * @param datetime
+   * @param bidPrice
+   * @param bidSize
+   * @param offerPrice
+   * @param offerSize
+   * @return false if the exchange code is not a letter
+   */
+  bool update(char exchange, uint64_t datetime, float bidPrice,
+              uint32_t bidSize, float offerPrice, uint32_t offerSize);
+
+  /**
+   * Current NBBO over all exchanges
+   */
+  NbboQuote nbbo() const;
+
+  /**
+   * Drop all quotes, at the start of a new trading day
+   */
+  void clear();
+
+private:
+  ExchangeBook books[exchanges];
+};
+
+/**
+ * Sparse array of NBBO changes with the dimensions of the Quote array. Each
+ * cell is keyed by the quote which changed the NBBO and holds the NBBO in
+ * effect from then on.
+ */
+class Nbbo : public DerivedArray {
+public:
+  explicit Nbbo(std::string array_name);
+
+  /**
+   * Create NBBO array
+   */
+  void createArray(tiledb::FilterList coordinate_filter_list,
+                   tiledb::FilterList offset_filter_list,
+                   tiledb::FilterList attribute_filter_list) override;
+
+  /**
+   * Replay the quotes of each symbol in time order and write the NBBO
+   * changes. Symbols are replayed concurrently, each worker with its own
+   * Quote reader sharing this array's context.
+   * @param quoteUri Quote array
+   * @param symbolIds symbol_ids to build, empty for all symbols of the Quote
+   * array
+   * @param start first change datetime in nanoseconds since epoch
+   * (inclusive), books are built from the start of its exchange day
+   * @param end last quote datetime in nanoseconds since epoch (inclusive)
+   * @param threads
+   * @return NBBO changes written
+   */
+  uint64_t build(const std::string &quoteUri, std::vector<uint64_t> symbolIds,
+                 uint64_t start, uint64_t end, uint32_t threads);
+
+  /**
+   * Buffered changes are written as a fragment once this many are pending
+   */
+  uint64_t flushRows = 1 << 22;
+
+private:
+  /**
+   * Replay one symbol from the start of the exchange day of start
+   * @param quotes reader with the NBBO columns projected
+   * @param symbolId
+   * @param start first change written
+   * @param end
+   * @param changes buffers to append NBBO changes to
+   */
+  void buildSymbol(Array &quotes, uint64_t symbolId, uint64_t start,
+                   uint64_t end,
+                   std::unordered_map<std::string, std::shared_ptr<buffer>>
+                       &changes);
+
+  /**
+   * Append a worker's changes to the pending changes, writing them once
+   * flushRows are pending
+   * @param changes emptied
+   * @param force write whatever is pending
+   */
+  void append(std::unordered_map<std::string, std::shared_ptr<buffer>> &changes,
+              bool force);
+
+  std::mutex pendingMutex;
+  std::unordered_map<std::string, std::shared_ptr<buffer>> pending;
+  uint64_t pendingRows = 0;
+  uint64_t changesWritten = 0;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_NBBO_H
@@ -0,0 +1,235 @@
+/**
+ * @file  PerfCounters.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Hardware performance counters (cycles, instructions, cache misses and branch
+ * mispredicts) grouped per ingest stage and per thread using Linux
+ * perf_event_open
+ *
+ */
+
+#include "PerfCounters.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char *stageNames[] = {"tokenize", "convert", "coords", "merge",
+                                   "submit"};
+
+#ifdef __linux__
+static const uint64_t eventConfigs[] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+/**
+ * Open a hardware counter for the calling thread on any cpu
+ * @param config counter to open
+ * @param groupFd leader fd or -1 to create a new group
+ * @return fd or -1 on failure
+ */
+static int openCounter(uint64_t config, int groupFd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.disabled = groupFd == -1 ? 1 : 0;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  return static_cast<int>(
+      syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+
+/**
+ * Open the counter group for a thread, members which fail to open are left at
+ * -1 and report zero
+ * @param state
+ * @return true if at least the cycles counter could be opened
+ */
+static bool openGroup(nyse::PerfThreadState *state) {
+  state->fds[0] = openCounter(eventConfigs[0], -1);
+  if (state->fds[0] == -1)
+    return false;
+  for (int i = 1; i < 4; i++)
+    state->fds[i] = openCounter(eventConfigs[i], state->fds[0]);
+  ioctl(state->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(state->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+}
+#endif
+
+nyse::PerfThreadState::~PerfThreadState() {
+#ifdef __linux__
+  for (int fd : fds) {
+    if (fd != -1)
+      close(fd);
+  }
+#endif
+}
+
+nyse::PerfCounters &nyse::PerfCounters::instance() {
+  static PerfCounters counters;
+  return counters;
+}
+
+bool nyse::PerfCounters::enable() {
+#ifdef __linux__
+  int fd = openCounter(eventConfigs[0], -1);
+  if (fd == -1) {
+    std::cerr << "Hardware performance counters unavailable ("
+              << strerror(errno)
+              << "), check /proc/sys/kernel/perf_event_paranoid. Continuing "
+                 "without them."
+              << std::endl;
+    return false;
+  }
+  close(fd);
+  isEnabled.store(true);
+  return true;
+#else
+  std::cerr << "Hardware performance counters are only supported on Linux. "
+               "Continuing without them."
+            << std::endl;
+  return false;
+#endif
+}
+
+nyse::PerfThreadState *nyse::PerfCounters::threadState() {
+  thread_local PerfThreadState *state = nullptr;
+  if (state == nullptr) {
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    threads.emplace_back(new PerfThreadState());
+    state = threads.back().get();
+    state->tid = static_cast<uint32_t>(threads.size());
+#ifdef __linux__
+    state->failed = !openGroup(state);
+#else
+    state->failed = true;
+#endif
+  }
+  return state;
+}
+
+bool nyse::PerfCounters::read(PerfSample &sample) {
+  PerfThreadState *state = threadState();
+  if (state->failed)
+    return false;
+#ifdef __linux__
+  uint64_t data[5];
+  ssize_t size = ::read(state->fds[0], data, sizeof(data));
+  if (size < static_cast<ssize_t>(2 * sizeof(uint64_t)))
+    return false;
+  // Values are returned in the order the group members were opened
+  uint64_t index = 1;
+  for (int i = 0; i < 4; i++) {
+    sample.values[i] =
+        (state->fds[i] != -1 && index <= data[0]) ? data[index++] : 0;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+void nyse::PerfCounters::add(PerfStage stage, const PerfSample &begin,
+                             const PerfSample &end, uint64_t rows,
+                             uint64_t bytes) {
+  PerfStageTotals &totals = threadState()->stages[static_cast<int>(stage)];
+  for (int i = 0; i < 4; i++)
+    totals.counters[i] += end.values[i] - begin.values[i];
+  totals.rows += rows;
+  totals.bytes += bytes;
+}
+
+/**
+ * Print one line of the report
+ */
+static void printTotals(FILE *out, const char *stage, const char *thread,
+                        const nyse::PerfStageTotals &totals) {
+  if (totals.rows == 0)
+    return;
+  double rows = totals.rows;
+  fprintf(out, "  %-9s %-7s %10.1f %10.1f %6.2f %10.3f %10.3f %10.2f\n", stage,
+          thread, totals.counters[0] / rows, totals.counters[1] / rows,
+          totals.counters[0] > 0
+              ? double(totals.counters[1]) / totals.counters[0]
+              : 0.0,
+          totals.counters[2] / rows, totals.counters[3] / rows,
+          totals.bytes > 0 ? double(totals.counters[0]) / totals.bytes : 0.0);
+}
+
+void nyse::PerfCounters::report(FILE *out) {
+  if (!enabled())
+    return;
+  std::lock_guard<std::mutex> lock(threadsMutex);
+  fprintf(out, "hardware counters (tokenize, convert and coords sampled every "
+               "%u rows, submit excludes TileDB's internal threads):\n",
+          sampleEvery);
+  fprintf(out, "  %-9s %-7s %10s %10s %6s %10s %10s %10s\n", "stage", "thread",
+          "cycles/row", "instr/row", "IPC", "cmiss/row", "bmiss/row",
+          "cycles/B");
+  for (int stage = 0; stage < static_cast<int>(PerfStage::Count); stage++) {
+    PerfStageTotals all;
+    for (const auto &thread : threads) {
+      const PerfStageTotals &totals = thread->stages[stage];
+      for (int i = 0; i < 4; i++)
+        all.counters[i] += totals.counters[i];
+      all.rows += totals.rows;
+      all.bytes += totals.bytes;
+    }
+    printTotals(out, stageNames[stage], "all", all);
+    for (const auto &thread : threads) {
+      std::string tid = std::to_string(thread->tid);
+      printTotals(out, stageNames[stage], tid.c_str(), thread->stages[stage]);
+    }
+  }
+}
+
+nyse::PerfStageScope::PerfStageScope(PerfStage stage, bool active,
+                                     uint64_t rows, uint64_t bytes)
+    : stage(stage), active(active), rows(rows), bytes(bytes) {
+  if (this->active)
+    this->active = PerfCounters::instance().read(begin);
+}
+
+nyse::PerfStageScope::~PerfStageScope() {
+  if (!active)
+    return;
+  PerfSample end;
+  if (PerfCounters::instance().read(end))
+    PerfCounters::instance().add(stage, begin, end, rows, bytes);
+}
@@ -0,0 +1,168 @@
+/**
+ * @file  PerfCounters.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Hardware performance counters (cycles, instructions, cache misses and branch
+ * mispredicts) grouped per ingest stage and per thread using Linux
+ * perf_event_open
+ *
+ */
+
+#ifndef NYSE_INGESTOR_PERFCOUNTERS_H
+#define NYSE_INGESTOR_PERFCOUNTERS_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * Ingest stages counters are attributed to
+ */
+enum class PerfStage : int {
+  Tokenize, // splitting a line into fields
+  Convert,  // parsing attribute values and appending to column buffers
+  Coords,   // resolving and appending dimension values
+  Merge,    // concatenating worker buffers into global buffers
+  Submit,   // TileDB write on the calling thread only, compression and IO on
+            // TileDB's own threads are not counted
+  Count
+};
+
+/**
+ * Raw counter values, in the order cycles, instructions, cache misses, branch
+ * misses
+ */
+struct PerfSample {
+  uint64_t values[4] = {0, 0, 0, 0};
+};
+
+/**
+ * Accumulated counters and work done for a stage
+ */
+struct PerfStageTotals {
+  uint64_t counters[4] = {0, 0, 0, 0};
+  uint64_t rows = 0;
+  uint64_t bytes = 0;
+};
+
+/**
+ * Per thread counter group and its totals. Counters are opened for the owning
+ * thread only and do not follow threads it hands work to.
+ */
+struct PerfThreadState {
+  PerfThreadState() = default;
+  ~PerfThreadState();
+
+  PerfThreadState(const PerfThreadState &) = delete;
+  PerfThreadState &operator=(const PerfThreadState &) = delete;
+
+  uint32_t tid = 0;
+  int fds[4] = {-1, -1, -1, -1};
+  bool failed = false;
+  PerfStageTotals stages[static_cast<int>(PerfStage::Count)];
+};
+
+class PerfCounters {
+public:
+  static PerfCounters &instance();
+
+  /**
+   * Enable counters, checking that perf events may be opened
+   * @return false if perf events are not supported or not permitted
+   */
+  bool enable();
+
+  bool enabled() const { return isEnabled.load(std::memory_order_relaxed); }
+
+  /**
+   * Read the calling thread's counters, opening them on first use
+   * @param sample
+   * @return false if counters are unavailable on this thread
+   */
+  bool read(PerfSample &sample);
+
+  /**
+   * Attribute the counter delta between two samples and the work it
+   * represents to a stage on the calling thread
+   */
+  void add(PerfStage stage, const PerfSample &begin, const PerfSample &end,
+           uint64_t rows, uint64_t bytes);
+
+  /**
+   * Print per row and per byte figures for each stage, in total and per
+   * thread
+   * @param out
+   */
+  void report(FILE *out = stdout);
+
+  /**
+   * Per row stages are only measured on one of every sampleEvery rows to keep
+   * the read overhead low, figures are normalized by the sampled rows
+   */
+  uint32_t sampleEvery = 64;
+
+private:
+  PerfCounters() = default;
+
+  PerfThreadState *threadState();
+
+  std::atomic<bool> isEnabled{false};
+  std::mutex threadsMutex;
+  std::vector<std::unique_ptr<PerfThreadState>> threads;
+};
+
+/**
+ * Measures the enclosed block for a stage when active
+ */
+class PerfStageScope {
+public:
+  PerfStageScope(PerfStage stage, bool active, uint64_t rows = 1,
+                 uint64_t bytes = 0);
+  ~PerfStageScope();
+
+  PerfStageScope(const PerfStageScope &) = delete;
+  PerfStageScope &operator=(const PerfStageScope &) = delete;
+
+  void setRows(uint64_t rows) { this->rows = rows; }
+  void setBytes(uint64_t bytes) { this->bytes = bytes; }
+
+private:
+  PerfStage stage;
+  bool active;
+  uint64_t rows;
+  uint64_t bytes;
+  PerfSample begin;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_PERFCOUNTERS_H
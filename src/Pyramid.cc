@@ -0,0 +1,408 @@
+/**
+ * @file  Pyramid.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Multi resolution pyramid of downsampled quote arrays for charting, each level
+ * holding the range of the mid, bid and ask prices per bucket
+ *
+ */
+
+#include "Pyramid.h"
+#include "Nbbo.h"
+#include "Quote.h"
+#include "ResultStream.h"
+#include "Trace.h"
+#include <ThreadPool.h>
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+static const uint64_t nanosecondsPerMillisecond = 1000000;
+
+static const std::vector<std::string> sourceColumns = {
+    "datetime", "Bid_Price", "Offer_Price"};
+
+static const char *priceNames[] = {"mid", "bid", "ask"};
+static const char *rangeNames[] = {"min", "max", "first", "last"};
+
+/**
+ * Empty buffers for level cells
+ */
+static std::unordered_map<std::string, std::shared_ptr<nyse::buffer>>
+cellBuffers() {
+  std::unordered_map<std::string, std::shared_ptr<nyse::buffer>> buffers;
+  auto add = [&](const std::string &name, tiledb_datatype_t datatype) {
+    buffers.emplace(name, std::make_shared<nyse::buffer>(nyse::buffer{
+                              nullptr, nyse::createBuffer(datatype), datatype}));
+  };
+  add(TILEDB_COORDS, TILEDB_UINT64);
+  add("count", TILEDB_UINT64);
+  for (const char *price : priceNames) {
+    for (const char *range : rangeNames)
+      add(std::string(price) + "_" + range, TILEDB_FLOAT32);
+  }
+  return buffers;
+}
+
+/**
+ * Typed values of a cell buffer
+ */
+template <typename T>
+static std::vector<T> &
+values(std::unordered_map<std::string, std::shared_ptr<nyse::buffer>> &buffers,
+       const std::string &name) {
+  return *std::static_pointer_cast<std::vector<T>>(buffers.at(name)->values);
+}
+
+/**
+ * Merge cells into buckets of a coarser width
+ * @param cells in time order
+ * @param width multiple of the width of cells
+ * @param coarse replaced by the merged cells
+ */
+static void coarsen(const std::vector<nyse::PyramidCell> &cells,
+                    uint64_t width, std::vector<nyse::PyramidCell> &coarse) {
+  coarse.clear();
+  for (const nyse::PyramidCell &cell : cells) {
+    uint64_t start = cell.start / width * width;
+    if (coarse.empty() || coarse.back().start != start) {
+      coarse.push_back(cell);
+      coarse.back().start = start;
+      continue;
+    }
+    nyse::PyramidCell &into = coarse.back();
+    into.count += cell.count;
+    into.mid.merge(cell.mid);
+    into.bid.merge(cell.bid);
+    into.ask.merge(cell.ask);
+  }
+}
+
+nyse::PyramidLevel::PyramidLevel(std::string array_name) {
+  this->array_uri = std::move(array_name);
+  this->ctx = std::make_shared<tiledb::Context>();
+  this->type = FileType::Pyramid;
+  this->origin = "Pyramid levels are built from a Quote or NBBO array with "
+                 "--pyramid";
+}
+
+void nyse::PyramidLevel::createArray(
+    tiledb::FilterList coordinate_filter_list,
+    tiledb::FilterList offset_filter_list,
+    tiledb::FilterList attribute_filter_list) {
+  // If the array already exists on disk, return immediately.
+  if (tiledb::Object::object(*ctx, array_uri).type() ==
+      tiledb::Object::Type::Array)
+    return;
+
+  tiledb::Domain domain(*ctx);
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(*ctx, "symbol_id",
+                                                           {{0, 10000}}, 100));
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(
+      *ctx, "datetime", {{0, UINT64_MAX - 60UL * 60 * 1000000000}},
+      60UL * 60 * 1000000000));
+
+  tiledb::ArraySchema schema(*ctx, TILEDB_SPARSE);
+  schema.set_domain(domain).set_order({{TILEDB_ROW_MAJOR, TILEDB_ROW_MAJOR}});
+
+  if (coordinate_filter_list.nfilters() > 0) {
+    schema.set_coords_filter_list(coordinate_filter_list);
+  }
+
+  if (offset_filter_list.nfilters() > 0) {
+    schema.set_offsets_filter_list(offset_filter_list);
+  }
+
+  schema.set_capacity(1000000);
+
+  // Set compression filter to ZSTD if not already set
+  if (attribute_filter_list.nfilters() == 0) {
+    tiledb::Filter compressor(*ctx, TILEDB_FILTER_ZSTD);
+    attribute_filter_list.add_filter(compressor);
+  }
+
+  schema.add_attribute(tiledb::Attribute::create<uint64_t>(*ctx, "count")
+                           .set_filter_list(attribute_filter_list));
+  for (const char *price : priceNames) {
+    for (const char *range : rangeNames)
+      schema.add_attribute(tiledb::Attribute::create<float>(
+                               *ctx, std::string(price) + "_" + range)
+                               .set_filter_list(attribute_filter_list));
+  }
+
+  // Create the (empty) array on disk.
+  tiledb::Array::create(array_uri, schema);
+}
+
+void nyse::PyramidLevel::openWrite() {
+  query.reset(nullptr);
+  array = std::make_unique<tiledb::Array>(*ctx, array_uri,
+                                          tiledb_query_type_t::TILEDB_WRITE);
+  openedForRead = false;
+  pending = cellBuffers();
+  pendingRows = 0;
+  cellsWritten = 0;
+}
+
+void nyse::PyramidLevel::append(uint64_t symbolId,
+                                const std::vector<PyramidCell> &cells) {
+  const float missing = std::numeric_limits<float>::quiet_NaN();
+  std::lock_guard<std::mutex> lock(pendingMutex);
+  std::vector<uint64_t> &coords = values<uint64_t>(pending, TILEDB_COORDS);
+  std::vector<uint64_t> &count = values<uint64_t>(pending, "count");
+  for (const PyramidCell &cell : cells) {
+    coords.push_back(symbolId);
+    coords.push_back(cell.start);
+    count.push_back(cell.count);
+  }
+  const PriceRange PyramidCell::*prices[] = {&PyramidCell::mid,
+                                             &PyramidCell::bid,
+                                             &PyramidCell::ask};
+  for (int p = 0; p < 3; p++) {
+    std::string prefix = std::string(priceNames[p]) + "_";
+    std::vector<float> &min = values<float>(pending, prefix + "min");
+    std::vector<float> &max = values<float>(pending, prefix + "max");
+    std::vector<float> &first = values<float>(pending, prefix + "first");
+    std::vector<float> &last = values<float>(pending, prefix + "last");
+    for (const PyramidCell &cell : cells) {
+      const PriceRange &range = cell.*prices[p];
+      min.push_back(range.set ? range.min : missing);
+      max.push_back(range.set ? range.max : missing);
+      first.push_back(range.set ? range.first : missing);
+      last.push_back(range.set ? range.last : missing);
+    }
+  }
+  pendingRows += cells.size();
+  if (pendingRows >= flushRows)
+    flush();
+}
+
+void nyse::PyramidLevel::flush() {
+  if (pendingRows == 0)
+    return;
+  writeFragment(pending);
+  cellsWritten += pendingRows;
+  pending = cellBuffers();
+  pendingRows = 0;
+}
+
+uint64_t nyse::PyramidLevel::closeWrite() {
+  std::lock_guard<std::mutex> lock(pendingMutex);
+  flush();
+  array->close();
+  array.reset(nullptr);
+  return cellsWritten;
+}
+
+nyse::Pyramid::Pyramid(std::string uri)
+    : ctx(std::make_shared<tiledb::Context>()), uri(std::move(uri)) {}
+
+std::string nyse::Pyramid::levelUri(uint64_t width) const {
+  return uri + "/" + std::to_string(width / nanosecondsPerMillisecond) + "ms";
+}
+
+std::vector<uint64_t> nyse::Pyramid::levels() const {
+  std::vector<uint64_t> widths;
+  if (tiledb::Object::object(*ctx, uri).type() != tiledb::Object::Type::Group)
+    return widths;
+  tiledb::ObjectIter objects(*ctx, uri);
+  objects.set_non_recursive();
+  for (const tiledb::Object &object : objects) {
+    if (object.type() != tiledb::Object::Type::Array)
+      continue;
+    std::string name = object.uri();
+    while (!name.empty() && name.back() == '/')
+      name.pop_back();
+    name = name.substr(name.find_last_of('/') + 1);
+    // Level arrays are named <milliseconds>ms
+    if (name.size() < 3 || name.compare(name.size() - 2, 2, "ms") != 0 ||
+        name.find_first_not_of("0123456789") != name.size() - 2)
+      continue;
+    widths.push_back(std::stoull(name) * nanosecondsPerMillisecond);
+  }
+  std::sort(widths.begin(), widths.end());
+  return widths;
+}
+
+std::string nyse::Pyramid::levelFor(uint64_t resolution) const {
+  std::vector<uint64_t> widths = levels();
+  if (widths.empty())
+    return "";
+  if (resolution == 0)
+    return levelUri(widths.front());
+  auto coarsest = std::upper_bound(widths.begin(), widths.end(), resolution);
+  if (coarsest == widths.begin())
+    return "";
+  return levelUri(*(coarsest - 1));
+}
+
+void nyse::Pyramid::bucketSymbol(Array &source, uint64_t symbolId,
+                                 uint64_t start, uint64_t end, uint64_t width,
+                                 std::vector<PyramidCell> &cells) {
+  cells.clear();
+  std::vector<uint64_t> subarray =
+      source.symbolSubarray(symbolId, start, end, source.nonEmptyDomain());
+  if (subarray.empty())
+    return;
+  uint64_t datetimeIndex =
+      dimensionIndex(source.array->schema().domain().dimensions(), "datetime");
+
+  ResultStream stream(source, subarray);
+  for (const ResultBatch &batch : stream) {
+    uint64_t ndim = batch.dimensions();
+    ColumnSpan<uint64_t> coordinates = batch.coordinates<uint64_t>();
+    ColumnSpan<float> bidPrice = batch.values<float>("Bid_Price");
+    ColumnSpan<float> offerPrice = batch.values<float>("Offer_Price");
+
+    for (uint64_t i = 0; i < batch.rows(); i++) {
+      uint64_t bucket = coordinates[i * ndim + datetimeIndex] / width * width;
+      if (cells.empty() || cells.back().start != bucket) {
+        cells.emplace_back();
+        cells.back().start = bucket;
+      }
+      PyramidCell &cell = cells.back();
+      float bid = bidPrice[i];
+      float ask = offerPrice[i];
+      cell.count++;
+      cell.bid.add(bid);
+      cell.ask.add(ask);
+      if (bid > 0 && ask > 0)
+        cell.mid.add(0.5f * (bid + ask));
+    }
+  }
+}
+
+uint64_t nyse::Pyramid::build(const std::string &sourceUri,
+                              FileType sourceType,
+                              std::vector<uint64_t> widths,
+                              std::vector<uint64_t> symbolIds, uint64_t start,
+                              uint64_t end, uint32_t threads) {
+  if (sourceType != FileType::Quote && sourceType != FileType::Nbbo)
+    throw std::invalid_argument(
+        "A pyramid can only be built from a Quote or NBBO array");
+  widths.erase(std::remove_if(widths.begin(), widths.end(),
+                              [](uint64_t width) {
+                                return width == 0 ||
+                                       width % nanosecondsPerMillisecond != 0;
+                              }),
+               widths.end());
+  std::sort(widths.begin(), widths.end());
+  widths.erase(std::unique(widths.begin(), widths.end()), widths.end());
+  if (widths.empty())
+    throw std::invalid_argument(
+        "Pyramid level widths must be whole milliseconds");
+  // Each level is merged from the coarsest finer level it is a multiple of
+  std::vector<size_t> parents(widths.size(), 0);
+  for (size_t l = 1; l < widths.size(); l++) {
+    if (widths[l] % widths[0] != 0)
+      throw std::invalid_argument(
+          "Pyramid level widths must be multiples of the finest level");
+    for (size_t p = 0; p < l; p++) {
+      if (widths[l] % widths[p] == 0)
+        parents[l] = p;
+    }
+  }
+  threads = std::max(threads, 1u);
+
+  auto makeSource = [&]() -> std::unique_ptr<Array> {
+    std::unique_ptr<Array> source;
+    if (sourceType == FileType::Quote)
+      source = std::make_unique<Quote>(sourceUri, "", '|');
+    else
+      source = std::make_unique<Nbbo>(sourceUri);
+    source->setCtx(ctx);
+    return source;
+  };
+
+  if (symbolIds.empty()) {
+    std::unique_ptr<Array> source = makeSource();
+    std::vector<std::pair<uint64_t, uint64_t>> domain =
+        source->nonEmptyDomain();
+    uint64_t symbolIndex = dimensionIndex(
+        source->array->schema().domain().dimensions(), "symbol_id");
+    if (domain.empty())
+      return 0;
+    for (uint64_t s = domain[symbolIndex].first;
+         s <= domain[symbolIndex].second; s++)
+      symbolIds.push_back(s);
+  }
+
+  if (tiledb::Object::object(*ctx, uri).type() != tiledb::Object::Type::Group)
+    tiledb::create_group(*ctx, uri);
+  std::vector<std::unique_ptr<PyramidLevel>> levels;
+  for (uint64_t width : widths) {
+    levels.push_back(std::make_unique<PyramidLevel>(levelUri(width)));
+    levels.back()->setCtx(ctx);
+    levels.back()->createArray(tiledb::FilterList(*ctx),
+                               tiledb::FilterList(*ctx),
+                               tiledb::FilterList(*ctx));
+    levels.back()->openWrite();
+  }
+
+  std::atomic<uint64_t> nextSymbol{0};
+  auto worker = [&]() {
+    std::unique_ptr<Array> source;
+    std::vector<std::vector<PyramidCell>> cells(widths.size());
+    for (uint64_t s = nextSymbol++; s < symbolIds.size(); s = nextSymbol++) {
+      try {
+        if (source == nullptr) {
+          source = makeSource();
+          if (!source->setColumns(sourceColumns))
+            throw std::runtime_error("Invalid pyramid columns");
+        }
+        TraceSpan span("pyramid", sourceUri);
+        bucketSymbol(*source, symbolIds[s], start, end, widths[0], cells[0]);
+        span.setRows(cells[0].size());
+        levels[0]->append(symbolIds[s], cells[0]);
+        for (size_t l = 1; l < widths.size(); l++) {
+          coarsen(cells[parents[l]], widths[l], cells[l]);
+          levels[l]->append(symbolIds[s], cells[l]);
+        }
+      } catch (const std::exception &e) {
+        std::cerr << "Pyramid of symbol_id " << symbolIds[s]
+                  << " failed: " << e.what() << std::endl;
+      }
+    }
+  };
+
+  {
+    ThreadPool pool(std::min<uint64_t>(threads, symbolIds.size() + 1));
+    std::vector<std::future<void>> workers;
+    for (uint32_t t = 0; t < threads && t < symbolIds.size(); t++)
+      workers.emplace_back(pool.enqueue(worker));
+    for (auto &future : workers)
+      future.get();
+  }
+
+  uint64_t written = 0;
+  for (auto &level : levels)
+    written += level->closeWrite();
+  return written;
+}
@@ -0,0 +1,225 @@
+/**
+ * @file  Pyramid.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Multi resolution pyramid of downsampled quote arrays for charting, each level
+ * holding the range of the mid, bid and ask prices per bucket
+ *
+ */
+
+#ifndef NYSE_INGESTOR_PYRAMID_H
+#define NYSE_INGESTOR_PYRAMID_H
+
+#include "Array.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * First, last, minimum and maximum of a price within a bucket. Only set
+ * once a positive price has been added.
+ */
+struct PriceRange {
+  float min = 0;
+  float max = 0;
+  float first = 0;
+  float last = 0;
+  bool set = false;
+
+  void add(float price) {
+    if (price <= 0)
+      return;
+    if (!set) {
+      min = max = first = price;
+      set = true;
+    }
+    min = std::min(min, price);
+    max = std::max(max, price);
+    last = price;
+  }
+
+  /**
+   * Combine with the range of the following bucket
+   * @param next
+   */
+  void merge(const PriceRange &next) {
+    if (!next.set)
+      return;
+    if (!set) {
+      *this = next;
+      return;
+    }
+    min = std::min(min, next.min);
+    max = std::max(max, next.max);
+    last = next.last;
+  }
+};
+
+/**
+ * Quotes of one symbol within one bucket
+ */
+struct PyramidCell {
+  // Bucket start in nanoseconds since epoch
+  uint64_t start = 0;
+  uint64_t count = 0;
+  PriceRange mid;
+  PriceRange bid;
+  PriceRange ask;
+};
+
+/**
+ * One level of a pyramid, a sparse array with the dimensions symbol_id and
+ * datetime, the bucket start. It is read like any other array with
+ * --type Pyramid, prices of a side which was never quoted in a bucket are
+ * NaN.
+ */
+class PyramidLevel : public DerivedArray {
+public:
+  explicit PyramidLevel(std::string array_name);
+
+  /**
+   * Create level array
+   */
+  void createArray(tiledb::FilterList coordinate_filter_list,
+                   tiledb::FilterList offset_filter_list,
+                   tiledb::FilterList attribute_filter_list) override;
+
+  /**
+   * Open the level for writing
+   */
+  void openWrite();
+
+  /**
+   * Append the cells of a symbol, writing a fragment once flushRows are
+   * pending. Safe to call concurrently.
+   * @param symbolId
+   * @param cells in time order
+   */
+  void append(uint64_t symbolId, const std::vector<PyramidCell> &cells);
+
+  /**
+   * Write whatever is pending and close the level
+   * @return cells written since openWrite
+   */
+  uint64_t closeWrite();
+
+  /**
+   * Buffered cells are written as a fragment once this many are pending
+   */
+  uint64_t flushRows = 1 << 22;
+
+private:
+  void flush();
+
+  std::mutex pendingMutex;
+  std::unordered_map<std::string, std::shared_ptr<buffer>> pending;
+  uint64_t pendingRows = 0;
+  uint64_t cellsWritten = 0;
+};
+
+/**
+ * Pyramid of levels of increasing bucket width stored as a TileDB group, one
+ * level array per width named by the width in milliseconds. All levels are
+ * built in one pass over the quotes, the finest level from the quotes and
+ * each coarser level from the finest level it is a multiple of.
+ */
+class Pyramid {
+public:
+  /**
+   * @param uri group of the pyramid
+   */
+  explicit Pyramid(std::string uri);
+
+  std::shared_ptr<tiledb::Context> getCtx() const { return ctx; }
+
+  /**
+   * Level array of a width
+   * @param width bucket width in nanoseconds, a whole number of milliseconds
+   * @return level uri
+   */
+  std::string levelUri(uint64_t width) const;
+
+  /**
+   * Widths of the levels present on disk
+   * @return bucket widths in nanoseconds, finest first
+   */
+  std::vector<uint64_t> levels() const;
+
+  /**
+   * Pick the coarsest level whose buckets are no wider than a resolution, so
+   * a chart gets at least one bucket per point with the fewest cells read
+   * @param resolution time covered by one point in nanoseconds, 0 for the
+   * finest level
+   * @return level uri, empty if no level is fine enough
+   */
+  std::string levelFor(uint64_t resolution) const;
+
+  /**
+   * Build the levels from a Quote or NBBO array, creating the group and
+   * level arrays as needed. Symbols are processed concurrently, each worker
+   * with its own reader sharing this pyramid's context.
+   * @param sourceUri Quote or NBBO array
+   * @param sourceType FileType::Quote or FileType::Nbbo
+   * @param widths bucket widths in nanoseconds, each a whole number of
+   * milliseconds and a multiple of the finest
+   * @param symbolIds symbol_ids to build, empty for all symbols of the source
+   * @param start first quote datetime in nanoseconds since epoch (inclusive)
+   * @param end last quote datetime in nanoseconds since epoch (inclusive)
+   * @param threads
+   * @return cells written over all levels
+   */
+  uint64_t build(const std::string &sourceUri, FileType sourceType,
+                 std::vector<uint64_t> widths, std::vector<uint64_t> symbolIds,
+                 uint64_t start, uint64_t end, uint32_t threads);
+
+private:
+  /**
+   * Bucket the quotes of one symbol into the finest level
+   * @param source reader with the price columns projected
+   * @param symbolId
+   * @param start
+   * @param end
+   * @param width finest bucket width
+   * @param cells replaced by the symbol's cells in time order
+   */
+  void bucketSymbol(Array &source, uint64_t symbolId, uint64_t start,
+                    uint64_t end, uint64_t width,
+                    std::vector<PyramidCell> &cells);
+
+  std::shared_ptr<tiledb::Context> ctx;
+  std::string uri;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_PYRAMID_H
@@ -0,0 +1,439 @@
+/**
+ * @file  QueryServer.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Long lived query server answering symbol and time range queries over a Unix
+ * domain socket from arrays kept open between requests
+ *
+ */
+
+#include "QueryServer.h"
+#include "Master.h"
+#include "Quote.h"
+#include "ResultCache.h"
+#include "Trade.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static volatile std::sig_atomic_t stopRequested = 0;
+
+// Longest symbol and column list accepted, the lengths are sent by clients
+static const uint16_t maxSymbolLength = 256;
+static const uint32_t maxColumnsLength = 64 * 1024;
+
+// Seconds a worker waits for the rest of a request before dropping the client
+static const int receiveTimeout = 30;
+
+// Write end of the running server's wake pipe
+static int stopFd = -1;
+
+/**
+ * Signals may be delivered to any thread, writing to the pipe wakes up the
+ * poll loop wherever the handler runs
+ */
+static void requestStop(int) {
+  int savedErrno = errno;
+  stopRequested = 1;
+  char byte = 0;
+  if (write(stopFd, &byte, 1) < 0) {
+    // The pipe is full, so the loop is woken up already
+  }
+  errno = savedErrno;
+}
+
+/**
+ * Wake up the poll loop
+ * @param fd write end of the wake pipe
+ */
+static void wake(int fd) {
+  char byte = 0;
+  if (write(fd, &byte, 1) < 0) {
+    // The pipe is full, so the loop is woken up already
+  }
+}
+
+/**
+ * Read exactly size bytes
+ * @return false on error or if the peer closed the connection
+ */
+static bool readFully(int fd, void *data, size_t size) {
+  char *position = static_cast<char *>(data);
+  while (size > 0) {
+    ssize_t received = ::recv(fd, position, size, 0);
+    if (received < 0 && errno == EINTR)
+      continue;
+    if (received <= 0)
+      return false;
+    position += received;
+    size -= received;
+  }
+  return true;
+}
+
+/**
+ * Write exactly size bytes
+ * @return false on error
+ */
+static bool writeFully(int fd, const void *data, size_t size) {
+  const char *position = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t sent = ::send(fd, position, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR)
+      continue;
+    if (sent <= 0)
+      return false;
+    position += sent;
+    size -= sent;
+  }
+  return true;
+}
+
+nyse::QueryServer::QueryServer(std::string socketPath, std::string masterFile,
+                               std::string delimiter, uint32_t threads,
+                               uint64_t tileCacheSize)
+    : socketPath(std::move(socketPath)), masterFile(std::move(masterFile)),
+      delimiter(std::move(delimiter)), threads(std::max(threads, 1u)) {
+  tiledb::Config config;
+  config.set("sm.dedup_coords", "true");
+  if (tileCacheSize > 0)
+    config.set("sm.tile_cache_size", std::to_string(tileCacheSize));
+  ctx = std::make_shared<tiledb::Context>(config);
+
+  for (const auto &symbol : Master::buildSymbolIds(
+           *ctx, this->masterFile, this->delimiter.c_str()[0]))
+    symbolIds.emplace(symbol.first, std::stoull(symbol.second));
+}
+
+std::unique_ptr<nyse::Array>
+nyse::QueryServer::createArray(FileType type, const std::string &uri) {
+  std::unique_ptr<Array> array;
+  if (type == FileType::Quote)
+    array = std::make_unique<Quote>(uri, masterFile, delimiter.c_str()[0]);
+  else
+    array = std::make_unique<Trade>(uri, masterFile, delimiter.c_str()[0]);
+  array->setCtx(ctx);
+  return array;
+}
+
+bool nyse::QueryServer::addArray(FileType type, const std::string &uri) {
+  if (type != FileType::Quote && type != FileType::Trade) {
+    std::cerr << "Only Quote and Trade arrays can be served" << std::endl;
+    return false;
+  }
+  std::unique_ptr<Array> array = createArray(type, uri);
+  try {
+    array->openForRead();
+  } catch (const std::exception &e) {
+    std::cerr << "Could not open array " << uri << ": " << e.what()
+              << std::endl;
+    return false;
+  }
+  arrayUris[type] = uri;
+  idle[type].push_back(std::move(array));
+  return true;
+}
+
+std::unique_ptr<nyse::Array> nyse::QueryServer::acquire(FileType type) {
+  auto uri = arrayUris.find(type);
+  if (uri == arrayUris.end())
+    return nullptr;
+  {
+    std::lock_guard<std::mutex> lock(idleMutex);
+    std::vector<std::unique_ptr<Array>> &instances = idle[type];
+    if (!instances.empty()) {
+      std::unique_ptr<Array> array = std::move(instances.back());
+      instances.pop_back();
+      return array;
+    }
+  }
+  std::unique_ptr<Array> array = createArray(type, uri->second);
+  array->openForRead();
+  return array;
+}
+
+void nyse::QueryServer::release(FileType type, std::unique_ptr<Array> array) {
+  std::lock_guard<std::mutex> lock(idleMutex);
+  idle[type].push_back(std::move(array));
+}
+
+nyse::ServerResponse nyse::QueryServer::handleRequest(
+    const ServerRequest &request, const std::string &symbol,
+    const std::string &columns, std::string &payload) {
+  ServerResponse response = {};
+  response.status = static_cast<uint8_t>(ServerStatus::Error);
+
+  FileType type = static_cast<FileType>(request.type);
+  auto symbolId = symbolIds.find(symbol);
+  if (symbolId == symbolIds.end()) {
+    payload = "Symbol " + symbol + " not found in master file";
+    return response;
+  }
+  if (request.format > static_cast<uint8_t>(ServerFormat::ArrowFile)) {
+    payload = "Unknown format " + std::to_string(request.format);
+    return response;
+  }
+
+  std::unique_ptr<Array> array;
+  try {
+    array = acquire(type);
+  } catch (const std::exception &e) {
+    payload = e.what();
+    return response;
+  }
+  if (array == nullptr) {
+    payload = "Array type " + std::to_string(request.type) + " is not served";
+    return response;
+  }
+
+  std::vector<std::string> columnList;
+  if (!columns.empty())
+    columnList = split(columns, ',');
+  if (!array->setColumns(columnList)) {
+    payload = "Unknown column in " + columns;
+    release(type, std::move(array));
+    return response;
+  }
+
+  ServerFormat format = static_cast<ServerFormat>(request.format);
+  if (format == ServerFormat::ArrowStream)
+    array->setExportFormat(ExportFormat::ArrowStream);
+  else if (format == ServerFormat::ArrowFile)
+    array->setExportFormat(ExportFormat::ArrowFile);
+  else
+    array->setExportFormat(ExportFormat::Csv);
+
+  std::ostringstream output;
+  try {
+    response.rows = array->querySymbol(symbolId->second, request.start,
+                                       request.end, &output, delimiter);
+  } catch (const std::exception &e) {
+    // The instance may be left mid query, so it is dropped
+    payload = e.what();
+    return response;
+  }
+  release(type, std::move(array));
+
+  payload = output.str();
+  response.status = static_cast<uint8_t>(ServerStatus::Ok);
+  return response;
+}
+
+void nyse::QueryServer::serveRequest(int fd) {
+  ServerRequest request;
+  std::string symbol;
+  std::string columns;
+  std::string payload;
+  bool open = readFully(fd, &request, sizeof(request));
+  if (open && (request.symbolLength > maxSymbolLength ||
+               request.columnsLength > maxColumnsLength)) {
+    // The rest of the request is not read, so the connection is closed
+    ServerResponse response = {};
+    response.status = static_cast<uint8_t>(ServerStatus::Error);
+    payload = "Request too long, symbols are limited to " +
+              std::to_string(maxSymbolLength) + " bytes and columns to " +
+              std::to_string(maxColumnsLength) + " bytes";
+    response.length = payload.size();
+    if (writeFully(fd, &response, sizeof(response)))
+      writeFully(fd, payload.data(), payload.size());
+    open = false;
+  }
+  if (open) {
+    symbol.resize(request.symbolLength);
+    columns.resize(request.columnsLength);
+    open = readFully(fd, &symbol[0], symbol.size()) &&
+           readFully(fd, &columns[0], columns.size());
+  }
+  if (open) {
+    ServerResponse response = handleRequest(request, symbol, columns, payload);
+    response.length = payload.size();
+    open = writeFully(fd, &response, sizeof(response)) &&
+           writeFully(fd, payload.data(), payload.size());
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    if (open) {
+      answered.push_back(fd);
+    } else {
+      connections.erase(fd);
+      close(fd);
+    }
+  }
+  if (open)
+    wake(wakePipe[1]);
+}
+
+int nyse::QueryServer::run() {
+  if (arrayUris.empty()) {
+    std::cerr << "No arrays to serve" << std::endl;
+    return 1;
+  }
+
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path " << socketPath << " is too long" << std::endl;
+    return 1;
+  }
+  strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+  if (pipe(wakePipe) != 0) {
+    std::cerr << "Could not create pipe: " << strerror(errno) << std::endl;
+    return 1;
+  }
+  for (int fd : wakePipe)
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    std::cerr << "Could not create socket: " << strerror(errno) << std::endl;
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+    return 1;
+  }
+  // Remove a socket left behind by a previous server
+  unlink(socketPath.c_str());
+  if (bind(listenFd, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) != 0 ||
+      listen(listenFd, SOMAXCONN) != 0) {
+    std::cerr << "Could not listen on " << socketPath << ": "
+              << strerror(errno) << std::endl;
+    close(listenFd);
+    close(wakePipe[0]);
+    close(wakePipe[1]);
+    return 1;
+  }
+  // A client may disconnect between poll and accept
+  fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+
+  stopFd = wakePipe[1];
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = requestStop;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  printf("serving %lu arrays on %s with %u threads\n", arrayUris.size(),
+         socketPath.c_str(), threads);
+  {
+    ThreadPool pool(threads);
+    // Connections waiting for their next request
+    std::vector<int> waiting;
+    std::vector<pollfd> polled;
+    while (!stopRequested) {
+      polled.clear();
+      polled.push_back({wakePipe[0], POLLIN, 0});
+      polled.push_back({listenFd, POLLIN, 0});
+      for (int fd : waiting)
+        polled.push_back({fd, POLLIN, 0});
+      if (poll(polled.data(), polled.size(), -1) < 0) {
+        if (errno != EINTR) {
+          std::cerr << "poll failed: " << strerror(errno) << std::endl;
+          break;
+        }
+        continue;
+      }
+
+      // A connection with a pending request, or closed by the client, is
+      // handed to a worker and not polled until it is answered
+      std::vector<int> next;
+      for (size_t i = 2; i < polled.size(); i++) {
+        int fd = polled[i].fd;
+        if (polled[i].revents != 0)
+          pool.enqueue([this, fd]() { serveRequest(fd); });
+        else
+          next.push_back(fd);
+      }
+
+      if (polled[0].revents != 0) {
+        char bytes[64];
+        while (read(wakePipe[0], bytes, sizeof(bytes)) > 0) {
+        }
+        std::lock_guard<std::mutex> lock(connectionsMutex);
+        next.insert(next.end(), answered.begin(), answered.end());
+        answered.clear();
+      }
+
+      if (polled[1].revents != 0) {
+        int fd;
+        while ((fd = accept(listenFd, nullptr, nullptr)) >= 0) {
+          // Requests are read once the connection is readable, a client
+          // sending only part of one must not hold a worker forever
+          timeval timeout = {receiveTimeout, 0};
+          setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+          std::lock_guard<std::mutex> lock(connectionsMutex);
+          connections.insert(fd);
+          next.push_back(fd);
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+            errno != ECONNABORTED)
+          std::cerr << "accept failed: " << strerror(errno) << std::endl;
+      }
+      waiting.swap(next);
+    }
+
+    // Close idle connections and wake up requests still being read, the
+    // pool then finishes any request in progress
+    std::lock_guard<std::mutex> lock(connectionsMutex);
+    for (int fd : waiting) {
+      connections.erase(fd);
+      close(fd);
+    }
+    for (int fd : connections)
+      shutdown(fd, SHUT_RD);
+  }
+  for (int fd : connections)
+    close(fd);
+  connections.clear();
+  answered.clear();
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  stopFd = -1;
+  close(wakePipe[0]);
+  close(wakePipe[1]);
+  close(listenFd);
+  unlink(socketPath.c_str());
+  printf("server stopped\n");
+  ResultCache::instance().report();
+  return 0;
+}
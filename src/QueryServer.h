@@ -0,0 +1,187 @@
+/**
+ * @file  QueryServer.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Long lived query server answering symbol and time range queries over a Unix
+ * domain socket from arrays kept open between requests
+ *
+ */
+
+#ifndef NYSE_INGESTOR_QUERYSERVER_H
+#define NYSE_INGESTOR_QUERYSERVER_H
+
+#include "Array.h"
+#include <ThreadPool.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * Fixed size request header, followed by symbolLength bytes of symbol and
+ * columnsLength bytes of comma separated column names (empty for all).
+ * Integers are little endian. Symbols longer than 256 bytes or columns longer
+ * than 64 KiB are answered with an error and the connection is closed.
+ */
+struct ServerRequest {
+  uint8_t type;           // FileType of the array, Quote or Trade
+  uint8_t format;         // ServerFormat of the response payload
+  uint16_t symbolLength;  // bytes of symbol following the header
+  uint32_t columnsLength; // bytes of columns following the symbol
+  uint64_t start;         // first datetime, ns since epoch (inclusive)
+  uint64_t end;           // last datetime, ns since epoch (inclusive)
+};
+
+/**
+ * Fixed size response header, followed by length bytes of payload. The
+ * payload is the result in the requested format, or an error message.
+ */
+struct ServerResponse {
+  uint8_t status;     // ServerStatus
+  uint8_t padding[7]; // zero
+  uint64_t rows;      // rows in the result
+  uint64_t length;    // bytes of payload following the header
+};
+
+static_assert(sizeof(ServerRequest) == 24, "request header must be packed");
+static_assert(sizeof(ServerResponse) == 24, "response header must be packed");
+
+enum class ServerFormat : uint8_t { Csv = 0, ArrowStream = 1, ArrowFile = 2 };
+
+enum class ServerStatus : uint8_t { Ok = 0, Error = 1 };
+
+/**
+ * Serves queries for a symbol over a time range from Quote and Trade arrays.
+ * Arrays share one TileDB context, so its tile cache is shared by all
+ * clients, and stay open between requests. Idle connections are polled and
+ * each request is answered by a worker thread, so any number of clients may
+ * keep a connection open and send requests in turn.
+ */
+class QueryServer {
+public:
+  /**
+   * @param socketPath path of the Unix domain socket to listen on
+   * @param masterFile master file used to resolve symbols
+   * @param delimiter delimiter of the master file and of delimited results
+   * @param threads requests served concurrently
+   * @param tileCacheSize bytes of TileDB tile cache, 0 for TileDB's default
+   */
+  QueryServer(std::string socketPath, std::string masterFile,
+              std::string delimiter, uint32_t threads, uint64_t tileCacheSize);
+
+  /**
+   * Serve an array, opening it so the first request starts warm
+   * @param type Quote or Trade
+   * @param uri
+   * @return false if the type is not supported or the array can not be opened
+   */
+  bool addArray(FileType type, const std::string &uri);
+
+  /**
+   * Accept connections until SIGINT or SIGTERM
+   * @return exit status
+   */
+  int run();
+
+private:
+  /**
+   * Answer the next request on a connection and hand the connection back to
+   * the poll loop, or close it if the client closed it
+   * @param fd
+   */
+  void serveRequest(int fd);
+
+  /**
+   * Answer a single request
+   * @param request
+   * @param symbol
+   * @param columns
+   * @param payload result or error message
+   * @return response header
+   */
+  ServerResponse handleRequest(const ServerRequest &request,
+                               const std::string &symbol,
+                               const std::string &columns,
+                               std::string &payload);
+
+  /**
+   * Take an idle instance of an array, creating one if all are busy
+   * @param type
+   * @return array or nullptr if the type is not served
+   */
+  std::unique_ptr<Array> acquire(FileType type);
+
+  /**
+   * Return an instance to the idle list
+   * @param type
+   * @param array
+   */
+  void release(FileType type, std::unique_ptr<Array> array);
+
+  /**
+   * Create an instance of a served array on the shared context
+   * @param type
+   * @param uri
+   * @return array
+   */
+  std::unique_ptr<Array> createArray(FileType type, const std::string &uri);
+
+  std::string socketPath;
+  std::string masterFile;
+  std::string delimiter;
+  uint32_t threads;
+
+  std::shared_ptr<tiledb::Context> ctx;
+
+  // symbol to symbol_id from the master file
+  std::unordered_map<std::string, uint64_t> symbolIds;
+
+  // Served array uris, and open instances not currently serving a request.
+  // An instance holds its own read buffers so is used by one request at a
+  // time.
+  std::map<FileType, std::string> arrayUris;
+  std::mutex idleMutex;
+  std::map<FileType, std::vector<std::unique_ptr<Array>>> idle;
+
+  // Open client connections, and those whose request was answered and which
+  // wait to be polled again
+  std::mutex connectionsMutex;
+  std::set<int> connections;
+  std::vector<int> answered;
+
+  // Wakes up the poll loop on a stop request or an answered request
+  int wakePipe[2] = {-1, -1};
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_QUERYSERVER_H
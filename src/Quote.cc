@@ -197,199 +197,3 @@ int nyse::Quote::load(const std::vector<std::string> file_uris, char delimiter,
   }
   return Array::load(file_uris, delimiter, batchSize, threads);
 }
-
-uint64_t nyse::Quote::readSample(std::string outfile, std::string delimiter) {
-  uint64_t rows_read = 0;
-  array = std::make_unique<tiledb::Array>(*ctx, array_uri,
-                                          tiledb_query_type_t::TILEDB_READ);
-  query = std::make_unique<tiledb::Query>(*ctx, *array);
-
-  std::ofstream output;
-  if (!outfile.empty()) {
-    output = std::ofstream(outfile);
-  }
-
-  query->set_layout(tiledb_layout_t::TILEDB_GLOBAL_ORDER);
-
-  tiledb::ArraySchema arraySchema = array->schema();
-
-  auto nonEmptyDomain = array->non_empty_domain<uint64_t>();
-
-  // 2018-07-30 09:30:00.000 to 2018-07-30 12:30:00.000
-  // Then select the entire domain for sequence number
-  // std::vector<uint64_t> subarray = {1532957400000000000, 1532968200000000000,
-  // nonEmptyDomain[1].second.first, nonEmptyDomain[1].second.second};
-  std::vector<uint64_t> subarray = {
-      nonEmptyDomain[0].second.first, nonEmptyDomain[0].second.second,
-      nonEmptyDomain[1].second.first, nonEmptyDomain[1].second.second};
-  query->set_subarray(subarray);
-
-  std::vector<uint64_t> coords(this->buffer_size / sizeof(uint64_t));
-  query->set_coordinates(coords);
-
-  std::vector<char> Exchange(this->buffer_size / sizeof(char));
-  query->set_buffer("Exchange", Exchange);
-
-  std::vector<char> Symbol(this->buffer_size / sizeof(char));
-  std::vector<uint64_t> Symbol_offsets(this->buffer_size / sizeof(uint64_t));
-  query->set_buffer("Symbol", Symbol_offsets, Symbol);
-
-  std::vector<float> Bid_Price(this->buffer_size / sizeof(float));
-  query->set_buffer("Bid_Price", Bid_Price);
-
-  std::vector<uint32_t> Bid_Size(this->buffer_size / sizeof(uint32_t));
-  query->set_buffer("Bid_Size", Bid_Size);
-
-  std::vector<float> Offer_Price(this->buffer_size / sizeof(float));
-  query->set_buffer("Offer_Price", Offer_Price);
-
-  std::vector<uint32_t> Offer_Size(this->buffer_size / sizeof(uint32_t));
-  query->set_buffer("Offer_Size", Offer_Size);
-
-  std::vector<char> Quote_Condition(this->buffer_size / sizeof(char));
-  query->set_buffer("Quote_Condition", Quote_Condition);
-
-  std::vector<char> National_BBO_Ind(this->buffer_size / sizeof(char));
-  query->set_buffer("National_BBO_Ind", National_BBO_Ind);
-
-  std::vector<char> FINRA_BBO_Indicator(this->buffer_size / sizeof(char));
-  query->set_buffer("FINRA_BBO_Indicator", FINRA_BBO_Indicator);
-
-  std::vector<uint8_t> FINRA_ADF_MPID_Indicator(this->buffer_size /
-                                                sizeof(uint8_t));
-  query->set_buffer("FINRA_ADF_MPID_Indicator", FINRA_ADF_MPID_Indicator);
-
-  std::vector<char> Quote_Cancel_Correction(this->buffer_size / sizeof(char));
-  query->set_buffer("Quote_Cancel_Correction", Quote_Cancel_Correction);
-
-  std::vector<char> Source_Of_Quote(this->buffer_size / sizeof(char));
-  query->set_buffer("Source_Of_Quote", Source_Of_Quote);
-
-  std::vector<char> Retail_Interest_Indicator(this->buffer_size / sizeof(char));
-  query->set_buffer("Retail_Interest_Indicator", Retail_Interest_Indicator);
-
-  std::vector<char> Short_Sale_Restriction_Indicator(this->buffer_size /
-                                                     sizeof(char));
-  query->set_buffer("Short_Sale_Restriction_Indicator",
-                    Short_Sale_Restriction_Indicator);
-
-  std::vector<char> LULD_BBO_Indicator(this->buffer_size / sizeof(char));
-  query->set_buffer("LULD_BBO_Indicator", LULD_BBO_Indicator);
-
-  std::vector<char> SIP_Generated_Message_Identifier(this->buffer_size /
-                                                     sizeof(char));
-  query->set_buffer("SIP_Generated_Message_Identifier",
-                    SIP_Generated_Message_Identifier);
-
-  std::vector<char> National_BBO_LULD_Indicator(this->buffer_size /
-                                                sizeof(char));
-  query->set_buffer("National_BBO_LULD_Indicator", National_BBO_LULD_Indicator);
-
-  std::vector<uint64_t> Participant_Timestamp(this->buffer_size /
-                                              sizeof(uint64_t));
-  query->set_buffer("Participant_Timestamp", Participant_Timestamp);
-
-  std::vector<uint64_t> FINRA_ADF_Timestamp(this->buffer_size /
-                                            sizeof(uint64_t));
-  query->set_buffer("FINRA_ADF_Timestamp", FINRA_ADF_Timestamp);
-
-  std::vector<char> FINRA_ADF_Market_Participant_Quote_Indicator(
-      this->buffer_size / sizeof(char));
-  query->set_buffer("FINRA_ADF_Market_Participant_Quote_Indicator",
-                    FINRA_ADF_Market_Participant_Quote_Indicator);
-
-  std::vector<char> Security_Status_Indicator(this->buffer_size / sizeof(char));
-  query->set_buffer("Security_Status_Indicator", Security_Status_Indicator);
-
-  tiledb::Query::Status status;
-  size_t previous_result_num = 0;
-  do {
-    // Submit query and get status
-    query->submit();
-    status = query->query_status();
-
-    // If any results were retrieved, parse and print them
-    auto result_num =
-        (int)query->result_buffer_elements()[TILEDB_COORDS].second /
-        arraySchema.domain().ndim();
-    rows_read += result_num;
-    if (status == tiledb::Query::Status::INCOMPLETE &&
-        result_num == 0) { // VERY IMPORTANT!!
-      std::cerr << "Buffers were too small for query, you should fix this, "
-                   "test is invalid"
-                << std::endl;
-      std::cerr << "Last complete rows read: " << rows_read << std::endl;
-      std::cerr << "Last good coordinates [" << coords[previous_result_num - 2]
-                << ", " << coords[previous_result_num - 1]
-                << "] for result size " << previous_result_num << std::endl;
-      break;
-      // reallocate_buffers(&coords, &a1_data, &a2_off, &a2_data);
-    }
-    if (output.is_open()) {
-      for (int i = 0; i < result_num; i++) {
-        std::stringstream ss;
-        ss << std::to_string(coords[i * 2]);
-        ss << delimiter;
-        ss << std::to_string(coords[i * 2 + 1]);
-        ss << delimiter;
-        ss << std::string(1, Exchange[i]);
-        ss << delimiter;
-        size_t symbolEnd =
-            ((i + 1 == result_num) ? Symbol.size() : Symbol_offsets[i + 1]);
-        ss << std::string(Symbol.begin() + Symbol_offsets[i],
-                          Symbol.begin() + symbolEnd);
-        ss << delimiter;
-        ss << std::to_string(Bid_Price[i]);
-        ss << delimiter;
-        ss << std::to_string(Bid_Size[i]);
-        ss << delimiter;
-        ss << std::to_string(Offer_Price[i]);
-        ss << delimiter;
-        ss << std::to_string(Offer_Size[i]);
-        ss << delimiter;
-        ss << std::string(1, Quote_Condition[i]);
-        ss << delimiter;
-        ss << std::string(1, National_BBO_Ind[i]);
-        ss << delimiter;
-        ss << std::string(1, FINRA_BBO_Indicator[i]);
-        ss << delimiter;
-        ss << std::to_string(FINRA_ADF_MPID_Indicator[i]);
-        ss << delimiter;
-        ss << std::string(1, Quote_Cancel_Correction[i]);
-        ss << delimiter;
-        ss << std::string(1, Source_Of_Quote[i]);
-        ss << delimiter;
-        ss << std::string(1, Retail_Interest_Indicator[i]);
-        ss << delimiter;
-        ss << std::string(1, Short_Sale_Restriction_Indicator[i]);
-        ss << delimiter;
-        ss << std::string(1, LULD_BBO_Indicator[i]);
-        ss << delimiter;
-        ss << std::string(1, SIP_Generated_Message_Identifier[i]);
-        ss << delimiter;
-        ss << std::string(1, National_BBO_LULD_Indicator[i]);
-        ss << delimiter;
-        ss << std::to_string(Participant_Timestamp[i]);
-        ss << delimiter;
-        ss << std::to_string(FINRA_ADF_Timestamp[i]);
-        ss << delimiter;
-        ss << std::string(1, FINRA_ADF_Market_Participant_Quote_Indicator[i]);
-        ss << delimiter;
-        ss << std::string(1, Security_Status_Indicator[i]);
-        ss << std::endl;
-
-        output << ss.rdbuf();
-      }
-    }
-
-    // std::cerr << "Last good coordinates [" << coords[result_num-2] << ", " <<
-    // coords[result_num-1] << "] for result size " << result_num << std::endl;
-    previous_result_num = result_num;
-  } while (status == tiledb::Query::Status::INCOMPLETE);
-
-  if (output.is_open()) {
-    output.close();
-  }
-
-  return rows_read;
-}
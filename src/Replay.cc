@@ -0,0 +1,439 @@
+/**
+ * @file  Replay.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Replay of trades and quotes of many symbols in global time order, merging the
+ * per symbol runs of each array with optional real time rate control
+ *
+ */
+
+#include "Replay.h"
+#include "Quote.h"
+#include "ResultStream.h"
+#include "Trace.h"
+#include "Trade.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Replay order, ties between a trade and a quote go to the trade
+ */
+static bool eventBefore(const nyse::ReplayEvent &a,
+                        const nyse::ReplayEvent &b) {
+  if (a.datetime != b.datetime)
+    return a.datetime < b.datetime;
+  if (a.sequence != b.sequence)
+    return a.sequence < b.sequence;
+  if (a.type != b.type)
+    return a.type > b.type;
+  return a.symbolId < b.symbolId;
+}
+
+nyse::ReplayRing::~ReplayRing() {
+  if (header == nullptr)
+    return;
+  finish();
+  munmap(header, mappedBytes);
+  close(fd);
+}
+
+bool nyse::ReplayRing::create(const std::string &name, uint64_t capacity) {
+  uint64_t rounded = 1;
+  while (rounded < capacity)
+    rounded <<= 1;
+
+  // A segment left by an earlier run would have a stale header
+  shm_unlink(name.c_str());
+  fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd == -1) {
+    std::cerr << "Could not create shared memory " << name << ": "
+              << strerror(errno) << std::endl;
+    return false;
+  }
+  mappedBytes = sizeof(ReplayRingHeader) + rounded * sizeof(ReplayEvent);
+  if (ftruncate(fd, mappedBytes) != 0) {
+    std::cerr << "Could not size shared memory " << name << ": "
+              << strerror(errno) << std::endl;
+    close(fd);
+    fd = -1;
+    return false;
+  }
+  void *mapped =
+      mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) {
+    std::cerr << "Could not map shared memory " << name << ": "
+              << strerror(errno) << std::endl;
+    close(fd);
+    fd = -1;
+    return false;
+  }
+
+  header = new (mapped) ReplayRingHeader();
+  header->capacity = rounded;
+  header->eventSize = sizeof(ReplayEvent);
+  header->written.store(0, std::memory_order_relaxed);
+  header->read.store(0, std::memory_order_relaxed);
+  header->done.store(0, std::memory_order_relaxed);
+  events = reinterpret_cast<ReplayEvent *>(static_cast<char *>(mapped) +
+                                           sizeof(ReplayRingHeader));
+  mask = rounded - 1;
+  // Consumers check the magic last, once the rest of the header is valid
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = magic;
+  return true;
+}
+
+void nyse::ReplayRing::push(const ReplayEvent &event) {
+  uint64_t written = header->written.load(std::memory_order_relaxed);
+  while (written - header->read.load(std::memory_order_acquire) > mask)
+    std::this_thread::yield();
+  events[written & mask] = event;
+  header->written.store(written + 1, std::memory_order_release);
+}
+
+void nyse::ReplayRing::finish() {
+  if (header != nullptr)
+    header->done.store(1, std::memory_order_release);
+}
+
+nyse::Replay::Replay(std::shared_ptr<tiledb::Context> ctx,
+                     std::string tradeUri, std::string quoteUri)
+    : ctx(std::move(ctx)), tradeUri(std::move(tradeUri)),
+      quoteUri(std::move(quoteUri)) {}
+
+void nyse::Replay::setSymbols(std::vector<uint64_t> symbolIds) {
+  this->symbolIds = std::move(symbolIds);
+  selected.clear();
+  for (uint64_t symbolId : this->symbolIds) {
+    if (symbolId >= selected.size())
+      selected.resize(symbolId + 1, false);
+    selected[symbolId] = true;
+  }
+  symbolRanges.clear();
+  for (uint64_t symbolId = 0; symbolId < selected.size(); symbolId++) {
+    if (!selected[symbolId])
+      continue;
+    if (!symbolRanges.empty() && symbolRanges.back().second + 1 == symbolId)
+      symbolRanges.back().second = symbolId;
+    else
+      symbolRanges.emplace_back(symbolId, symbolId);
+  }
+}
+
+void nyse::Replay::readWindow(
+    Array &array, bool trades,
+    const std::vector<std::pair<uint64_t, uint64_t>> &nonEmptyDomain,
+    uint64_t start, uint64_t end, Window &result) {
+  result.events.clear();
+  result.runs.clear();
+
+  if (nonEmptyDomain.size() < 3) {
+    result.runs.push_back(0);
+    return;
+  }
+  // One read over the symbol range, rows of other symbols are skipped
+  uint64_t minSymbol = nonEmptyDomain[0].first;
+  uint64_t maxSymbol = nonEmptyDomain[0].second;
+  if (!symbolIds.empty()) {
+    auto range = std::minmax_element(symbolIds.begin(), symbolIds.end());
+    minSymbol = std::max(minSymbol, *range.first);
+    maxSymbol = std::min(maxSymbol, *range.second);
+  }
+  std::vector<uint64_t> subarray;
+  if (minSymbol <= maxSymbol)
+    subarray = array.symbolSubarray(minSymbol, start, end, nonEmptyDomain);
+  if (subarray.empty()) {
+    result.runs.push_back(0);
+    return;
+  }
+  subarray[1] = maxSymbol;
+
+  auto dimensions = array.array->schema().domain().dimensions();
+  uint64_t symbolIndex = dimensionIndex(dimensions, "symbol_id");
+  uint64_t datetimeIndex = dimensionIndex(dimensions, "datetime");
+  uint64_t sequenceIndex = dimensionIndex(dimensions, "Sequence_Number");
+
+  TraceSpan span("replay_read", array.array_uri);
+  ResultStream stream(array, subarray);
+  for (const ResultBatch &batch : stream) {
+    uint64_t ndim = batch.dimensions();
+    const uint64_t *coords = batch.coordinates<uint64_t>().data();
+    ColumnSpan<char> exchange = batch.values<char>("Exchange");
+    ColumnSpan<float> price, offerPrice;
+    ColumnSpan<uint32_t> size, offerSize;
+    if (trades) {
+      price = batch.values<float>("Trade_Price");
+      size = batch.values<uint32_t>("Trade_Volume");
+    } else {
+      price = batch.values<float>("Bid_Price");
+      size = batch.values<uint32_t>("Bid_Size");
+      offerPrice = batch.values<float>("Offer_Price");
+      offerSize = batch.values<uint32_t>("Offer_Size");
+    }
+
+    for (uint64_t row = 0; row < batch.rows(); row++) {
+      const uint64_t *cell = coords + row * ndim;
+      uint64_t symbolId = cell[symbolIndex];
+      if (!selected.empty() &&
+          (symbolId >= selected.size() || !selected[symbolId]))
+        continue;
+      ReplayEvent event;
+      memset(&event, 0, sizeof(event));
+      event.datetime = cell[datetimeIndex];
+      event.sequence = cell[sequenceIndex];
+      event.symbolId = static_cast<uint32_t>(symbolId);
+      event.type = trades ? 'T' : 'Q';
+      event.exchange = exchange[row];
+      event.price = price[row];
+      event.size = size[row];
+      if (!trades) {
+        event.offerPrice = offerPrice[row];
+        event.offerSize = offerSize[row];
+      }
+      // Global order is sorted per space tile, a new run starts wherever the
+      // order goes back
+      if (result.events.empty() || eventBefore(event, result.events.back()))
+        result.runs.push_back(result.events.size());
+      result.events.push_back(event);
+    }
+  }
+  result.runs.push_back(result.events.size());
+  span.setRows(result.events.size());
+}
+
+bool nyse::Replay::hasEvents(
+    Array &array, const std::vector<std::pair<uint64_t, uint64_t>> &domain,
+    uint64_t start, uint64_t end) {
+  if (domain.size() < 3)
+    return false;
+  std::vector<std::pair<uint64_t, uint64_t>> ranges = symbolRanges;
+  if (ranges.empty())
+    ranges.push_back(domain[0]);
+
+  std::vector<uint64_t> coords(domain.size());
+  for (const auto &range : ranges) {
+    uint64_t firstSymbol = std::max(range.first, domain[0].first);
+    uint64_t lastSymbol = std::min(range.second, domain[0].second);
+    if (firstSymbol > lastSymbol)
+      continue;
+    std::vector<uint64_t> subarray =
+        array.symbolSubarray(firstSymbol, start, end, domain);
+    if (subarray.empty())
+      return false;
+    subarray[1] = lastSymbol;
+
+    // The buffer holds a single cell, so the read stops at the first one
+    TraceSpan span("replay_probe", array.array_uri);
+    tiledb::Query probe(*array.ctx, *array.array);
+    probe.set_layout(tiledb_layout_t::TILEDB_UNORDERED);
+    probe.set_subarray(subarray);
+    probe.set_coordinates(coords);
+    tiledb::Query::Status status;
+    uint64_t cells = 0;
+    do {
+      status = probe.submit();
+      cells = probe.result_buffer_elements()[TILEDB_COORDS].second;
+    } while (status == tiledb::Query::Status::INCOMPLETE && cells == 0);
+    span.setRows(cells / domain.size());
+    if (status == tiledb::Query::Status::FAILED || cells > 0)
+      return true;
+  }
+  return false;
+}
+
+uint64_t nyse::Replay::run(uint64_t start, uint64_t end,
+                           const Callback &callback) {
+  std::unique_ptr<Array> trades, quotes;
+  if (!tradeUri.empty()) {
+    trades = std::make_unique<Trade>(tradeUri, "", '|');
+    trades->setCtx(ctx);
+    if (!trades->setColumns(
+            {"datetime", "Exchange", "Trade_Price", "Trade_Volume"}))
+      throw std::runtime_error("Invalid trade columns");
+  }
+  if (!quoteUri.empty()) {
+    quotes = std::make_unique<Quote>(quoteUri, "", '|');
+    quotes->setCtx(ctx);
+    if (!quotes->setColumns({"datetime", "Exchange", "Bid_Price", "Bid_Size",
+                             "Offer_Price", "Offer_Size"}))
+      throw std::runtime_error("Invalid quote columns");
+  }
+
+  // Clip the range to the datetimes of both arrays
+  std::vector<std::pair<uint64_t, uint64_t>> tradeDomain, quoteDomain;
+  if (trades != nullptr)
+    tradeDomain = trades->nonEmptyDomain();
+  if (quotes != nullptr)
+    quoteDomain = quotes->nonEmptyDomain();
+  uint64_t firstData = std::numeric_limits<uint64_t>::max();
+  uint64_t lastData = 0;
+  for (const auto *domain : {&tradeDomain, &quoteDomain}) {
+    if (domain->size() < 3)
+      continue;
+    firstData = std::min(firstData, (*domain)[1].first);
+    lastData = std::max(lastData, (*domain)[1].second);
+  }
+  start = std::max(start, firstData);
+  end = std::min(end, lastData);
+  if (start > end)
+    return 0;
+
+  auto windowEnd = [&](uint64_t windowStart) {
+    return end - windowStart < window ? end : windowStart + window - 1;
+  };
+  auto anyEvents = [&](uint64_t rangeStart, uint64_t rangeEnd) {
+    return (trades != nullptr &&
+            hasEvents(*trades, tradeDomain, rangeStart, rangeEnd)) ||
+           (quotes != nullptr &&
+            hasEvents(*quotes, quoteDomain, rangeStart, rangeEnd));
+  };
+
+  // First datetime from which a window has events, end + 1 if there are none.
+  // Empty ranges of doubling length are skipped, then the first range with
+  // events is bisected down to a window.
+  auto nextEvents = [&](uint64_t from) {
+    uint64_t length = window;
+    uint64_t last = windowEnd(from);
+    while (!anyEvents(from, last)) {
+      if (last == end)
+        return end + 1;
+      from = last + 1;
+      length = std::min(length * 2, std::numeric_limits<uint64_t>::max() / 4);
+      last = end - from < length ? end : from + length - 1;
+    }
+    while (last - from >= window) {
+      uint64_t middle = from + (last - from) / 2;
+      if (anyEvents(from, middle))
+        last = middle;
+      else
+        from = middle + 1;
+    }
+    return from;
+  };
+
+  // Trade and quote window from a datetime, an empty window is followed by
+  // the next one with events
+  struct Windows {
+    uint64_t end = 0;
+    Window trades;
+    Window quotes;
+  };
+  auto read = [&](uint64_t windowStart) {
+    Windows windows;
+    for (bool skipped = false;; skipped = true) {
+      windows.end = windowEnd(windowStart);
+      if (trades != nullptr)
+        readWindow(*trades, true, tradeDomain, windowStart, windows.end,
+                   windows.trades);
+      if (quotes != nullptr)
+        readWindow(*quotes, false, quoteDomain, windowStart, windows.end,
+                   windows.quotes);
+      if (skipped || windows.end == end ||
+          windows.trades.events.size() + windows.quotes.events.size() > 0)
+        return windows;
+      windowStart = nextEvents(windows.end + 1);
+      if (windowStart > end) {
+        windows.end = end;
+        return windows;
+      }
+    }
+  };
+
+  struct Cursor {
+    const ReplayEvent *next;
+    const ReplayEvent *end;
+  };
+  auto later = [](const Cursor &a, const Cursor &b) {
+    return eventBefore(*b.next, *a.next);
+  };
+
+  uint64_t delivered = 0;
+  bool paced = false;
+  uint64_t firstDatetime = 0;
+  std::chrono::steady_clock::time_point wallStart;
+
+  std::future<Windows> pending = std::async(std::launch::async, read, start);
+  while (pending.valid()) {
+    Windows current = pending.get();
+    if (current.end < end)
+      pending = std::async(std::launch::async, read, current.end + 1);
+
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(later)> heap(
+        later);
+    for (const Window *w : {&current.trades, &current.quotes}) {
+      for (size_t r = 0; r + 1 < w->runs.size(); r++) {
+        if (w->runs[r] < w->runs[r + 1])
+          heap.push(Cursor{w->events.data() + w->runs[r],
+                           w->events.data() + w->runs[r + 1]});
+      }
+    }
+
+    while (!heap.empty()) {
+      Cursor cursor = heap.top();
+      heap.pop();
+      const ReplayEvent &event = *cursor.next;
+
+      if (speed > 0) {
+        if (!paced) {
+          paced = true;
+          firstDatetime = event.datetime;
+          wallStart = std::chrono::steady_clock::now();
+        }
+        auto target =
+            wallStart + std::chrono::nanoseconds(static_cast<uint64_t>(
+                            (event.datetime - firstDatetime) / speed));
+        if (target > std::chrono::steady_clock::now())
+          std::this_thread::sleep_until(target);
+      }
+
+      delivered++;
+      if (!callback(event)) {
+        if (pending.valid())
+          pending.wait();
+        return delivered;
+      }
+      if (++cursor.next != cursor.end)
+        heap.push(cursor);
+    }
+  }
+  return delivered;
+}
@@ -0,0 +1,236 @@
+/**
+ * @file  Replay.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Replay of trades and quotes of many symbols in global time order, merging the
+ * per symbol runs of each array with optional real time rate control
+ *
+ */
+
+#ifndef NYSE_INGESTOR_REPLAY_H
+#define NYSE_INGESTOR_REPLAY_H
+
+#include "Array.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * A trade or quote in replay order. Fixed size and trivially copyable so it
+ * can be written to a shared memory ring as is.
+ */
+struct ReplayEvent {
+  uint64_t datetime;
+  uint64_t sequence;
+  uint32_t symbolId;
+  // 'T' for a trade, 'Q' for a quote
+  char type;
+  char exchange;
+  uint16_t reserved;
+  // Trade_Price and Trade_Volume, or Bid_Price and Bid_Size
+  float price;
+  uint32_t size;
+  // Offer_Price and Offer_Size of quotes
+  float offerPrice;
+  uint32_t offerSize;
+};
+static_assert(sizeof(ReplayEvent) == 40, "ReplayEvent layout is shared");
+static_assert(std::is_trivially_copyable<ReplayEvent>::value,
+              "ReplayEvent is copied into shared memory");
+
+/**
+ * Header of a replay ring in shared memory, followed by capacity events. The
+ * producer advances written after storing an event and the consumer advances
+ * read after consuming one, each counter on its own cache line. done is set
+ * once the replay finished.
+ */
+struct ReplayRingHeader {
+  // "NYSERPL1"
+  uint64_t magic;
+  uint64_t capacity;
+  uint64_t eventSize;
+  alignas(64) std::atomic<uint64_t> written;
+  alignas(64) std::atomic<uint64_t> read;
+  alignas(64) std::atomic<uint32_t> done;
+};
+static_assert(sizeof(ReplayRingHeader) == 256,
+              "Events start 256 bytes into the segment");
+
+/**
+ * Single producer, single consumer ring of replay events in POSIX shared
+ * memory, for consumers in another process. The consumer maps the segment,
+ * reads events [read, written) at index % capacity and unlinks it when done.
+ */
+class ReplayRing {
+public:
+  static const uint64_t magic = 0x314c50524553594eULL;
+
+  ReplayRing() = default;
+  ~ReplayRing();
+
+  ReplayRing(const ReplayRing &) = delete;
+  ReplayRing &operator=(const ReplayRing &) = delete;
+
+  /**
+   * Create the shared memory segment, replacing any previous one
+   * @param name shared memory object name, starting with /
+   * @param capacity events, rounded up to a power of two
+   * @return false if it could not be created
+   */
+  bool create(const std::string &name, uint64_t capacity);
+
+  /**
+   * Append an event, waiting while the ring is full
+   * @param event
+   */
+  void push(const ReplayEvent &event);
+
+  /**
+   * Mark the replay as finished
+   */
+  void finish();
+
+private:
+  ReplayRingHeader *header = nullptr;
+  ReplayEvent *events = nullptr;
+  uint64_t mask = 0;
+  uint64_t mappedBytes = 0;
+  int fd = -1;
+};
+
+/**
+ * Replays trades and quotes of a set of symbols in (datetime,
+ * Sequence_Number) order across both arrays. Time windows of all symbols are
+ * read in global order, which yields one sorted run per symbol and space
+ * tile, and the runs of both arrays are merged with a heap. The next window
+ * is read while the current one is delivered, so memory is bounded by two
+ * windows. The range is clipped to the data and time without events is
+ * skipped, a window after an empty one starts at the next datetime with
+ * events.
+ */
+class Replay {
+public:
+  /**
+   * Receives events in order, returns false to stop the replay
+   */
+  using Callback = std::function<bool(const ReplayEvent &)>;
+
+  /**
+   * @param ctx context shared by the readers
+   * @param tradeUri Trade array, empty for quotes only
+   * @param quoteUri Quote array, empty for trades only
+   */
+  Replay(std::shared_ptr<tiledb::Context> ctx, std::string tradeUri,
+         std::string quoteUri);
+
+  /**
+   * Symbols to replay, all symbols if empty
+   * @param symbolIds
+   */
+  void setSymbols(std::vector<uint64_t> symbolIds);
+
+  /**
+   * Time range read at once
+   * @param nanoseconds
+   */
+  void setWindow(uint64_t nanoseconds) {
+    window = std::max<uint64_t>(nanoseconds, 1);
+  }
+
+  /**
+   * Replay speed relative to real time, 0 to deliver as fast as possible
+   * @param speed
+   */
+  void setSpeed(double speed) { this->speed = std::max(speed, 0.0); }
+
+  /**
+   * Replay a time range
+   * @param start first datetime in nanoseconds since epoch (inclusive)
+   * @param end last datetime in nanoseconds since epoch (inclusive)
+   * @param callback
+   * @return events delivered
+   */
+  uint64_t run(uint64_t start, uint64_t end, const Callback &callback);
+
+private:
+  /**
+   * Events of one window of one array, in global order
+   */
+  struct Window {
+    std::vector<ReplayEvent> events;
+    // Start of each sorted run, followed by events.size()
+    std::vector<uint64_t> runs;
+  };
+
+  /**
+   * Read a window of an array
+   * @param array reader with the replay columns projected
+   * @param trades whether the array holds trades
+   * @param domain non-empty domain of the array
+   * @param start
+   * @param end
+   * @param result replaced by the events and their runs
+   */
+  void readWindow(Array &array, bool trades,
+                  const std::vector<std::pair<uint64_t, uint64_t>> &domain,
+                  uint64_t start, uint64_t end, Window &result);
+
+  /**
+   * Whether an array has events of the replayed symbols in a time range,
+   * reading at most one cell per range of consecutive symbol ids
+   * @param array
+   * @param domain non-empty domain of the array
+   * @param start
+   * @param end
+   * @return true if there are events or the read failed
+   */
+  bool hasEvents(Array &array,
+                 const std::vector<std::pair<uint64_t, uint64_t>> &domain,
+                 uint64_t start, uint64_t end);
+
+  std::shared_ptr<tiledb::Context> ctx;
+  std::string tradeUri;
+  std::string quoteUri;
+  std::vector<uint64_t> symbolIds;
+  // Requested symbols indexed by symbol_id, empty for all
+  std::vector<bool> selected;
+  // Ranges of consecutive requested symbol ids, empty for all
+  std::vector<std::pair<uint64_t, uint64_t>> symbolRanges;
+  uint64_t window = 60000000000;
+  double speed = 0;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_REPLAY_H
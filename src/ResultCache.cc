@@ -0,0 +1,162 @@
+/**
+ * @file  ResultCache.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Process wide LRU cache of decoded read results, keyed by array, fragment set,
+ * subarray and columns
+ *
+ */
+
+#include "ResultCache.h"
+
+bool nyse::CachedResult::append(
+    const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+    const ResultElements &resultElements, uint64_t rows, uint64_t limit) {
+  uint64_t batchBytes = 0;
+  for (const auto &entry : buffers) {
+    const std::pair<uint64_t, uint64_t> &elements =
+        resultElements.at(entry.first);
+    batchBytes += dispatchDatatype(entry.second->datatype, [&](auto type) {
+      return elements.second * sizeof(decltype(type));
+    });
+    if (entry.second->offsets != nullptr)
+      batchBytes += elements.first * sizeof(uint64_t);
+  }
+  if (bytes + batchBytes > limit)
+    return false;
+
+  CachedBatch batch{{}, resultElements, rows};
+  for (const auto &entry : buffers) {
+    const buffer &source = *entry.second;
+    const std::pair<uint64_t, uint64_t> &elements =
+        resultElements.at(entry.first);
+    auto copy = std::make_shared<buffer>(buffer{nullptr, nullptr,
+                                                source.datatype});
+    dispatchDatatype(source.datatype, [&](auto type) {
+      using T = decltype(type);
+      const T *values =
+          std::static_pointer_cast<std::vector<T>>(source.values)->data();
+      copy->values =
+          std::make_shared<std::vector<T>>(values, values + elements.second);
+    });
+    if (source.offsets != nullptr)
+      copy->offsets = std::make_shared<std::vector<uint64_t>>(
+          source.offsets->begin(), source.offsets->begin() + elements.first);
+    batch.buffers.emplace(entry.first, std::move(copy));
+  }
+  batches.push_back(std::move(batch));
+  this->rows += rows;
+  bytes += batchBytes;
+  return true;
+}
+
+nyse::ResultCache &nyse::ResultCache::instance() {
+  static ResultCache cache;
+  return cache;
+}
+
+void nyse::ResultCache::setCapacity(uint64_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  capacityBytes.store(bytes);
+  evict(0);
+}
+
+void nyse::ResultCache::evict(uint64_t bytes) {
+  uint64_t cap = capacity();
+  while (!entries.empty() && this->bytes + bytes > cap) {
+    const Entry &oldest = entries.back();
+    this->bytes -= oldest.bytes;
+    index.erase(oldest.key);
+    entries.pop_back();
+    evictions++;
+  }
+}
+
+std::shared_ptr<const nyse::CachedResult>
+nyse::ResultCache::find(const std::string &key) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto entry = index.find(key);
+  if (entry == index.end()) {
+    misses++;
+    return nullptr;
+  }
+  hits++;
+  entries.splice(entries.begin(), entries, entry->second);
+  return entry->second->result;
+}
+
+void nyse::ResultCache::insert(const std::string &arrayUri,
+                               const std::string &key,
+                               std::shared_ptr<const CachedResult> result) {
+  uint64_t entryBytes = result->bytes + key.size();
+  std::lock_guard<std::mutex> lock(mutex);
+  if (entryBytes > capacity() || index.count(key))
+    return;
+  evict(entryBytes);
+  entries.push_front(Entry{key, arrayUri, std::move(result), entryBytes});
+  index.emplace(key, entries.begin());
+  bytes += entryBytes;
+}
+
+void nyse::ResultCache::setFragments(const std::string &arrayUri,
+                                     const std::string &fragments) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto known = arrayFragments.find(arrayUri);
+  if (known == arrayFragments.end()) {
+    arrayFragments.emplace(arrayUri, fragments);
+    return;
+  }
+  if (known->second == fragments)
+    return;
+  known->second = fragments;
+
+  // Results of the old fragment set can never be hit again
+  for (auto entry = entries.begin(); entry != entries.end();) {
+    if (entry->arrayUri != arrayUri) {
+      ++entry;
+      continue;
+    }
+    bytes -= entry->bytes;
+    index.erase(entry->key);
+    entry = entries.erase(entry);
+    invalidations++;
+  }
+}
+
+void nyse::ResultCache::report(FILE *out) {
+  if (!enabled())
+    return;
+  std::lock_guard<std::mutex> lock(mutex);
+  uint64_t lookups = hits + misses;
+  fprintf(out,
+          "result cache: %lu hits, %lu misses (%.1f%% hit rate), %lu "
+          "evictions, %lu invalidations, %lu results in %.1f of %.1f MiB\n",
+          hits, misses, lookups > 0 ? 100.0 * hits / lookups : 0.0, evictions,
+          invalidations, entries.size(), bytes / 1048576.0,
+          capacity() / 1048576.0);
+}
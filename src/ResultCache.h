@@ -0,0 +1,159 @@
+/**
+ * @file  ResultCache.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Process wide LRU cache of decoded read results, keyed by array, fragment set,
+ * subarray and columns
+ *
+ */
+
+#ifndef NYSE_INGESTOR_RESULTCACHE_H
+#define NYSE_INGESTOR_RESULTCACHE_H
+
+#include "Array.h"
+#include "buffer.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * Copy of one result batch, with buffers sized to the result
+ */
+struct CachedBatch {
+  std::unordered_map<std::string, std::shared_ptr<buffer>> buffers;
+  ResultElements resultElements;
+  uint64_t rows;
+};
+
+/**
+ * All batches of a read
+ */
+struct CachedResult {
+  std::vector<CachedBatch> batches;
+  uint64_t rows = 0;
+  uint64_t bytes = 0;
+
+  /**
+   * Copy a result batch
+   * @param buffers buffers the batch was read into
+   * @param resultElements
+   * @param rows
+   * @param limit bytes the result may not exceed
+   * @return false if the copy would exceed limit, nothing is copied then
+   */
+  bool
+  append(const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers,
+         const ResultElements &resultElements, uint64_t rows, uint64_t limit);
+};
+
+class ResultCache {
+public:
+  static ResultCache &instance();
+
+  /**
+   * Set the memory cap, evicting results until it is met
+   * @param bytes cap, 0 disables the cache
+   */
+  void setCapacity(uint64_t bytes);
+
+  uint64_t capacity() const {
+    return capacityBytes.load(std::memory_order_relaxed);
+  }
+
+  bool enabled() const { return capacity() > 0; }
+
+  /**
+   * Look up a result, marking it most recently used
+   * @param key
+   * @return result or nullptr on a miss
+   */
+  std::shared_ptr<const CachedResult> find(const std::string &key);
+
+  /**
+   * Insert a result, evicting least recently used results to make room
+   * @param arrayUri array the result was read from
+   * @param key
+   * @param result
+   */
+  void insert(const std::string &arrayUri, const std::string &key,
+              std::shared_ptr<const CachedResult> result);
+
+  /**
+   * Record the fragments of an array, dropping its results when they changed
+   * @param arrayUri
+   * @param fragments
+   */
+  void setFragments(const std::string &arrayUri, const std::string &fragments);
+
+  /**
+   * Print hit, miss, eviction and memory figures
+   * @param out
+   */
+  void report(FILE *out = stdout);
+
+private:
+  ResultCache() = default;
+
+  /**
+   * Evict least recently used results until bytes fit in the capacity
+   * @param bytes
+   */
+  void evict(uint64_t bytes);
+
+  struct Entry {
+    std::string key;
+    std::string arrayUri;
+    std::shared_ptr<const CachedResult> result;
+    uint64_t bytes;
+  };
+
+  std::atomic<uint64_t> capacityBytes{0};
+
+  std::mutex mutex;
+  // Most recently used first
+  std::list<Entry> entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  std::unordered_map<std::string, std::string> arrayFragments;
+  uint64_t bytes = 0;
+
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  uint64_t invalidations = 0;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_RESULTCACHE_H
@@ -0,0 +1,180 @@
+/**
+ * @file  ResultStream.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Streaming reader over query results which fetches the next batch in the
+ * background while the current one is processed
+ *
+ */
+
+#include "ResultStream.h"
+#include "Trace.h"
+#include <chrono>
+#include <iostream>
+
+const nyse::buffer &
+nyse::ResultBatch::columnBuffer(const std::string &column) const {
+  auto buf = readBuffers->find(column);
+  if (buf == readBuffers->end())
+    throw std::invalid_argument("Column " + column + " was not read");
+  return *buf->second;
+}
+
+nyse::ColumnSpan<uint64_t>
+nyse::ResultBatch::offsets(const std::string &column) const {
+  const buffer &buf = columnBuffer(column);
+  if (buf.offsets == nullptr)
+    throw std::invalid_argument("Column " + column + " is not variable sized");
+  return ColumnSpan<uint64_t>(buf.offsets->data(), elements.at(column).first);
+}
+
+nyse::ResultStream::ResultStream(Array &array,
+                                 const std::vector<uint64_t> &subarray)
+    : array(array) {
+  array.openForRead();
+  tiledb::ArraySchema arraySchema = array.array->schema();
+  ndim = arraySchema.domain().dimensions().size();
+
+  query = std::make_unique<tiledb::Query>(*array.ctx, *array.array);
+  query->set_layout(tiledb_layout_t::TILEDB_GLOBAL_ORDER);
+  setSubarray(*query, arraySchema.domain().type(), subarray);
+
+  bufferSets[0] = &array.readBuffers;
+  bufferSets[1] = &array.prefetchBuffers;
+  array.allocateReadBuffers(*array.array, subarray, *bufferSets[0]);
+  array.allocateReadBuffers(*array.array, subarray, *bufferSets[1]);
+
+  // Rows are counted from the coordinates when fetched, otherwise from the
+  // first projected attribute
+  countColumn = bufferSets[0]->count(TILEDB_COORDS)
+                    ? std::string(TILEDB_COORDS)
+                    : array.outputColumns().front();
+
+  array.setQueryBuffers(*query, *bufferSets[pending]);
+  submit();
+}
+
+nyse::ResultStream::~ResultStream() {
+  if (inFlight)
+    wait();
+}
+
+void nyse::ResultStream::submit() {
+  {
+    std::lock_guard<std::mutex> lock(completionMutex);
+    completed = false;
+  }
+  inFlight = true;
+  query->submit_async([this]() {
+    std::lock_guard<std::mutex> lock(completionMutex);
+    completed = true;
+    completion.notify_one();
+  });
+}
+
+bool nyse::ResultStream::wait() {
+  std::unique_lock<std::mutex> lock(completionMutex);
+  // TileDB only calls back when the query succeeds, a failure is noticed by
+  // polling the status
+  bool failed = false;
+  while (!completion.wait_for(lock, std::chrono::milliseconds(10),
+                              [this]() { return completed; })) {
+    if (query->query_status() == tiledb::Query::Status::FAILED) {
+      failed = true;
+      break;
+    }
+  }
+  inFlight = false;
+  return !failed;
+}
+
+bool nyse::ResultStream::next() {
+  hasBatch = false;
+  while (inFlight) {
+    // Only the time spent blocked on the fetch is traced, the rest of the
+    // submission overlapped with processing of the previous batch
+    TraceSpan waitSpan("read", array.array_uri);
+    tiledb::Query::Status status = wait() ? query->query_status()
+                                          : tiledb::Query::Status::FAILED;
+    if (status == tiledb::Query::Status::FAILED) {
+      std::cerr << "Read of " << array.array_uri << " failed after "
+                << rowsRead << " rows" << std::endl;
+      return false;
+    }
+
+    std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers =
+        *bufferSets[pending];
+    ResultElements resultElements = query->result_buffer_elements();
+    uint64_t rows;
+    if (countColumn == TILEDB_COORDS)
+      rows = resultElements[countColumn].second / ndim;
+    else if (buffers.at(countColumn)->offsets != nullptr)
+      rows = resultElements[countColumn].first;
+    else
+      rows = resultElements[countColumn].second;
+    waitSpan.setRows(rows);
+    waitSpan.end();
+
+    bool incomplete = status == tiledb::Query::Status::INCOMPLETE;
+    if (incomplete && rows == 0) {
+      // Not even one cell fit, grow the buffers and resubmit
+      if (!array.growReadBuffers(buffers)) {
+        std::cerr << "Read buffers reached their limit without fitting a "
+                     "single cell, aborting after "
+                  << rowsRead << " rows" << std::endl;
+        return false;
+      }
+      array.setQueryBuffers(*query, buffers);
+      submit();
+      continue;
+    }
+    if (rows == 0)
+      return false;
+
+    array.resultsRead(buffers, resultElements, rows);
+    current = ResultBatch(&buffers, std::move(resultElements), rows, ndim);
+    rowsRead += rows;
+    if (incomplete) {
+      // Fetch the next batch into the other set while this one is processed
+      pending = 1 - pending;
+      array.setQueryBuffers(*query, *bufferSets[pending]);
+      submit();
+    }
+    hasBatch = true;
+    return true;
+  }
+  return false;
+}
+
+nyse::ResultStream::iterator nyse::ResultStream::begin() {
+  if (!started) {
+    started = true;
+    next();
+  }
+  return hasBatch ? iterator(this) : end();
+}
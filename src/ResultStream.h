@@ -0,0 +1,289 @@
+/**
+ * @file  ResultStream.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Streaming reader over query results which fetches the next batch in the
+ * background while the current one is processed
+ *
+ */
+
+#ifndef NYSE_INGESTOR_RESULTSTREAM_H
+#define NYSE_INGESTOR_RESULTSTREAM_H
+
+#include "Array.h"
+#include "buffer.h"
+#include <condition_variable>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * Read only view over contiguous values of a result buffer
+ */
+template <typename T> class ColumnSpan {
+public:
+  ColumnSpan() = default;
+  ColumnSpan(const T *values, uint64_t count) : values(values), count(count) {}
+
+  const T *data() const { return values; }
+  uint64_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  const T &operator[](uint64_t i) const { return values[i]; }
+  const T *begin() const { return values; }
+  const T *end() const { return values + count; }
+
+private:
+  const T *values = nullptr;
+  uint64_t count = 0;
+};
+
+/**
+ * One batch of query results. The spans point into the stream's buffers and
+ * stay valid until the stream advances.
+ */
+class ResultBatch {
+public:
+  ResultBatch() = default;
+
+  /**
+   * Number of result cells in the batch
+   */
+  uint64_t rows() const { return rowCount; }
+
+  /**
+   * Number of dimensions interleaved in the coordinates
+   */
+  uint64_t dimensions() const { return ndim; }
+
+  /**
+   * Values of an attribute, for variable sized attributes these are the
+   * concatenated values of all cells
+   * @tparam T type matching the attribute's datatype
+   * @param column attribute name or TILEDB_COORDS
+   * @return values
+   */
+  template <typename T> ColumnSpan<T> values(const std::string &column) const;
+
+  /**
+   * Coordinates of all cells, dimensions() values per cell
+   * @tparam T domain type
+   * @return coordinates
+   */
+  template <typename T> ColumnSpan<T> coordinates() const {
+    return values<T>(TILEDB_COORDS);
+  }
+
+  /**
+   * Byte offsets of each cell of a variable sized attribute
+   * @param column
+   * @return offsets, one per row
+   */
+  ColumnSpan<uint64_t> offsets(const std::string &column) const;
+
+  /**
+   * Values of a single cell of a variable sized attribute
+   * @tparam T type matching the attribute's datatype
+   * @param column
+   * @param row
+   * @return cell values
+   */
+  template <typename T>
+  ColumnSpan<T> cell(const std::string &column, uint64_t row) const;
+
+  /**
+   * Buffers and result elements the batch was read into
+   */
+  const std::unordered_map<std::string, std::shared_ptr<buffer>> &
+  buffers() const {
+    return *readBuffers;
+  }
+  const ResultElements &resultElements() const { return elements; }
+
+private:
+  friend class ResultStream;
+
+  ResultBatch(
+      const std::unordered_map<std::string, std::shared_ptr<buffer>> *buffers,
+      ResultElements elements, uint64_t rows, uint64_t ndim)
+      : readBuffers(buffers), elements(std::move(elements)), rowCount(rows),
+        ndim(ndim) {}
+
+  const buffer &columnBuffer(const std::string &column) const;
+
+  const std::unordered_map<std::string, std::shared_ptr<buffer>> *readBuffers =
+      nullptr;
+  ResultElements elements;
+  uint64_t rowCount = 0;
+  uint64_t ndim = 0;
+};
+
+/**
+ * Reads a subarray in global order batch by batch. Two sets of read buffers
+ * are used in turn, while the caller processes the batch in one set the next
+ * submission is already running asynchronously into the other.
+ *
+ * The stream uses the array's read buffers, only one stream per array may be
+ * open at a time.
+ */
+class ResultStream {
+public:
+  /**
+   * Open a stream and start fetching the first batch
+   * @param array array to read, the column projection applies
+   * @param subarray low/high pair for each dimension
+   */
+  ResultStream(Array &array, const std::vector<uint64_t> &subarray);
+
+  /**
+   * Waits for a submission still in flight
+   */
+  ~ResultStream();
+
+  ResultStream(const ResultStream &) = delete;
+  ResultStream &operator=(const ResultStream &) = delete;
+
+  /**
+   * Advance to the next batch, waiting for it if it is still being fetched.
+   * The previous batch is invalidated.
+   * @return false once all results have been returned or the read failed
+   */
+  bool next();
+
+  /**
+   * Current batch, valid after next() returned true
+   */
+  const ResultBatch &batch() const { return current; }
+
+  /**
+   * Rows returned so far
+   */
+  uint64_t rows() const { return rowsRead; }
+
+  /**
+   * Single pass iterator over the batches
+   */
+  class iterator {
+  public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef ResultBatch value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const ResultBatch *pointer;
+    typedef const ResultBatch &reference;
+
+    explicit iterator(ResultStream *stream = nullptr) : stream(stream) {}
+
+    reference operator*() const { return stream->batch(); }
+    pointer operator->() const { return &stream->batch(); }
+    iterator &operator++() {
+      if (!stream->next())
+        stream = nullptr;
+      return *this;
+    }
+    bool operator==(const iterator &other) const {
+      return stream == other.stream;
+    }
+    bool operator!=(const iterator &other) const { return !(*this == other); }
+
+  private:
+    ResultStream *stream;
+  };
+
+  /**
+   * Iterator at the current batch, fetching the first one on first use
+   */
+  iterator begin();
+  iterator end() { return iterator(); }
+
+private:
+  /**
+   * Submit the query asynchronously into the pending buffer set
+   */
+  void submit();
+
+  /**
+   * Wait for the submission in flight to complete or fail
+   * @return false if the query failed
+   */
+  bool wait();
+
+  Array &array;
+  std::unique_ptr<tiledb::Query> query;
+
+  // Buffer sets used in turn, pending is the one being fetched into
+  std::unordered_map<std::string, std::shared_ptr<buffer>> *bufferSets[2];
+  int pending = 0;
+
+  std::string countColumn;
+  uint64_t ndim = 0;
+
+  ResultBatch current;
+  uint64_t rowsRead = 0;
+  bool started = false;
+  bool hasBatch = false;
+  bool inFlight = false;
+
+  std::mutex completionMutex;
+  std::condition_variable completion;
+  bool completed = false;
+};
+
+template <typename T>
+ColumnSpan<T> ResultBatch::values(const std::string &column) const {
+  const buffer &buf = columnBuffer(column);
+  bool matches = dispatchDatatype(buf.datatype, [](auto type) {
+    return std::is_same<decltype(type), T>::value;
+  });
+  if (!matches)
+    throw std::invalid_argument("Column " + column +
+                                " does not match the requested type");
+  return ColumnSpan<T>(
+      std::static_pointer_cast<std::vector<T>>(buf.values)->data(),
+      elements.at(column).second);
+}
+
+template <typename T>
+ColumnSpan<T> ResultBatch::cell(const std::string &column,
+                                uint64_t row) const {
+  ColumnSpan<T> all = values<T>(column);
+  ColumnSpan<uint64_t> cellOffsets = offsets(column);
+  uint64_t begin = cellOffsets[row] / sizeof(T);
+  uint64_t end = row + 1 == cellOffsets.size()
+                     ? all.size()
+                     : cellOffsets[row + 1] / sizeof(T);
+  return ColumnSpan<T>(all.data() + begin, end - begin);
+}
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_RESULTSTREAM_H
@@ -0,0 +1,508 @@
+/**
+ * @file  Sketch.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Mergeable t-digest quantile sketches of prices and sizes per symbol and day,
+ * accumulated while loading and merged over date ranges to answer quantiles
+ *
+ */
+
+#include "Sketch.h"
+#include "ResultStream.h"
+#include "Trace.h"
+#include "utils.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <tuple>
+
+static const uint64_t nanosecondsPerDay = 86400000000000;
+
+// Centroids of a digest are never more than a few times its compression
+static const uint64_t maxCentroids = 65535;
+
+// Stored digests are read back in blocks of this many symbol ids, the symbol
+// tile extent
+static const uint64_t symbolTile = 100;
+
+const std::vector<std::string> &nyse::sketchColumns() {
+  static const std::vector<std::string> names = {
+      "Trade_Price", "Trade_Volume", "Bid_Price", "Bid_Size",
+      "Offer_Price", "Offer_Size",   "spread"};
+  return names;
+}
+
+bool nyse::parseSketchColumn(const std::string &name, SketchColumn &column) {
+  const std::vector<std::string> &names = sketchColumns();
+  auto found = std::find(names.begin(), names.end(), name);
+  if (found == names.end())
+    return false;
+  column = static_cast<SketchColumn>(found - names.begin());
+  return true;
+}
+
+void nyse::TDigest::add(double value, double weight) {
+  if (std::isnan(value) || weight <= 0)
+    return;
+  addCentroid(Centroid{value, weight}, value, value);
+}
+
+void nyse::TDigest::addCentroid(const Centroid &centroid, double min,
+                                double max) {
+  if (empty()) {
+    minValue = min;
+    maxValue = max;
+  } else {
+    minValue = std::min(minValue, min);
+    maxValue = std::max(maxValue, max);
+  }
+  pending.push_back(centroid);
+  pendingWeight += centroid.weight;
+  // Values are buffered so sorting is amortized over many of them
+  if (pending.size() >= 5 * compression)
+    compress();
+}
+
+void nyse::TDigest::merge(const TDigest &other) {
+  if (other.empty())
+    return;
+  if (empty()) {
+    minValue = other.minValue;
+    maxValue = other.maxValue;
+  } else {
+    minValue = std::min(minValue, other.minValue);
+    maxValue = std::max(maxValue, other.maxValue);
+  }
+  pending.insert(pending.end(), other.merged.begin(), other.merged.end());
+  pending.insert(pending.end(), other.pending.begin(), other.pending.end());
+  pendingWeight += other.count();
+  if (pending.size() >= 5 * compression)
+    compress();
+}
+
+void nyse::TDigest::compress() {
+  if (pending.empty())
+    return;
+  pending.insert(pending.end(), merged.begin(), merged.end());
+  std::sort(pending.begin(), pending.end(),
+            [](const Centroid &a, const Centroid &b) {
+              return a.mean < b.mean;
+            });
+  double total = totalWeight + pendingWeight;
+
+  // Arcsine scale function, a centroid spans at most one unit of k
+  double normalizer = compression / (2 * M_PI);
+  auto k = [&](double q) { return normalizer * std::asin(2 * q - 1); };
+  auto kInverse = [&](double k) {
+    return (std::sin(k / normalizer) + 1) / 2;
+  };
+
+  merged.clear();
+  Centroid current = pending.front();
+  double weightSoFar = 0;
+  double limit = total * kInverse(k(0) + 1);
+  for (size_t i = 1; i < pending.size(); i++) {
+    const Centroid &next = pending[i];
+    if (weightSoFar + current.weight + next.weight <= limit) {
+      current.weight += next.weight;
+      current.mean += (next.mean - current.mean) * next.weight / current.weight;
+    } else {
+      weightSoFar += current.weight;
+      merged.push_back(current);
+      limit = total * kInverse(k(std::min(weightSoFar / total, 1.0)) + 1);
+      current = next;
+    }
+  }
+  merged.push_back(current);
+  pending.clear();
+  totalWeight = total;
+  pendingWeight = 0;
+}
+
+const std::vector<nyse::Centroid> &nyse::TDigest::centroids() {
+  compress();
+  return merged;
+}
+
+double nyse::TDigest::quantile(double q) {
+  compress();
+  if (merged.empty())
+    return std::numeric_limits<double>::quiet_NaN();
+  q = std::min(std::max(q, 0.0), 1.0);
+  double target = q * totalWeight;
+
+  // Interpolate between centroid centers, the tails between the extreme
+  // centroids and the minimum and maximum
+  const Centroid &first = merged.front();
+  if (target <= first.weight / 2)
+    return minValue + (first.mean - minValue) * target / (first.weight / 2);
+  double cumulative = first.weight / 2;
+  for (size_t i = 0; i + 1 < merged.size(); i++) {
+    double gap = (merged[i].weight + merged[i + 1].weight) / 2;
+    if (target <= cumulative + gap)
+      return merged[i].mean +
+             (merged[i + 1].mean - merged[i].mean) * (target - cumulative) /
+                 gap;
+    cumulative += gap;
+  }
+  const Centroid &last = merged.back();
+  return last.mean + (maxValue - last.mean) *
+                         std::min(1.0, (target - cumulative) /
+                                           (last.weight / 2));
+}
+
+nyse::TDigest &nyse::SketchSet::digest(uint64_t symbolId, uint64_t day,
+                                       SketchColumn column) {
+  if (symbolId >= bySymbol.size())
+    bySymbol.resize(symbolId + 1);
+  SymbolSketches &symbol = bySymbol[symbolId];
+  if (symbol.days.empty()) {
+    symbol.first = day;
+    symbol.days.resize(1);
+  } else if (day < symbol.first) {
+    symbol.days.insert(symbol.days.begin(), symbol.first - day,
+                       DaySketches());
+    symbol.first = day;
+  } else if (day - symbol.first >= symbol.days.size()) {
+    symbol.days.resize(day - symbol.first + 1);
+  }
+  DaySketches &sketches = symbol.days[day - symbol.first];
+  if (sketches.columns.empty())
+    sketches.columns.resize(sketchColumns().size());
+  return sketches.columns[static_cast<int>(column)];
+}
+
+void nyse::SketchSet::merge(const SketchSet &other) {
+  const std::vector<SymbolSketches> &symbols = other.symbols();
+  for (uint64_t symbolId = 0; symbolId < symbols.size(); symbolId++) {
+    const SymbolSketches &symbol = symbols[symbolId];
+    for (uint64_t i = 0; i < symbol.days.size(); i++) {
+      const std::vector<TDigest> &columns = symbol.days[i].columns;
+      for (size_t c = 0; c < columns.size(); c++) {
+        if (!columns[c].empty())
+          digest(symbolId, symbol.first + i, static_cast<SketchColumn>(c))
+              .merge(columns[c]);
+      }
+    }
+  }
+}
+
+nyse::Sketches::Sketches(std::string array_name) {
+  this->array_uri = std::move(array_name);
+  this->ctx = std::make_shared<tiledb::Context>();
+  this->type = FileType::Sketch;
+  this->origin = "Sketches are computed by Quote and Trade loads with --sketch";
+}
+
+void nyse::Sketches::createArray(tiledb::FilterList coordinate_filter_list,
+                                 tiledb::FilterList offset_filter_list,
+                                 tiledb::FilterList attribute_filter_list) {
+  // If the array already exists on disk, return immediately.
+  if (tiledb::Object::object(*ctx, array_uri).type() ==
+      tiledb::Object::Type::Array)
+    return;
+
+  uint64_t maxDay = std::numeric_limits<uint64_t>::max() / nanosecondsPerDay;
+
+  tiledb::Domain domain(*ctx);
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(*ctx, "symbol_id",
+                                                           {{0, 10000}}, 100));
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(
+      *ctx, "day", {{0, maxDay - 366}}, 366));
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(
+      *ctx, "column", {{0, 63}}, 64));
+  // Id of the loaded file the values were parsed from
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(
+      *ctx, "source", {{0, UINT64_MAX - 1}}, UINT64_MAX));
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(
+      *ctx, "centroid", {{0, maxCentroids}}, maxCentroids + 1));
+
+  tiledb::ArraySchema schema(*ctx, TILEDB_SPARSE);
+  schema.set_domain(domain).set_order({{TILEDB_ROW_MAJOR, TILEDB_ROW_MAJOR}});
+
+  if (coordinate_filter_list.nfilters() > 0) {
+    schema.set_coords_filter_list(coordinate_filter_list);
+  }
+
+  if (offset_filter_list.nfilters() > 0) {
+    schema.set_offsets_filter_list(offset_filter_list);
+  }
+
+  schema.set_capacity(1000000);
+
+  // Set compression filter to ZSTD if not already set
+  if (attribute_filter_list.nfilters() == 0) {
+    tiledb::Filter compressor(*ctx, TILEDB_FILTER_ZSTD);
+    attribute_filter_list.add_filter(compressor);
+  }
+
+  // The digest's minimum and maximum are repeated on each of its centroids
+  for (const char *name : {"mean", "weight", "min", "max"})
+    schema.add_attribute(tiledb::Attribute::create<double>(*ctx, name)
+                             .set_filter_list(attribute_filter_list));
+
+  // Create the (empty) array on disk.
+  tiledb::Array::create(array_uri, schema);
+}
+
+void nyse::Sketches::rowsParsed(
+    uint64_t source, const std::vector<tiledb::Dimension> &dimensions,
+    const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers) {
+  auto coords = buffers.find(TILEDB_COORDS);
+  if (coords == buffers.end())
+    return;
+  uint64_t ndim = dimensions.size();
+  const std::vector<uint64_t> &coordValues =
+      *std::static_pointer_cast<std::vector<uint64_t>>(coords->second->values);
+  uint64_t rows = coordValues.size() / ndim;
+  if (rows == 0)
+    return;
+  uint64_t symbolIndex = dimensionIndex(dimensions, "symbol_id");
+  uint64_t datetimeIndex = dimensionIndex(dimensions, "datetime");
+
+  // Accumulated locally and merged once so workers rarely contend
+  SketchSet workerSketches;
+  auto digest = [&](uint64_t row, SketchColumn column) -> TDigest & {
+    return workerSketches.digest(
+        coordValues[row * ndim + symbolIndex],
+        exchange_day(coordValues[row * ndim + datetimeIndex]), column);
+  };
+
+  // Columns missing from this array are skipped
+  for (SketchColumn column : selected) {
+    if (column == SketchColumn::Spread) {
+      auto bid = buffers.find("Bid_Price");
+      auto offer = buffers.find("Offer_Price");
+      if (bid == buffers.end() || offer == buffers.end())
+        continue;
+      const std::vector<float> &bidPrices =
+          *std::static_pointer_cast<std::vector<float>>(bid->second->values);
+      const std::vector<float> &offerPrices =
+          *std::static_pointer_cast<std::vector<float>>(
+              offer->second->values);
+      if (bidPrices.size() != rows || offerPrices.size() != rows)
+        continue;
+      for (uint64_t i = 0; i < rows; i++) {
+        if (bidPrices[i] > 0 && offerPrices[i] > 0)
+          digest(i, column).add(double(offerPrices[i]) - bidPrices[i]);
+      }
+      continue;
+    }
+
+    auto values = buffers.find(sketchColumns()[static_cast<int>(column)]);
+    if (values == buffers.end() || values->second->offsets != nullptr)
+      continue;
+    dispatchDatatype(values->second->datatype, [&](auto type) {
+      using T = decltype(type);
+      const std::vector<T> &columnValues =
+          *std::static_pointer_cast<std::vector<T>>(values->second->values);
+      if (columnValues.size() != rows)
+        return 0;
+      for (uint64_t i = 0; i < rows; i++)
+        digest(i, column).add(double(columnValues[i]));
+      return 0;
+    });
+  }
+  merge(source, workerSketches);
+}
+
+void nyse::Sketches::merge(uint64_t source, const SketchSet &sketches) {
+  std::lock_guard<std::mutex> lock(sketchesMutex);
+  accumulated[source].merge(sketches);
+}
+
+uint64_t nyse::Sketches::writeParsed() {
+  std::lock_guard<std::mutex> lock(sketchesMutex);
+
+  // A file loaded again replaces its digests, which can have fewer centroids
+  // than the stored ones, so the stored centroid count of each digest of the
+  // loaded files is kept to blank the rest
+  std::map<std::tuple<uint64_t, uint64_t, uint64_t, uint64_t>, uint64_t>
+      storedCentroids;
+  std::vector<std::pair<uint64_t, uint64_t>> domain = nonEmptyDomain();
+  for (const auto &entry : accumulated) {
+    uint64_t source = entry.first;
+    if (domain.size() < 5 || source < domain[3].first ||
+        source > domain[3].second)
+      continue;
+    const std::vector<SymbolSketches> &symbols = entry.second.symbols();
+    for (uint64_t blockStart = 0; blockStart < symbols.size();
+         blockStart += symbolTile) {
+      uint64_t blockEnd =
+          std::min<uint64_t>(blockStart + symbolTile, symbols.size());
+      uint64_t firstSymbol = std::numeric_limits<uint64_t>::max();
+      uint64_t lastSymbol = 0;
+      uint64_t firstDay = std::numeric_limits<uint64_t>::max();
+      uint64_t lastDay = 0;
+      for (uint64_t s = blockStart; s < blockEnd; s++) {
+        if (symbols[s].days.empty())
+          continue;
+        firstSymbol = std::min(firstSymbol, s);
+        lastSymbol = s;
+        firstDay = std::min(firstDay, symbols[s].first);
+        lastDay =
+            std::max(lastDay, symbols[s].first + symbols[s].days.size() - 1);
+      }
+      firstSymbol = std::max(firstSymbol, domain[0].first);
+      lastSymbol = std::min(lastSymbol, domain[0].second);
+      firstDay = std::max(firstDay, domain[1].first);
+      lastDay = std::min(lastDay, domain[1].second);
+      if (firstSymbol > lastSymbol || firstDay > lastDay)
+        continue;
+
+      std::vector<uint64_t> subarray = {
+          firstSymbol,     lastSymbol,       firstDay, lastDay,
+          domain[2].first, domain[2].second, source,   source,
+          domain[4].first, domain[4].second};
+      ResultStream stream(*this, subarray);
+      for (const ResultBatch &batch : stream) {
+        ColumnSpan<uint64_t> coordinates = batch.coordinates<uint64_t>();
+        uint64_t ndim = batch.dimensions();
+        for (uint64_t i = 0; i < batch.rows(); i++) {
+          const uint64_t *cell = &coordinates[i * ndim];
+          uint64_t &count = storedCentroids[std::make_tuple(
+              cell[0], cell[1], cell[2], cell[3])];
+          count = std::max(count, cell[4] + 1);
+        }
+      }
+    }
+  }
+
+  query.reset(nullptr);
+  array = std::make_unique<tiledb::Array>(*ctx, array_uri,
+                                          tiledb_query_type_t::TILEDB_WRITE);
+  openedForRead = false;
+
+  auto coords = std::make_shared<std::vector<uint64_t>>();
+  auto mean = std::make_shared<std::vector<double>>();
+  auto weight = std::make_shared<std::vector<double>>();
+  auto min = std::make_shared<std::vector<double>>();
+  auto max = std::make_shared<std::vector<double>>();
+  std::unordered_map<std::string, std::shared_ptr<buffer>> buffers;
+  buffers.emplace(TILEDB_COORDS, std::make_shared<buffer>(
+                                     buffer{nullptr, coords, TILEDB_UINT64}));
+  buffers.emplace("mean", std::make_shared<buffer>(
+                              buffer{nullptr, mean, TILEDB_FLOAT64}));
+  buffers.emplace("weight", std::make_shared<buffer>(
+                                buffer{nullptr, weight, TILEDB_FLOAT64}));
+  buffers.emplace("min", std::make_shared<buffer>(
+                             buffer{nullptr, min, TILEDB_FLOAT64}));
+  buffers.emplace("max", std::make_shared<buffer>(
+                             buffer{nullptr, max, TILEDB_FLOAT64}));
+
+  auto flush = [&]() {
+    writeFragment(buffers);
+    coords->clear();
+    mean->clear();
+    weight->clear();
+    min->clear();
+    max->clear();
+  };
+
+  uint64_t written = 0;
+  for (auto &entry : accumulated) {
+    uint64_t source = entry.first;
+    std::vector<SymbolSketches> &symbols = entry.second.symbols();
+    for (uint64_t symbolId = 0; symbolId < symbols.size(); symbolId++) {
+      SymbolSketches &symbol = symbols[symbolId];
+      for (uint64_t i = 0; i < symbol.days.size(); i++) {
+        uint64_t day = symbol.first + i;
+        std::vector<TDigest> &columns = symbol.days[i].columns;
+        for (uint64_t c = 0; c < columns.size(); c++) {
+          TDigest &digest = columns[c];
+          if (digest.empty())
+            continue;
+          const std::vector<Centroid> &centroids = digest.centroids();
+          for (uint64_t n = 0; n < centroids.size() && n <= maxCentroids;
+               n++) {
+            coords->insert(coords->end(), {symbolId, day, c, source, n});
+            mean->push_back(centroids[n].mean);
+            weight->push_back(centroids[n].weight);
+            min->push_back(digest.min());
+            max->push_back(digest.max());
+          }
+          auto stored =
+              storedCentroids.find(std::make_tuple(symbolId, day, c, source));
+          if (stored != storedCentroids.end()) {
+            for (uint64_t n = centroids.size(); n < stored->second; n++) {
+              coords->insert(coords->end(), {symbolId, day, c, source, n});
+              mean->push_back(0);
+              weight->push_back(0);
+              min->push_back(digest.min());
+              max->push_back(digest.max());
+            }
+          }
+          written++;
+        }
+      }
+      if (mean->size() >= (1 << 22))
+        flush();
+    }
+  }
+  flush();
+
+  array->close();
+  array.reset(nullptr);
+  return written;
+}
+
+nyse::TDigest nyse::Sketches::digest(uint64_t symbolId, SketchColumn column,
+                                     uint64_t start, uint64_t end) {
+  TDigest result;
+  std::vector<std::pair<uint64_t, uint64_t>> domain = nonEmptyDomain();
+  uint64_t columnId = static_cast<uint64_t>(column);
+  if (domain.size() < 5 || symbolId < domain[0].first ||
+      symbolId > domain[0].second || columnId < domain[2].first ||
+      columnId > domain[2].second)
+    return result;
+  uint64_t firstDay = std::max(exchange_day(start), domain[1].first);
+  uint64_t lastDay = std::min(exchange_day(end), domain[1].second);
+  if (firstDay > lastDay)
+    return result;
+
+  // Digests of all source files are merged
+  std::vector<uint64_t> subarray = {
+      symbolId,        symbolId,        firstDay,        lastDay,
+      columnId,        columnId,        domain[3].first, domain[3].second,
+      domain[4].first, domain[4].second};
+  ResultStream stream(*this, subarray);
+  for (const ResultBatch &batch : stream) {
+    ColumnSpan<double> mean = batch.values<double>("mean");
+    ColumnSpan<double> weight = batch.values<double>("weight");
+    ColumnSpan<double> min = batch.values<double>("min");
+    ColumnSpan<double> max = batch.values<double>("max");
+    for (uint64_t i = 0; i < batch.rows(); i++) {
+      // Centroids past the end of a digest rewritten shorter have no weight
+      if (weight[i] > 0)
+        result.addCentroid(Centroid{mean[i], weight[i]}, min[i], max[i]);
+    }
+  }
+  return result;
+}
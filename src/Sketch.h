@@ -0,0 +1,262 @@
+/**
+ * @file  Sketch.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Mergeable t-digest quantile sketches of prices and sizes per symbol and day,
+ * accumulated while loading and merged over date ranges to answer quantiles
+ *
+ */
+
+#ifndef NYSE_INGESTOR_SKETCH_H
+#define NYSE_INGESTOR_SKETCH_H
+
+#include "Array.h"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * Columns which can be sketched. The position in sketchColumns() is the
+ * column coordinate of the sketch array so it must not change.
+ */
+enum class SketchColumn : int {
+  TradePrice,
+  TradeVolume,
+  BidPrice,
+  BidSize,
+  OfferPrice,
+  OfferSize,
+  // Offer_Price - Bid_Price of two sided quotes
+  Spread
+};
+
+/**
+ * Names of all sketch columns, in SketchColumn order
+ */
+const std::vector<std::string> &sketchColumns();
+
+/**
+ * Parse a sketch column name
+ * @param name
+ * @param column set on success
+ * @return false if the name is unknown
+ */
+bool parseSketchColumn(const std::string &name, SketchColumn &column);
+
+/**
+ * Weighted mean of a cluster of values
+ */
+struct Centroid {
+  double mean;
+  double weight;
+};
+
+/**
+ * Merging t-digest. Values are buffered and merged into centroids whose size
+ * is bounded by the arcsine scale function, so quantiles near 0 and 1 are the
+ * most accurate. Digests merge without loss beyond their own error, which
+ * lets per day digests be combined over any range of days.
+ */
+class TDigest {
+public:
+  /**
+   * @param compression bounds the number of centroids to about this many
+   */
+  explicit TDigest(double compression = 100) : compression(compression) {}
+
+  /**
+   * Add a value, NaN is ignored
+   * @param value
+   * @param weight
+   */
+  void add(double value, double weight = 1);
+
+  /**
+   * Add all values of another digest
+   * @param other
+   */
+  void merge(const TDigest &other);
+
+  /**
+   * Add a centroid of a stored digest
+   * @param centroid
+   * @param min smallest value of the stored digest
+   * @param max largest value of the stored digest
+   */
+  void addCentroid(const Centroid &centroid, double min, double max);
+
+  /**
+   * Approximate quantile
+   * @param q in [0, 1]
+   * @return value, NaN if the digest is empty
+   */
+  double quantile(double q);
+
+  /**
+   * Centroids in order of their means, merging buffered values first
+   */
+  const std::vector<Centroid> &centroids();
+
+  double count() const { return totalWeight + pendingWeight; }
+  double min() const { return minValue; }
+  double max() const { return maxValue; }
+  bool empty() const { return count() == 0; }
+
+private:
+  /**
+   * Merge buffered values and centroids into a new set of centroids
+   */
+  void compress();
+
+  double compression;
+  std::vector<Centroid> merged;
+  std::vector<Centroid> pending;
+  double totalWeight = 0;
+  double pendingWeight = 0;
+  double minValue = 0;
+  double maxValue = 0;
+};
+
+/**
+ * Digests of all sketch columns of one symbol in one day
+ */
+struct DaySketches {
+  std::vector<TDigest> columns;
+};
+
+/**
+ * Digests of one symbol, contiguous from day index first
+ */
+struct SymbolSketches {
+  uint64_t first = 0;
+  std::vector<DaySketches> days;
+};
+
+/**
+ * Digests of all symbols, indexed directly by symbol_id and day index
+ * (exchange_day(datetime)) so adding a value does no hashing
+ */
+class SketchSet {
+public:
+  /**
+   * Digest of a column of a symbol and day, created as needed
+   * @param symbolId
+   * @param day day index
+   * @param column
+   * @return digest
+   */
+  TDigest &digest(uint64_t symbolId, uint64_t day, SketchColumn column);
+
+  /**
+   * Combine the digests of another set into this one
+   * @param other
+   */
+  void merge(const SketchSet &other);
+
+  const std::vector<SymbolSketches> &symbols() const { return bySymbol; }
+  std::vector<SymbolSketches> &symbols() { return bySymbol; }
+
+private:
+  std::vector<SymbolSketches> bySymbol;
+};
+
+/**
+ * Sparse array of digest centroids with dimensions symbol_id, day, column,
+ * source and centroid. Digests are written by Quote and Trade loads, one per
+ * symbol, day, sketched column and loaded file, and merged over files and date
+ * ranges to answer quantiles without reading the data. A file loaded again
+ * replaces its digests, centroids beyond the end of a rewritten digest are
+ * kept with zero weight.
+ */
+class Sketches : public DerivedArray {
+public:
+  explicit Sketches(std::string array_name);
+
+  /**
+   * Create sketch array
+   */
+  void createArray(tiledb::FilterList coordinate_filter_list,
+                   tiledb::FilterList offset_filter_list,
+                   tiledb::FilterList attribute_filter_list) override;
+
+  /**
+   * Columns sketched by loads
+   * @param columns
+   */
+  void setSketchColumns(const std::vector<SketchColumn> &columns) {
+    selected = columns;
+  }
+  const std::vector<SketchColumn> &sketchedColumns() const { return selected; }
+
+  /**
+   * Add the values of the sketched columns parsed by a load worker to their
+   * digests, columns missing from the loaded array are skipped
+   */
+  void rowsParsed(uint64_t source,
+                  const std::vector<tiledb::Dimension> &dimensions,
+                  const std::unordered_map<std::string, std::shared_ptr<buffer>>
+                      &buffers) override;
+
+  /**
+   * Add digests accumulated by a load worker, safe to call concurrently
+   * @param source id of the file sketched
+   * @param sketches
+   */
+  void merge(uint64_t source, const SketchSet &sketches);
+
+  /**
+   * Write all accumulated digests, replacing those stored for the same files
+   * @return digests written
+   */
+  uint64_t writeParsed() override;
+
+  std::string contents() const override { return "quantile sketches"; }
+
+  /**
+   * Merge the stored digests of a symbol and column over a time range
+   * @param symbolId
+   * @param column
+   * @param start first datetime in nanoseconds since epoch (inclusive)
+   * @param end last datetime in nanoseconds since epoch (inclusive)
+   * @return digest of all days in the range
+   */
+  TDigest digest(uint64_t symbolId, SketchColumn column, uint64_t start,
+                 uint64_t end);
+
+private:
+  std::mutex sketchesMutex;
+  std::map<uint64_t, SketchSet> accumulated;
+  std::vector<SketchColumn> selected;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_SKETCH_H
@@ -0,0 +1,71 @@
+/**
+ * @file  Stats.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Stage timings and TileDB statistics capture for ingestion and reads
+ *
+ */
+
+#include "Stats.h"
+#include <tiledb/tiledb>
+
+void nyse::StageTimings::add(const std::string &stage,
+                             std::chrono::nanoseconds duration) {
+  for (auto &entry : stages) {
+    if (entry.first == stage) {
+      entry.second += duration;
+      return;
+    }
+  }
+  stages.emplace_back(stage, duration);
+}
+
+void nyse::StageTimings::print(FILE *out) const {
+  fprintf(out, "stage timings:\n");
+  for (const auto &entry : stages) {
+    fprintf(out, "  %-12s %.3f seconds\n", entry.first.c_str(),
+            std::chrono::duration<double>(entry.second).count());
+  }
+}
+
+nyse::TileDBStatsScope::TileDBStatsScope(bool enabled, std::string label)
+    : enabled(enabled), label(std::move(label)) {
+  if (!this->enabled)
+    return;
+  tiledb::Stats::reset();
+  tiledb::Stats::enable();
+}
+
+nyse::TileDBStatsScope::~TileDBStatsScope() {
+  if (!enabled)
+    return;
+  tiledb::Stats::disable();
+  fprintf(stdout, "==== TileDB stats: %s ====\n", label.c_str());
+  tiledb::Stats::dump(stdout);
+  tiledb::Stats::reset();
+}
@@ -0,0 +1,92 @@
+/**
+ * @file  Stats.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Stage timings and TileDB statistics capture for ingestion and reads
+ *
+ */
+
+#ifndef NYSE_INGESTOR_STATS_H
+#define NYSE_INGESTOR_STATS_H
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * Collects wall clock durations of the named stages of a load or read so they
+ * can be reported together at the end
+ */
+class StageTimings {
+public:
+  /**
+   * Record the duration of a stage, repeated stages are accumulated
+   * @param stage name of stage
+   * @param duration
+   */
+  void add(const std::string &stage, std::chrono::nanoseconds duration);
+
+  /**
+   * Print all recorded stages in the order they were first added
+   * @param out file to print to
+   */
+  void print(FILE *out = stdout) const;
+
+private:
+  std::vector<std::pair<std::string, std::chrono::nanoseconds>> stages;
+};
+
+/**
+ * Scoped capture of TileDB internal statistics. While in scope TileDB stats
+ * collection is enabled, on destruction the collected counters are dumped
+ * under the given label and reset so each phase is reported separately.
+ */
+class TileDBStatsScope {
+public:
+  /**
+   * @param enabled if false this scope does nothing
+   * @param label printed before the dumped statistics
+   */
+  TileDBStatsScope(bool enabled, std::string label);
+
+  ~TileDBStatsScope();
+
+  TileDBStatsScope(const TileDBStatsScope &) = delete;
+  TileDBStatsScope &operator=(const TileDBStatsScope &) = delete;
+
+private:
+  bool enabled;
+  std::string label;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_STATS_H
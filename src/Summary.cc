@@ -0,0 +1,363 @@
+/**
+ * @file  Summary.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Per symbol and day summary of loaded rows, accumulated while parsing and
+ * written to a small sparse index array
+ *
+ */
+
+#include "Summary.h"
+#include "ResultStream.h"
+#include "Trace.h"
+#include "utils.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+static const uint64_t nanosecondsPerDay = 86400000000000;
+
+static const char *const summaryColumns[] = {
+    "rows", "first_datetime", "last_datetime", "first_sequence",
+    "last_sequence", "bytes"};
+
+void nyse::DaySummary::merge(const DaySummary &other) {
+  if (other.rows == 0)
+    return;
+  if (rows == 0) {
+    *this = other;
+    return;
+  }
+  // Rows at the same time are ordered by Sequence_Number
+  if (other.firstDatetime < firstDatetime ||
+      (other.firstDatetime == firstDatetime &&
+       other.firstSequence < firstSequence)) {
+    firstDatetime = other.firstDatetime;
+    firstSequence = other.firstSequence;
+  }
+  if (other.lastDatetime > lastDatetime ||
+      (other.lastDatetime == lastDatetime &&
+       other.lastSequence > lastSequence)) {
+    lastDatetime = other.lastDatetime;
+    lastSequence = other.lastSequence;
+  }
+  rows += other.rows;
+  bytes += other.bytes;
+}
+
+nyse::DaySummary &nyse::SummarySet::day(uint64_t symbolId, uint64_t index) {
+  if (symbolId >= bySymbol.size())
+    bySymbol.resize(symbolId + 1);
+  SymbolDays &symbol = bySymbol[symbolId];
+  if (symbol.days.empty()) {
+    symbol.first = index;
+    symbol.days.resize(1);
+  } else if (index < symbol.first) {
+    symbol.days.insert(symbol.days.begin(), symbol.first - index,
+                       DaySummary());
+    symbol.first = index;
+  } else if (index - symbol.first >= symbol.days.size()) {
+    symbol.days.resize(index - symbol.first + 1);
+  }
+  return symbol.days[index - symbol.first];
+}
+
+void nyse::SummarySet::add(uint64_t symbolId, uint64_t datetime,
+                           uint64_t sequence, uint64_t bytes) {
+  DaySummary &summary = day(symbolId, exchange_day(datetime));
+  if (summary.rows == 0) {
+    summary.firstDatetime = summary.lastDatetime = datetime;
+    summary.firstSequence = summary.lastSequence = sequence;
+  } else {
+    if (datetime < summary.firstDatetime ||
+        (datetime == summary.firstDatetime &&
+         sequence < summary.firstSequence)) {
+      summary.firstDatetime = datetime;
+      summary.firstSequence = sequence;
+    }
+    if (datetime > summary.lastDatetime ||
+        (datetime == summary.lastDatetime &&
+         sequence > summary.lastSequence)) {
+      summary.lastDatetime = datetime;
+      summary.lastSequence = sequence;
+    }
+  }
+  summary.rows++;
+  summary.bytes += bytes;
+}
+
+void nyse::SummarySet::merge(const SummarySet &other) {
+  const std::vector<SymbolDays> &symbols = other.symbols();
+  for (uint64_t symbolId = 0; symbolId < symbols.size(); symbolId++) {
+    const SymbolDays &symbol = symbols[symbolId];
+    for (uint64_t i = 0; i < symbol.days.size(); i++) {
+      if (symbol.days[i].rows > 0)
+        day(symbolId, symbol.first + i).merge(symbol.days[i]);
+    }
+  }
+}
+
+nyse::Summary::Summary(std::string array_name) {
+  this->array_uri = std::move(array_name);
+  this->ctx = std::make_shared<tiledb::Context>();
+  this->type = FileType::Summary;
+  this->origin = "Summaries are computed by Quote and Trade loads with "
+                 "--summary";
+}
+
+void nyse::Summary::createArray(tiledb::FilterList coordinate_filter_list,
+                                tiledb::FilterList offset_filter_list,
+                                tiledb::FilterList attribute_filter_list) {
+  // If the array already exists on disk, return immediately.
+  if (tiledb::Object::object(*ctx, array_uri).type() ==
+      tiledb::Object::Type::Array)
+    return;
+
+  // A year of days per tile
+  uint64_t daysPerTile = 366;
+  uint64_t maxDay = std::numeric_limits<uint64_t>::max() / nanosecondsPerDay;
+
+  tiledb::Domain domain(*ctx);
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(*ctx, "symbol_id",
+                                                           {{0, 10000}}, 100));
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(
+      *ctx, "day", {{0, maxDay - daysPerTile}}, daysPerTile));
+  // Id of the loaded file the rows were parsed from
+  domain.add_dimension(tiledb::Dimension::create<uint64_t>(
+      *ctx, "source", {{0, UINT64_MAX - 1}}, UINT64_MAX));
+
+  tiledb::ArraySchema schema(*ctx, TILEDB_SPARSE);
+  schema.set_domain(domain).set_order({{TILEDB_ROW_MAJOR, TILEDB_ROW_MAJOR}});
+
+  if (coordinate_filter_list.nfilters() > 0) {
+    schema.set_coords_filter_list(coordinate_filter_list);
+  }
+
+  if (offset_filter_list.nfilters() > 0) {
+    schema.set_offsets_filter_list(offset_filter_list);
+  }
+
+  schema.set_capacity(100000);
+
+  // Set compression filter to ZSTD if not already set
+  if (attribute_filter_list.nfilters() == 0) {
+    tiledb::Filter compressor(*ctx, TILEDB_FILTER_ZSTD);
+    attribute_filter_list.add_filter(compressor);
+  }
+
+  for (const char *name : summaryColumns)
+    schema.add_attribute(tiledb::Attribute::create<uint64_t>(*ctx, name)
+                             .set_filter_list(attribute_filter_list));
+
+  // Create the (empty) array on disk.
+  tiledb::Array::create(array_uri, schema);
+}
+
+void nyse::Summary::rowsParsed(
+    uint64_t source, const std::vector<tiledb::Dimension> &dimensions,
+    const std::unordered_map<std::string, std::shared_ptr<buffer>> &buffers) {
+  auto coords = buffers.find(TILEDB_COORDS);
+  if (coords == buffers.end())
+    return;
+  uint64_t ndim = dimensions.size();
+  const std::vector<uint64_t> &coordValues =
+      *std::static_pointer_cast<std::vector<uint64_t>>(coords->second->values);
+  uint64_t rows = coordValues.size() / ndim;
+  if (rows == 0)
+    return;
+  uint64_t symbolIndex = dimensionIndex(dimensions, "symbol_id");
+  uint64_t datetimeIndex = dimensionIndex(dimensions, "datetime");
+  uint64_t sequenceIndex = dimensionIndex(dimensions, "Sequence_Number");
+
+  // Uncompressed bytes of each row, fixed size columns are the same for every
+  // row and variable sized ones are taken from their offsets
+  std::vector<uint64_t> rowBytes(rows, ndim * sizeof(uint64_t));
+  for (const auto &entry : buffers) {
+    if (entry.first == TILEDB_COORDS || entry.second->values == nullptr)
+      continue;
+    const buffer &column = *entry.second;
+    dispatchDatatype(column.datatype, [&](auto type) {
+      using T = decltype(type);
+      uint64_t size =
+          std::static_pointer_cast<std::vector<T>>(column.values)->size();
+      if (column.offsets == nullptr) {
+        if (size != rows)
+          return 0;
+        for (uint64_t i = 0; i < rows; i++)
+          rowBytes[i] += sizeof(T);
+        return 0;
+      }
+      const std::vector<uint64_t> &offsets = *column.offsets;
+      if (offsets.size() != rows)
+        return 0;
+      for (uint64_t i = 0; i < rows; i++) {
+        uint64_t next = i + 1 < rows ? offsets[i + 1] : size;
+        rowBytes[i] += (next - offsets[i]) * sizeof(T) + sizeof(uint64_t);
+      }
+      return 0;
+    });
+  }
+
+  // Accumulated locally and merged once so workers rarely contend
+  SummarySet workerSummaries;
+  for (uint64_t i = 0; i < rows; i++)
+    workerSummaries.add(coordValues[i * ndim + symbolIndex],
+                        coordValues[i * ndim + datetimeIndex],
+                        coordValues[i * ndim + sequenceIndex], rowBytes[i]);
+  merge(source, workerSummaries);
+}
+
+void nyse::Summary::merge(uint64_t source, const SummarySet &summaries) {
+  std::lock_guard<std::mutex> lock(summariesMutex);
+  accumulated[source].merge(summaries);
+}
+
+uint64_t nyse::Summary::writeParsed() {
+  std::lock_guard<std::mutex> lock(summariesMutex);
+  query.reset(nullptr);
+  array = std::make_unique<tiledb::Array>(*ctx, array_uri,
+                                          tiledb_query_type_t::TILEDB_WRITE);
+  openedForRead = false;
+
+  std::vector<uint64_t> coords, rows, firstDatetime, lastDatetime,
+      firstSequence, lastSequence, bytes;
+  uint64_t written = 0;
+
+  // One write per loaded file. The cells of a file loaded again have the
+  // same coordinates as the stored ones and replace them.
+  for (const auto &entry : accumulated) {
+    uint64_t source = entry.first;
+    const std::vector<SymbolDays> &symbols = entry.second.symbols();
+    coords.clear();
+    rows.clear();
+    firstDatetime.clear();
+    lastDatetime.clear();
+    firstSequence.clear();
+    lastSequence.clear();
+    bytes.clear();
+    for (uint64_t s = 0; s < symbols.size(); s++) {
+      const SymbolDays &symbol = symbols[s];
+      for (uint64_t i = 0; i < symbol.days.size(); i++) {
+        const DaySummary &day = symbol.days[i];
+        if (day.rows == 0)
+          continue;
+        coords.insert(coords.end(), {s, symbol.first + i, source});
+        rows.push_back(day.rows);
+        firstDatetime.push_back(day.firstDatetime);
+        lastDatetime.push_back(day.lastDatetime);
+        firstSequence.push_back(day.firstSequence);
+        lastSequence.push_back(day.lastSequence);
+        bytes.push_back(day.bytes);
+      }
+    }
+
+    if (rows.empty())
+      continue;
+
+    TraceSpan span("submit", array_uri);
+    span.setRows(rows.size());
+    tiledb::Query sourceQuery(*ctx, *array);
+    sourceQuery.set_layout(tiledb_layout_t::TILEDB_UNORDERED);
+    sourceQuery.set_coordinates(coords)
+        .set_buffer("rows", rows)
+        .set_buffer("first_datetime", firstDatetime)
+        .set_buffer("last_datetime", lastDatetime)
+        .set_buffer("first_sequence", firstSequence)
+        .set_buffer("last_sequence", lastSequence)
+        .set_buffer("bytes", bytes);
+    if (sourceQuery.submit() == tiledb::Query::Status::FAILED) {
+      std::cerr << "Writing summaries of source " << source << " failed"
+                << std::endl;
+    } else {
+      written += rows.size();
+    }
+    sourceQuery.finalize();
+  }
+
+  array->close();
+  array.reset(nullptr);
+  return written;
+}
+
+std::vector<nyse::SymbolSummary> nyse::Summary::totals(uint64_t start,
+                                                       uint64_t end) {
+  std::vector<SymbolSummary> totals;
+  std::vector<std::pair<uint64_t, uint64_t>> domain = nonEmptyDomain();
+  if (domain.size() < 3)
+    return totals;
+  uint64_t firstDay = std::max(exchange_day(start), domain[1].first);
+  uint64_t lastDay = std::min(exchange_day(end), domain[1].second);
+  if (firstDay > lastDay)
+    return totals;
+
+  // Summed over the days and source files of each symbol
+  std::vector<SymbolSummary> bySymbol(domain[0].second - domain[0].first + 1);
+  std::vector<uint64_t> subarray = {domain[0].first, domain[0].second,
+                                    firstDay,        lastDay,
+                                    domain[2].first, domain[2].second};
+  ResultStream stream(*this, subarray);
+  for (const ResultBatch &batch : stream) {
+    ColumnSpan<uint64_t> coordinates = batch.coordinates<uint64_t>();
+    ColumnSpan<uint64_t> rows = batch.values<uint64_t>("rows");
+    ColumnSpan<uint64_t> bytes = batch.values<uint64_t>("bytes");
+    ColumnSpan<uint64_t> firstDatetime =
+        batch.values<uint64_t>("first_datetime");
+    ColumnSpan<uint64_t> lastDatetime = batch.values<uint64_t>("last_datetime");
+    uint64_t ndim = batch.dimensions();
+    for (uint64_t i = 0; i < batch.rows(); i++) {
+      if (rows[i] == 0)
+        continue;
+      SymbolSummary &total = bySymbol[coordinates[i * ndim] - domain[0].first];
+      if (total.rows == 0 || firstDatetime[i] < total.firstDatetime)
+        total.firstDatetime = firstDatetime[i];
+      total.lastDatetime = std::max(total.lastDatetime, lastDatetime[i]);
+      total.rows += rows[i];
+      total.bytes += bytes[i];
+    }
+  }
+
+  for (uint64_t i = 0; i < bySymbol.size(); i++) {
+    if (bySymbol[i].rows == 0)
+      continue;
+    bySymbol[i].symbolId = domain[0].first + i;
+    totals.push_back(bySymbol[i]);
+  }
+
+  std::stable_sort(totals.begin(), totals.end(),
+                   [](const SymbolSummary &a, const SymbolSummary &b) {
+                     return a.rows > b.rows;
+                   });
+  return totals;
+}
+
+std::vector<uint64_t> nyse::Summary::symbolSubarray(
+    uint64_t symbolId, uint64_t start, uint64_t end,
+    const std::vector<std::pair<uint64_t, uint64_t>> &nonEmptyDomain) {
+  return Array::symbolSubarray(symbolId, exchange_day(start),
+                               exchange_day(end), nonEmptyDomain);
+}
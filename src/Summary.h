@@ -0,0 +1,187 @@
+/**
+ * @file  Summary.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Per symbol and day summary of loaded rows, accumulated while parsing and
+ * written to a small sparse index array
+ *
+ */
+
+#ifndef NYSE_INGESTOR_SUMMARY_H
+#define NYSE_INGESTOR_SUMMARY_H
+
+#include "Array.h"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * Rows of one symbol in one day, rows is 0 for a day without data
+ */
+struct DaySummary {
+  uint64_t rows = 0;
+  uint64_t firstDatetime = 0;
+  uint64_t lastDatetime = 0;
+  uint64_t firstSequence = 0;
+  uint64_t lastSequence = 0;
+  // Uncompressed bytes of the coordinates and attributes
+  uint64_t bytes = 0;
+
+  /**
+   * Combine with the summary of other rows of the same day
+   * @param other
+   */
+  void merge(const DaySummary &other);
+};
+
+/**
+ * Days of one symbol, contiguous from day index first
+ */
+struct SymbolDays {
+  uint64_t first = 0;
+  std::vector<DaySummary> days;
+};
+
+/**
+ * Summaries of all symbols, indexed directly by symbol_id and day index
+ * (exchange_day(datetime)) so adding a row does no hashing
+ */
+class SummarySet {
+public:
+  /**
+   * Add a row to its day
+   * @param symbolId
+   * @param datetime nanoseconds since epoch
+   * @param sequence Sequence_Number
+   * @param bytes uncompressed size of the row
+   */
+  void add(uint64_t symbolId, uint64_t datetime, uint64_t sequence,
+           uint64_t bytes);
+
+  /**
+   * Combine the summaries of another set into this one
+   * @param other
+   */
+  void merge(const SummarySet &other);
+
+  const std::vector<SymbolDays> &symbols() const { return bySymbol; }
+
+private:
+  /**
+   * Day of a symbol, extending the symbol's range as needed
+   * @param symbolId
+   * @param index day index
+   * @return day
+   */
+  DaySummary &day(uint64_t symbolId, uint64_t index);
+
+  std::vector<SymbolDays> bySymbol;
+};
+
+/**
+ * Totals of a symbol over a range of days
+ */
+struct SymbolSummary {
+  uint64_t symbolId = 0;
+  uint64_t rows = 0;
+  uint64_t bytes = 0;
+  uint64_t firstDatetime = 0;
+  uint64_t lastDatetime = 0;
+};
+
+/**
+ * Sparse array of summaries with dimensions symbol_id, day and source, the day
+ * index being the exchange day of the rows and source the id of the loaded
+ * file. Summaries are written by Quote and Trade loads, reads and queries
+ * work like those of any other array with query time ranges mapped to days.
+ * Each file keeps its own summaries so one loaded again replaces them instead
+ * of being counted twice, totals add up the files of a symbol.
+ */
+class Summary : public DerivedArray {
+public:
+  explicit Summary(std::string array_name);
+
+  /**
+   * Create summary array
+   */
+  void createArray(tiledb::FilterList coordinate_filter_list,
+                   tiledb::FilterList offset_filter_list,
+                   tiledb::FilterList attribute_filter_list) override;
+
+  /**
+   * Summarize the rows parsed by a load worker
+   */
+  void rowsParsed(uint64_t source,
+                  const std::vector<tiledb::Dimension> &dimensions,
+                  const std::unordered_map<std::string, std::shared_ptr<buffer>>
+                      &buffers) override;
+
+  /**
+   * Add summaries accumulated by a load worker, safe to call concurrently
+   * @param source id of the file summarized
+   * @param summaries
+   */
+  void merge(uint64_t source, const SummarySet &summaries);
+
+  /**
+   * Write all accumulated summaries, one write of the symbol days with rows
+   * per loaded file
+   * @return symbol days with rows written
+   */
+  uint64_t writeParsed() override;
+
+  std::string contents() const override { return "symbol day summaries"; }
+
+  /**
+   * Total rows and bytes per symbol over a time range, read from the array
+   * @param start first datetime in nanoseconds since epoch (inclusive)
+   * @param end last datetime in nanoseconds since epoch (inclusive)
+   * @return symbols with rows, by descending rows
+   */
+  std::vector<SymbolSummary> totals(uint64_t start, uint64_t end);
+
+protected:
+  /**
+   * Subarray of the days of one symbol covering a time range
+   */
+  std::vector<uint64_t> symbolSubarray(
+      uint64_t symbolId, uint64_t start, uint64_t end,
+      const std::vector<std::pair<uint64_t, uint64_t>> &nonEmptyDomain)
+      override;
+
+private:
+  std::mutex summariesMutex;
+  std::map<uint64_t, SummarySet> accumulated;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_SUMMARY_H
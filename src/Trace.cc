@@ -0,0 +1,163 @@
+/**
+ * @file  Trace.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Timeline recorder for ingest and read tasks, exported as Chrome trace-event
+ * JSON which can be opened in chrome://tracing or Perfetto
+ *
+ */
+
+#include "Trace.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+/**
+ * Escape a string for inclusion in a JSON document
+ * @param s
+ * @return escaped string
+ */
+static std::string jsonEscape(const std::string &s) {
+  std::string escaped;
+  escaped.reserve(s.size());
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      escaped.push_back('\\');
+      escaped.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      escaped.push_back(' ');
+    } else {
+      escaped.push_back(c);
+    }
+  }
+  return escaped;
+}
+
+nyse::Tracer &nyse::Tracer::instance() {
+  static Tracer tracer;
+  return tracer;
+}
+
+void nyse::Tracer::enable(size_t eventsPerThread) {
+  capacity = eventsPerThread;
+  epoch = std::chrono::steady_clock::now();
+  isEnabled.store(true);
+}
+
+uint64_t nyse::Tracer::now() const {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - epoch)
+      .count();
+}
+
+nyse::TraceThreadBuffer *nyse::Tracer::threadBuffer() {
+  thread_local TraceThreadBuffer *buffer = nullptr;
+  if (buffer == nullptr) {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    buffers.emplace_back(new TraceThreadBuffer());
+    buffer = buffers.back().get();
+    buffer->tid = static_cast<uint32_t>(buffers.size());
+    buffer->events.resize(capacity);
+  }
+  return buffer;
+}
+
+void nyse::Tracer::record(TraceEvent &&event) {
+  TraceThreadBuffer *buffer = threadBuffer();
+  buffer->events[buffer->written % buffer->events.size()] = std::move(event);
+  buffer->written++;
+}
+
+bool nyse::Tracer::write(const std::string &path) {
+  std::ofstream output(path);
+  if (!output.good()) {
+    std::cerr << "Could not open trace file " << path << std::endl;
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(buffersMutex);
+  output << "{\"traceEvents\":[\n";
+  bool first = true;
+  for (const auto &buffer : buffers) {
+    if (!first)
+      output << ",\n";
+    first = false;
+    output << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+           << buffer->tid << ",\"args\":{\"name\":\"thread " << buffer->tid
+           << "\"}}";
+
+    // Oldest surviving event first
+    uint64_t count = std::min<uint64_t>(buffer->written, buffer->events.size());
+    uint64_t begin = buffer->written - count;
+    for (uint64_t i = begin; i < buffer->written; i++) {
+      const TraceEvent &event = buffer->events[i % buffer->events.size()];
+      output << ",\n{\"name\":\"" << event.name
+             << "\",\"cat\":\"nyse\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+             << buffer->tid << ",\"ts\":" << event.startNs / 1000.0
+             << ",\"dur\":" << event.durationNs / 1000.0 << ",\"args\":{";
+      output << "\"file\":\"" << jsonEscape(event.file) << "\"";
+      output << ",\"bytes\":" << event.bytes;
+      output << ",\"rows\":" << event.rows << "}}";
+    }
+    if (buffer->written > buffer->events.size())
+      std::cerr << "Trace buffer for thread " << buffer->tid << " dropped "
+                << buffer->written - buffer->events.size() << " events"
+                << std::endl;
+  }
+  output << "\n]}\n";
+  return output.good();
+}
+
+nyse::TraceSpan::TraceSpan(const char *name, std::string file)
+    : name(name), active(Tracer::instance().enabled()) {
+  if (!active)
+    return;
+  this->file = std::move(file);
+  start = Tracer::instance().now();
+}
+
+nyse::TraceSpan::~TraceSpan() { end(); }
+
+void nyse::TraceSpan::end() {
+  if (!active)
+    return;
+  active = false;
+  Tracer &tracer = Tracer::instance();
+  tracer.record(TraceEvent{name, std::move(file), start, tracer.now() - start,
+                           bytes, rows});
+}
+
+nyse::TraceSession::TraceSession(std::string path) : path(std::move(path)) {
+  if (!this->path.empty())
+    Tracer::instance().enable();
+}
+
+nyse::TraceSession::~TraceSession() {
+  if (!path.empty())
+    Tracer::instance().write(path);
+}
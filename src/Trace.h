@@ -0,0 +1,162 @@
+/**
+ * @file  Trace.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Timeline recorder for ingest and read tasks, exported as Chrome trace-event
+ * JSON which can be opened in chrome://tracing or Perfetto
+ *
+ */
+
+#ifndef NYSE_INGESTOR_TRACE_H
+#define NYSE_INGESTOR_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * A single completed span
+ */
+struct TraceEvent {
+  // Span name, must be a string literal
+  const char *name;
+  std::string file;
+  uint64_t startNs;
+  uint64_t durationNs;
+  uint64_t bytes;
+  uint64_t rows;
+};
+
+/**
+ * Fixed size ring buffer of events owned by a single thread. Once full the
+ * oldest events are overwritten so memory use stays constant.
+ */
+struct TraceThreadBuffer {
+  uint32_t tid;
+  uint64_t written = 0;
+  std::vector<TraceEvent> events;
+};
+
+/**
+ * Process wide trace recorder. Spans are only recorded once enabled, each
+ * thread appends to its own ring buffer without locking.
+ */
+class Tracer {
+public:
+  static Tracer &instance();
+
+  /**
+   * Enable recording
+   * @param eventsPerThread capacity of each thread's ring buffer
+   */
+  void enable(size_t eventsPerThread = 1 << 16);
+
+  bool enabled() const { return isEnabled.load(std::memory_order_relaxed); }
+
+  /**
+   * Nanoseconds since tracing was enabled
+   */
+  uint64_t now() const;
+
+  /**
+   * Record a completed span into the calling thread's buffer
+   * @param event
+   */
+  void record(TraceEvent &&event);
+
+  /**
+   * Write all recorded events as Chrome trace-event JSON. Must be called once
+   * all traced work has finished.
+   * @param path output file
+   * @return true on success
+   */
+  bool write(const std::string &path);
+
+private:
+  Tracer() = default;
+
+  TraceThreadBuffer *threadBuffer();
+
+  std::atomic<bool> isEnabled{false};
+  size_t capacity = 0;
+  std::chrono::steady_clock::time_point epoch;
+
+  std::mutex buffersMutex;
+  std::vector<std::unique_ptr<TraceThreadBuffer>> buffers;
+};
+
+/**
+ * RAII span, records the time between construction and destruction when
+ * tracing is enabled
+ */
+class TraceSpan {
+public:
+  TraceSpan(const char *name, std::string file = "");
+  ~TraceSpan();
+
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+  void setBytes(uint64_t bytes) { this->bytes = bytes; }
+  void setRows(uint64_t rows) { this->rows = rows; }
+
+  /**
+   * Record the span now instead of on destruction
+   */
+  void end();
+
+private:
+  const char *name;
+  std::string file;
+  uint64_t start = 0;
+  uint64_t bytes = 0;
+  uint64_t rows = 0;
+  bool active;
+};
+
+/**
+ * Enables tracing for the lifetime of the session and writes the trace file
+ * when it goes out of scope. Does nothing if the path is empty.
+ */
+class TraceSession {
+public:
+  explicit TraceSession(std::string path);
+  ~TraceSession();
+
+private:
+  std::string path;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_TRACE_H
@@ -177,160 +177,3 @@ int nyse::Trade::load(const std::vector<std::string> file_uris, char delimiter,
   }
   return Array::load(file_uris, delimiter, batchSize, threads);
 }
-
-uint64_t nyse::Trade::readSample(std::string outfile, std::string delimiter) {
-  uint64_t rows_read = 0;
-  array = std::make_unique<tiledb::Array>(*ctx, array_uri,
-                                          tiledb_query_type_t::TILEDB_READ);
-  query = std::make_unique<tiledb::Query>(*ctx, *array);
-
-  std::ofstream output;
-  if (!outfile.empty()) {
-    output = std::ofstream(outfile);
-  }
-
-  query->set_layout(tiledb_layout_t::TILEDB_GLOBAL_ORDER);
-
-  tiledb::ArraySchema arraySchema = array->schema();
-
-  auto nonEmptyDomain = array->non_empty_domain<uint64_t>();
-
-  // Then select the entire domain for sequence number
-  std::vector<uint64_t> subarray = {
-      nonEmptyDomain[0].second.first, nonEmptyDomain[0].second.second,
-      nonEmptyDomain[1].second.first, nonEmptyDomain[1].second.second};
-
-  query->set_subarray(subarray);
-
-  std::vector<uint64_t> coords(this->buffer_size / sizeof(uint64_t));
-  query->set_coordinates(coords);
-
-  auto max_buffer_elements = array->max_buffer_elements(subarray);
-
-  std::vector<char> Exchange(this->buffer_size / sizeof(char));
-  query->set_buffer("Exchange", Exchange);
-
-  std::vector<char> Symbol(this->buffer_size / sizeof(char));
-  std::vector<uint64_t> Symbol_offsets(this->buffer_size / sizeof(uint64_t));
-  query->set_buffer("Symbol", Symbol_offsets, Symbol);
-
-  std::vector<char> Sale_Condition(this->buffer_size / sizeof(char));
-  std::vector<uint64_t> Sale_Condition_offsets(this->buffer_size /
-                                               sizeof(uint64_t));
-  query->set_buffer("Sale_Condition", Sale_Condition_offsets, Sale_Condition);
-
-  std::vector<uint32_t> Trade_Volume(this->buffer_size / sizeof(uint32_t));
-  query->set_buffer("Trade_Volume", Trade_Volume);
-
-  std::vector<float> Trade_Price(this->buffer_size / sizeof(float));
-  query->set_buffer("Trade_Price", Trade_Price);
-
-  std::vector<char> Trade_Stop_Stock_Indicator(this->buffer_size /
-                                               sizeof(char));
-  query->set_buffer("Trade_Stop_Stock_Indicator", Trade_Stop_Stock_Indicator);
-
-  std::vector<uint8_t> Trade_Correction_Indicator(this->buffer_size /
-                                                  sizeof(uint8_t));
-  query->set_buffer("Trade_Correction_Indicator", Trade_Correction_Indicator);
-
-  std::vector<char> Trade_Id(this->buffer_size / sizeof(char));
-  std::vector<uint64_t> Trade_Id_offsets(this->buffer_size / sizeof(uint64_t));
-  query->set_buffer("Trade_Id", Trade_Id_offsets, Trade_Id);
-
-  std::vector<char> Source_of_Trade(this->buffer_size / sizeof(char));
-  query->set_buffer("Source_of_Trade", Source_of_Trade);
-
-  std::vector<char> Trade_Reporting_Facility(this->buffer_size / sizeof(char));
-  query->set_buffer("Trade_Reporting_Facility", Trade_Reporting_Facility);
-
-  std::vector<uint64_t> Participant_Timestamp(this->buffer_size /
-                                              sizeof(uint64_t));
-  query->set_buffer("Participant_Timestamp", Participant_Timestamp);
-
-  std::vector<uint64_t> Trade_Reporting_Facility_TRF_Timestamp(
-      this->buffer_size / sizeof(uint64_t));
-  query->set_buffer("Trade_Reporting_Facility_TRF_Timestamp",
-                    Trade_Reporting_Facility_TRF_Timestamp);
-
-  std::vector<uint8_t> Trade_Through_Exempt_Indicator(this->buffer_size /
-                                                      sizeof(uint8_t));
-  query->set_buffer("Trade_Through_Exempt_Indicator",
-                    Trade_Through_Exempt_Indicator);
-
-  tiledb::Query::Status status;
-  size_t previous_result_num = 0;
-  do {
-    // Submit query and get status
-    query->submit();
-    status = query->query_status();
-
-    // If any results were retrieved, parse and print them
-    auto result_num =
-        (int)query->result_buffer_elements()[TILEDB_COORDS].second /
-        arraySchema.domain().ndim();
-    rows_read += result_num;
-    if (status == tiledb::Query::Status::INCOMPLETE &&
-        result_num == 0) { // VERY IMPORTANT!!
-      std::cerr << "Buffers were too small for query, you should fix this, "
-                   "test is invalid"
-                << std::endl;
-      std::cerr << "Last complete rows read: " << rows_read << std::endl;
-      std::cerr << "Last good coordinates [" << coords[previous_result_num - 2]
-                << ", " << coords[previous_result_num - 1]
-                << "] for result size " << previous_result_num << std::endl;
-      break;
-    }
-    if (output.is_open()) {
-      for (int i = 0; i < result_num; i++) {
-        std::stringstream ss;
-        ss << std::to_string(coords[i * 2]);
-        ss << delimiter;
-        ss << std::to_string(coords[i * 2 + 1]);
-        ss << delimiter;
-        ss << std::string(1, Exchange[i]);
-        ss << delimiter;
-        size_t symbolLength =
-            ((i + 1 == result_num) ? Symbol.size() : Symbol_offsets[i + 1]);
-        ss << std::string(Symbol.begin() + Symbol_offsets[i],
-                          Symbol.begin() + symbolLength);
-        ss << delimiter;
-        ss << std::string(1, Sale_Condition[i]);
-        ss << delimiter;
-        ss << std::to_string(Trade_Volume[i]);
-        ss << delimiter;
-        ss << std::to_string(Trade_Price[i]);
-        ss << delimiter;
-        ss << std::string(1, Trade_Stop_Stock_Indicator[i]);
-        ss << delimiter;
-        ss << std::to_string(Trade_Correction_Indicator[i]);
-        ss << delimiter;
-        size_t Trade_Id_Length =
-            ((i + 1 == result_num) ? Trade_Id.size() : Trade_Id_offsets[i + 1]);
-        ss << std::string(Trade_Id.begin() + Trade_Id_offsets[i],
-                          Trade_Id.begin() + Trade_Id_Length);
-        ss << delimiter;
-        ss << std::string(1, Source_of_Trade[i]);
-        ss << delimiter;
-        ss << std::string(1, Trade_Reporting_Facility[i]);
-        ss << delimiter;
-        ss << std::to_string(Participant_Timestamp[i]);
-        ss << delimiter;
-        ss << std::to_string(Trade_Reporting_Facility_TRF_Timestamp[i]);
-        ss << delimiter;
-        ss << std::to_string(Trade_Through_Exempt_Indicator[i]);
-        ss << std::endl;
-
-        output << ss.rdbuf();
-      }
-    }
-    // std::cerr << "Last good coordinates [" << coords[result_num-2] << ", " <<
-    // coords[result_num-1] << "] for result size " << result_num << std::endl;
-    previous_result_num = result_num;
-  } while (status == tiledb::Query::Status::INCOMPLETE);
-
-  if (output.is_open()) {
-    output.close();
-  }
-
-  return rows_read;
-}
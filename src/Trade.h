@@ -36,6 +36,7 @@
 
 #include "Array.h"
 #include "Master.h"
+#include <memory>
 #include <string>
 
 namespace nyse {
@@ -70,8 +71,6 @@ public:
   int load(const std::vector<std::string> file_uris, char delimiter,
            uint64_t batchSize, uint32_t threads) override;
 
-  uint64_t readSample(std::string outfile, std::string delimiter);
-
   std::string master_file;
 };
 } // namespace nyse
@@ -0,0 +1,314 @@
+/**
+ * @file  Volatility.cc
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Realized variance and volatility of previous tick sampled log returns at
+ * several frequencies per symbol and day
+ *
+ */
+
+#include "Volatility.h"
+#include "CsvWriter.h"
+#include "Nbbo.h"
+#include "Quote.h"
+#include "ResultStream.h"
+#include "Trace.h"
+#include "Trade.h"
+#include "utils.h"
+#include <ThreadPool.h>
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+static const uint64_t nanosecondsPerDay = 86400000000000;
+
+namespace {
+/**
+ * Grid position and sums of one sampling frequency
+ */
+struct FrequencyState {
+  uint64_t step = 0;
+  uint64_t next = 0;
+  bool sampled = false;
+  double lastLog = 0;
+  nyse::RealizedVariance variance;
+};
+} // namespace
+
+nyse::RealizedVolatility::RealizedVolatility(
+    std::shared_ptr<tiledb::Context> ctx, std::string uri, FileType type)
+    : ctx(std::move(ctx)), uri(std::move(uri)), type(type) {}
+
+void nyse::RealizedVolatility::setFrequencies(
+    std::vector<uint64_t> nanoseconds) {
+  nanoseconds.erase(std::remove(nanoseconds.begin(), nanoseconds.end(), 0),
+                    nanoseconds.end());
+  if (!nanoseconds.empty())
+    frequencies = std::move(nanoseconds);
+}
+
+uint64_t nyse::RealizedVolatility::sampleSymbol(
+    Array &array, uint64_t symbolId, uint64_t start, uint64_t end,
+    std::vector<VolatilityDay> &days) {
+  std::vector<uint64_t> subarray =
+      array.symbolSubarray(symbolId, start, end, array.nonEmptyDomain());
+  if (subarray.empty())
+    return 0;
+  uint64_t datetimeIndex =
+      dimensionIndex(array.array->schema().domain().dimensions(), "datetime");
+
+  std::vector<FrequencyState> states(frequencies.size());
+  for (size_t f = 0; f < frequencies.size(); f++)
+    states[f].step = frequencies[f];
+
+  bool inDay = false;
+  uint64_t dayStart = 0;
+  uint64_t close = 0;
+  VolatilityDay current;
+  // Previous tick and its log, computed once per price change
+  bool havePrice = false;
+  double price = 0;
+  bool haveLog = false;
+  double logPrice = 0;
+
+  auto sample = [&](FrequencyState &state) {
+    if (havePrice) {
+      if (!haveLog) {
+        logPrice = std::log(price);
+        haveLog = true;
+      }
+      if (state.sampled) {
+        double r = logPrice - state.lastLog;
+        state.variance.variance += r * r;
+        state.variance.returns++;
+      }
+      state.lastLog = logPrice;
+      state.sampled = true;
+    }
+    state.next += state.step;
+  };
+
+  // Sample the grid points of the session before t
+  auto sampleBefore = [&](uint64_t t) {
+    for (FrequencyState &state : states) {
+      while (state.next <= close && state.next < t)
+        sample(state);
+    }
+  };
+
+  auto finishDay = [&]() {
+    if (!inDay)
+      return;
+    sampleBefore(std::numeric_limits<uint64_t>::max());
+    for (const FrequencyState &state : states)
+      current.frequencies.push_back(state.variance);
+    days.push_back(std::move(current));
+    inDay = false;
+  };
+
+  auto startDay = [&](uint64_t t) {
+    dayStart = nyse::exchange_day_start(nyse::exchange_day(t));
+    close = dayStart + sessionClose;
+    for (FrequencyState &state : states) {
+      state.next = dayStart + sessionOpen;
+      state.sampled = false;
+      state.variance = RealizedVariance();
+    }
+    havePrice = false;
+    haveLog = false;
+    current = VolatilityDay();
+    current.day = dayStart;
+    inDay = true;
+  };
+
+  ResultStream stream(array, subarray);
+  for (const ResultBatch &batch : stream) {
+    uint64_t ndim = batch.dimensions();
+    const uint64_t *datetime =
+        batch.coordinates<uint64_t>().data() + datetimeIndex;
+    ColumnSpan<float> tradePrice, bidPrice, offerPrice;
+    if (type == FileType::Trade) {
+      tradePrice = batch.values<float>("Trade_Price");
+    } else {
+      bidPrice = batch.values<float>("Bid_Price");
+      offerPrice = batch.values<float>("Offer_Price");
+    }
+    auto valid = [&](uint64_t row) {
+      return type == FileType::Trade
+                 ? tradePrice[row] > 0
+                 : bidPrice[row] > 0 && offerPrice[row] > 0;
+    };
+
+    uint64_t row = 0;
+    uint64_t rows = batch.rows();
+    while (row < rows) {
+      uint64_t t = datetime[row * ndim];
+      if (!inDay || t >= dayStart + nanosecondsPerDay) {
+        finishDay();
+        startDay(t);
+      }
+
+      // Rows up to the next grid point only move the previous tick, skip to
+      // the last of them
+      uint64_t threshold = dayStart + nanosecondsPerDay - 1;
+      for (const FrequencyState &state : states) {
+        if (state.next <= close)
+          threshold = std::min(threshold, state.next);
+      }
+      uint64_t low = row, high = rows;
+      while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (datetime[middle * ndim] <= threshold)
+          low = middle + 1;
+        else
+          high = middle;
+      }
+
+      if (low == row) {
+        // The row is past the next grid point
+        sampleBefore(t);
+        continue;
+      }
+      for (uint64_t last = low; last > row; last--) {
+        if (!valid(last - 1))
+          continue;
+        double observed =
+            type == FileType::Trade
+                ? tradePrice[last - 1]
+                : 0.5 * (double(bidPrice[last - 1]) +
+                         double(offerPrice[last - 1]));
+        if (!havePrice || observed != price)
+          haveLog = false;
+        price = observed;
+        havePrice = true;
+        break;
+      }
+      current.observations += low - row;
+      row = low;
+    }
+  }
+  finishDay();
+  return stream.rows();
+}
+
+std::vector<std::vector<nyse::VolatilityDay>> nyse::RealizedVolatility::run(
+    const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+    uint64_t start, uint64_t end) {
+  if (type != FileType::Trade && type != FileType::Quote &&
+      type != FileType::Nbbo)
+    throw std::invalid_argument("Realized volatility is only supported for "
+                                "Trade, Quote and NBBO arrays");
+  std::vector<std::string> columns =
+      type == FileType::Trade
+          ? std::vector<std::string>{"datetime", "Trade_Price"}
+          : std::vector<std::string>{"datetime", "Bid_Price", "Offer_Price"};
+
+  std::vector<std::vector<VolatilityDay>> results(symbolIds.size());
+  std::atomic<uint64_t> nextSymbol{0};
+  std::atomic<uint64_t> totalRows{0};
+
+  // Each worker has its own reader, sharing the context and its caches
+  auto worker = [&]() {
+    std::unique_ptr<Array> array;
+    for (uint64_t s = nextSymbol++; s < symbolIds.size(); s = nextSymbol++) {
+      try {
+        if (array == nullptr) {
+          if (type == FileType::Trade)
+            array = std::make_unique<Trade>(uri, "", '|');
+          else if (type == FileType::Quote)
+            array = std::make_unique<Quote>(uri, "", '|');
+          else
+            array = std::make_unique<Nbbo>(uri);
+          array->setCtx(ctx);
+          if (!array->setColumns(columns))
+            throw std::runtime_error("Invalid price columns");
+        }
+        TraceSpan span("volatility", uri);
+        uint64_t rows = sampleSymbol(*array, symbolIds[s].second, start, end,
+                                     results[s]);
+        span.setRows(rows);
+        totalRows += rows;
+      } catch (const std::exception &e) {
+        std::cerr << "Realized volatility of " << symbolIds[s].first
+                  << " failed: " << e.what() << std::endl;
+      }
+    }
+  };
+
+  {
+    ThreadPool pool(std::min<uint64_t>(threads, symbolIds.size() + 1));
+    std::vector<std::future<void>> workers;
+    for (uint32_t t = 0; t < threads && t < symbolIds.size(); t++)
+      workers.emplace_back(pool.enqueue(worker));
+    for (auto &future : workers)
+      future.get();
+  }
+  rowsRead = totalRows;
+  return results;
+}
+
+void nyse::RealizedVolatility::write(
+    const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+    const std::vector<std::vector<VolatilityDay>> &days, std::ostream &output,
+    const std::string &delimiter) const {
+  CsvWriter writer(delimiter);
+  const char *header[] = {"symbol",      "day",
+                          "frequency",   "returns",
+                          "realized_variance", "realized_volatility"};
+  for (size_t c = 0; c < 6; c++) {
+    if (c > 0)
+      writer.appendDelimiter();
+    writer.append(header[c], strlen(header[c]));
+  }
+  writer.appendNewline();
+
+  for (size_t s = 0; s < symbolIds.size() && s < days.size(); s++) {
+    for (const VolatilityDay &day : days[s]) {
+      for (size_t f = 0; f < day.frequencies.size(); f++) {
+        const RealizedVariance &variance = day.frequencies[f];
+        writer.append(symbolIds[s].first.data(), symbolIds[s].first.size());
+        writer.appendDelimiter();
+        writer.appendValue(day.day);
+        writer.appendDelimiter();
+        writer.appendValue(frequencies[f] / 1e9);
+        writer.appendDelimiter();
+        writer.appendValue(variance.returns);
+        writer.appendDelimiter();
+        writer.appendValue(variance.variance);
+        writer.appendDelimiter();
+        writer.appendValue(variance.volatility());
+        writer.appendNewline();
+      }
+    }
+    writer.writeTo(output);
+    writer = CsvWriter(delimiter);
+  }
+}
@@ -0,0 +1,163 @@
+/**
+ * @file  Volatility.h
+ *
+ * @section LICENSE
+ *
+ * The MIT License
+ *
+ * @copyright Copyright (c) 2018 TileDB, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ * @section DESCRIPTION
+ *
+ * Realized variance and volatility of previous tick sampled log returns at
+ * several frequencies per symbol and day
+ *
+ */
+
+#ifndef NYSE_INGESTOR_VOLATILITY_H
+#define NYSE_INGESTOR_VOLATILITY_H
+
+#include "Array.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nyse {
+
+/**
+ * Sum of squared log returns at one sampling frequency
+ */
+struct RealizedVariance {
+  uint64_t returns = 0;
+  double variance = 0;
+
+  double volatility() const { return std::sqrt(variance); }
+};
+
+/**
+ * Realized variance of one symbol and trading day at each frequency, in the
+ * order the frequencies were set
+ */
+struct VolatilityDay {
+  // Exchange local midnight of the day, nanoseconds since epoch
+  uint64_t day = 0;
+  uint64_t observations = 0;
+  std::vector<RealizedVariance> frequencies;
+};
+
+/**
+ * Samples prices on a regular grid per symbol and trading session with
+ * previous tick interpolation, the price at a grid point being the last
+ * observation at or before it. All frequencies are sampled in the same pass.
+ * Trade arrays use Trade_Price, Quote and Nbbo arrays the midpoint of two
+ * sided quotes. Symbols are computed concurrently, each worker with its own
+ * reader.
+ */
+class RealizedVolatility {
+public:
+  /**
+   * @param ctx context shared by all readers
+   * @param uri Trade, Quote or NBBO array
+   * @param type FileType::Trade, FileType::Quote or FileType::Nbbo
+   */
+  RealizedVolatility(std::shared_ptr<tiledb::Context> ctx, std::string uri,
+                     FileType type);
+
+  /**
+   * Sampling frequencies
+   * @param nanoseconds grid spacing of each frequency
+   */
+  void setFrequencies(std::vector<uint64_t> nanoseconds);
+
+  /**
+   * Trading session sampled each day, in exchange local time. Observations
+   * before the open in the same day provide the price at the open.
+   * @param open nanoseconds since midnight of the first grid point
+   * @param close nanoseconds since midnight of the last grid point
+   */
+  void setSession(uint64_t open, uint64_t close) {
+    sessionOpen = open;
+    sessionClose = std::max(open, close);
+  }
+
+  void setThreads(uint32_t threads) { this->threads = std::max(threads, 1u); }
+
+  /**
+   * Compute realized variance for a set of symbols over a time range
+   * @param symbolIds symbol and its symbol_id
+   * @param start first datetime in nanoseconds since epoch (inclusive)
+   * @param end last datetime in nanoseconds since epoch (inclusive)
+   * @return days with observations of each symbol in day order, in the order
+   * of symbolIds
+   */
+  std::vector<std::vector<VolatilityDay>>
+  run(const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+      uint64_t start, uint64_t end);
+
+  /**
+   * Write delimited rows of symbol, day, frequency in seconds, returns,
+   * realized variance and realized volatility
+   * @param symbolIds symbols passed to run
+   * @param days result of run
+   * @param output
+   * @param delimiter
+   */
+  void write(const std::vector<std::pair<std::string, uint64_t>> &symbolIds,
+             const std::vector<std::vector<VolatilityDay>> &days,
+             std::ostream &output, const std::string &delimiter) const;
+
+  /**
+   * Rows read by the last run
+   */
+  uint64_t rows() const { return rowsRead; }
+
+private:
+  /**
+   * Sample one symbol
+   * @param array reader with the price columns projected
+   * @param symbolId
+   * @param start
+   * @param end
+   * @param days appended to
+   * @return rows read
+   */
+  uint64_t sampleSymbol(Array &array, uint64_t symbolId, uint64_t start,
+                        uint64_t end, std::vector<VolatilityDay> &days);
+
+  std::shared_ptr<tiledb::Context> ctx;
+  std::string uri;
+  FileType type;
+  std::vector<uint64_t> frequencies = {1000000000, 5000000000, 60000000000,
+                                       300000000000};
+  // Regular session 09:30 to 16:00
+  uint64_t sessionOpen = 34200000000000;
+  uint64_t sessionClose = 57600000000000;
+  uint32_t threads = 1;
+  uint64_t rowsRead = 0;
+};
+} // namespace nyse
+
+#endif // NYSE_INGESTOR_VOLATILITY_H
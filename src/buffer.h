@@ -49,6 +49,75 @@ struct buffer {
   std::shared_ptr<void> values;
   tiledb_datatype_t datatype;
 };
+
+/**
+ * Invoke a generic functor with a default value of the C++ type used to store
+ * a TileDB datatype, the functor recovers the type with decltype. The types
+ * match those allocated by createBuffer.
+ * @tparam F functor accepting any of the value types
+ * @param datatype
+ * @param f
+ * @return result of functor
+ */
+template <typename F>
+auto dispatchDatatype(tiledb_datatype_t datatype, F &&f)
+    -> decltype(f(int32_t())) {
+  switch (datatype) {
+  case TILEDB_INT32:
+    return f(int32_t());
+  case TILEDB_INT64:
+    return f(int64_t());
+  case TILEDB_FLOAT32:
+    return f(float());
+  case TILEDB_FLOAT64:
+    return f(double());
+  case TILEDB_CHAR:
+    return f(char());
+  case TILEDB_INT8:
+    return f(int8_t());
+  case TILEDB_UINT8:
+    return f(uint8_t());
+  case TILEDB_INT16:
+    return f(int16_t());
+  case TILEDB_UINT16:
+    return f(uint16_t());
+  case TILEDB_UINT32:
+    return f(uint32_t());
+  case TILEDB_UINT64:
+    return f(uint64_t());
+  case TILEDB_STRING_ASCII:
+  case TILEDB_STRING_UTF8:
+    return f(uint8_t());
+  case TILEDB_STRING_UTF16:
+  case TILEDB_STRING_UCS2:
+    return f(uint16_t());
+  case TILEDB_STRING_UTF32:
+  case TILEDB_STRING_UCS4:
+    return f(uint32_t());
+  case TILEDB_ANY:
+  default:
+    return f(int8_t());
+  }
+}
+
+/**
+ * Bytes allocated by a buffer's values and offsets
+ * @param buf
+ * @return bytes
+ */
+inline uint64_t bufferBytes(const buffer &buf) {
+  uint64_t bytes = 0;
+  if (buf.values != nullptr) {
+    bytes += dispatchDatatype(buf.datatype, [&buf](auto type) -> uint64_t {
+      using T = decltype(type);
+      return std::static_pointer_cast<std::vector<T>>(buf.values)->capacity() *
+             sizeof(T);
+    });
+  }
+  if (buf.offsets != nullptr)
+    bytes += buf.offsets->capacity() * sizeof(uint64_t);
+  return bytes;
+}
 } // namespace nyse
 
 #endif // NYSE_INGESTOR_BUFFER_H
@@ -31,12 +31,28 @@
  *
  */
 
+#include "Aggregate.h"
+#include "AsOfJoin.h"
+#include "Bars.h"
+#include "CsvWriter.h"
 #include "Master.h"
+#include "Nbbo.h"
+#include "PerfCounters.h"
+#include "Pyramid.h"
+#include "QueryServer.h"
 #include "Quote.h"
+#include "Replay.h"
+#include "ResultCache.h"
+#include "Sketch.h"
+#include "Summary.h"
+#include "Trace.h"
 #include "Trade.h"
+#include "Volatility.h"
 #include "utils.h"
 #include <CLI11.hpp>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <thread>
 #include <tiledb/tiledb>
@@ -50,6 +66,18 @@ std::istream &operator>>(std::istream &in, FileType &fileType) {
     fileType = FileType::Quote;
   } else if (s == "trade" || s == "Trade" || s == "TRADE") {
     fileType = FileType::Trade;
+  } else if (s == "bars" || s == "Bars" || s == "BARS") {
+    fileType = FileType::Bars;
+  } else if (s == "nbbo" || s == "Nbbo" || s == "NBBO") {
+    fileType = FileType::Nbbo;
+  } else if (s == "metrics" || s == "Metrics" || s == "METRICS") {
+    fileType = FileType::Metrics;
+  } else if (s == "pyramid" || s == "Pyramid" || s == "PYRAMID") {
+    fileType = FileType::Pyramid;
+  } else if (s == "summary" || s == "Summary" || s == "SUMMARY") {
+    fileType = FileType::Summary;
+  } else if (s == "sketch" || s == "Sketch" || s == "SKETCH") {
+    fileType = FileType::Sketch;
   } else {
     fileType = FileType::UNKNOWN;
   }
@@ -79,9 +107,12 @@ int main(int argc, char **argv) {
 
   FileType fileType;
   app.add_set("--type", fileType,
-              {FileType::Master, FileType::Trade, FileType::Quote},
+              {FileType::Master, FileType::Trade, FileType::Quote,
+               FileType::Bars, FileType::Nbbo, FileType::Metrics,
+               FileType::Pyramid, FileType::Summary, FileType::Sketch},
               "File type to ingest")
-      ->type_name("FileType in {Master, Quote, Trade}")
+      ->type_name("FileType in {Master, Quote, Trade, Bars, Nbbo, Metrics, "
+                  "Pyramid, Summary, Sketch}")
       ->required(true);
 
   bool createArray = false;
@@ -92,7 +123,59 @@ int main(int argc, char **argv) {
 
   uint32_t threads = std::thread::hardware_concurrency();
   app.add_option("--threads", threads,
-                 "Number of threads for loading in parallel");
+                 "Number of threads for loading and for formatting exports in "
+                 "parallel");
+
+  uint64_t barSeconds = 0;
+  app.add_option("--bars", barSeconds,
+                 "Bar width in seconds. Trade loads compute OHLCV bars into a "
+                 "dense bars array, Bars arrays are read with the same width");
+
+  std::string barsArray;
+  app.add_option("--bars-array", barsArray,
+                 "Bars array written by a Trade load with --bars, defaults to "
+                 "<array>_bars_<width>s");
+
+  bool summarize = false;
+  app.add_flag("--summary", summarize,
+               "Quote and Trade loads write row counts, time and "
+               "Sequence_Number ranges and byte estimates per symbol and day "
+               "to a summary array");
+
+  std::string summaryArray;
+  app.add_option("--summary-array", summaryArray,
+                 "Summary array written by a load with --summary, defaults "
+                 "to <array>_summary");
+
+  uint64_t mostActive = 0;
+  app.add_option("--most-active", mostActive,
+                 "Print the symbols of a Summary array with the most rows "
+                 "between --start and --end");
+
+  std::vector<std::string> sketchNames;
+  app.add_option("--sketch", sketchNames,
+                 "Quote and Trade loads keep quantile sketches of these "
+                 "columns per symbol and day, of Trade_Price, Trade_Volume, "
+                 "Bid_Price, Bid_Size, Offer_Price, Offer_Size and spread. "
+                 "Sketch arrays answer --quantiles of these columns",
+                 false);
+
+  std::string sketchArray;
+  app.add_option("--sketch-array", sketchArray,
+                 "Sketch array written by a load with --sketch, defaults to "
+                 "<array>_sketches");
+
+  std::vector<double> quantiles;
+  app.add_option("--quantiles", quantiles,
+                 "Approximate quantiles in [0, 1] of the --sketch columns of "
+                 "the --query symbols between --start and --end, read from a "
+                 "Sketch array",
+                 false);
+
+  std::string maxMemory;
+  app.add_option("--max-memory", maxMemory,
+                 "Memory budget for column buffers across all load workers, "
+                 "e.g. 64G. Workers flush fragments or wait when exceeded");
 
   bool consolidate = false;
   app.add_flag("--consolidate", consolidate, "Consolidate array");
@@ -100,10 +183,197 @@ int main(int argc, char **argv) {
   bool readSample = false;
   app.add_flag("--read", readSample, "read sample data from array for testing");
 
+  std::vector<std::string> querySymbols;
+  app.add_option("--query", querySymbols,
+                 "Read only these symbols, resolved to symbol_id with the "
+                 "master file",
+                 false);
+
+  std::string queryStart;
+  app.add_option("--start", queryStart,
+                 "Start of --query time range, nanoseconds since epoch or "
+                 "\"YYYY-MM-DD HH:MM:SS[.fffffffff]\" exchange time",
+                 false);
+
+  std::string queryEnd;
+  app.add_option("--end", queryEnd,
+                 "End of --query time range (inclusive), same format as "
+                 "--start",
+                 false);
+
+  std::string joinQuotes;
+  app.add_option("--join-quotes", joinQuotes,
+                 "With --query on a Trade array, attach the prevailing quote "
+                 "of this Quote array to each trade");
+
+  int64_t quoteLatency = 0;
+  app.add_option("--quote-latency", quoteLatency,
+                 "Minimum age in nanoseconds of the quote joined to a trade "
+                 "by --join-quotes");
+
+  uint64_t quoteLookback = 0;
+  app.add_option("--quote-lookback", quoteLookback,
+                 "Nanoseconds before --start searched for the quote "
+                 "prevailing at the first trade, 0 for all quotes");
+
+  uint64_t aggregateSeconds = 0;
+  app.add_option("--aggregate", aggregateSeconds,
+                 "Compute --metrics per symbol and bucket of this many "
+                 "seconds, for the --query symbols or all symbols");
+
+  std::vector<std::string> metricNames;
+  app.add_option("--metrics", metricNames,
+                 "Metrics computed by --aggregate in a single pass, of count, "
+                 "volume, vwap, twap, quoted_spread, relative_spread, "
+                 "imbalance and depth. Defaults to count volume vwap twap",
+                 false);
+
+  std::string metricsArray;
+  app.add_option("--metrics-array", metricsArray,
+                 "Write the buckets computed by --aggregate to this sparse "
+                 "array");
+
+  bool timeOfDay = false;
+  app.add_flag("--time-of-day", timeOfDay,
+               "With --aggregate, bucket by time of day across all days to "
+               "build intraday profiles");
+
+  std::vector<uint64_t> volatilitySeconds;
+  app.add_option("--realized-vol", volatilitySeconds,
+                 "Compute daily realized volatility sampled every given "
+                 "number of seconds, for the --query symbols or all symbols",
+                 false);
+
+  std::string sessionOpen = "09:30";
+  app.add_option("--session-open", sessionOpen,
+                 "First grid point of --realized-vol in exchange time, HH:MM",
+                 true);
+
+  std::string sessionClose = "16:00";
+  app.add_option("--session-close", sessionClose,
+                 "Last grid point of --realized-vol in exchange time, HH:MM",
+                 true);
+
+  std::string nbboArray;
+  app.add_option("--nbbo", nbboArray,
+                 "Build this NBBO array from the per exchange quotes of the "
+                 "Quote array, after loading when files are passed. --query, "
+                 "--start and --end restrict the symbols and time range");
+
+  std::string pyramidGroup;
+  app.add_option("--pyramid", pyramidGroup,
+                 "Build this pyramid of downsampled levels from the Quote or "
+                 "Nbbo array, after loading when files are passed. --query, "
+                 "--start and --end restrict the symbols and time range");
+
+  std::vector<uint64_t> pyramidLevels = {100, 1000, 10000, 60000};
+  app.add_option("--pyramid-levels", pyramidLevels,
+                 "Bucket widths in milliseconds of the --pyramid levels, each "
+                 "a multiple of the finest",
+                 true);
+
+  uint64_t resolution = 0;
+  app.add_option("--resolution", resolution,
+                 "Pyramid arrays are read from the coarsest level with "
+                 "buckets of at most this many milliseconds, 0 for the "
+                 "finest level",
+                 true);
+
+  bool replay = false;
+  app.add_flag("--replay", replay,
+               "Replay the trades or quotes of the --query symbols or all "
+               "symbols in time order, to --write-file or --replay-shm");
+
+  std::string replayQuotes;
+  app.add_option("--replay-quotes", replayQuotes,
+                 "With --replay of a Trade array, merge in the quotes of this "
+                 "Quote array");
+
+  double replaySpeed = 0;
+  app.add_option("--replay-speed", replaySpeed,
+                 "Replay at this multiple of real time, 0 for as fast as "
+                 "possible",
+                 true);
+
+  uint64_t replayWindow = 60;
+  app.add_option("--replay-window", replayWindow,
+                 "Seconds of events read at once by --replay, memory holds "
+                 "two windows",
+                 true);
+
+  std::string replayShm;
+  app.add_option("--replay-shm", replayShm,
+                 "Publish --replay events to a ring in this POSIX shared "
+                 "memory object, e.g. /nyse_replay");
+
+  uint64_t replayRing = 1 << 20;
+  app.add_option("--replay-ring", replayRing,
+                 "Events held by the --replay-shm ring", true);
+
+  std::vector<std::string> columns;
+  app.add_option("--columns", columns,
+                 "Attributes and dimensions to read and export, in output "
+                 "order. Defaults to all",
+                 false);
+
+  bool parallelRead = false;
+  app.add_flag("--parallel-read", parallelRead,
+               "Split reads into tile aligned partitions read concurrently "
+               "by --threads queries");
+
+  bool unordered = false;
+  app.add_flag("--unordered", unordered,
+               "With --parallel-read, write partitions as they complete "
+               "instead of in global order");
+
+  std::string serveSocket;
+  app.add_option("--serve", serveSocket,
+                 "Serve symbol and time range queries on this Unix domain "
+                 "socket, keeping the arrays open between requests");
+
+  std::string serveQuoteArray;
+  app.add_option("--quote-array", serveQuoteArray,
+                 "Quote array to serve with --serve, in addition to --array");
+
+  std::string serveTradeArray;
+  app.add_option("--trade-array", serveTradeArray,
+                 "Trade array to serve with --serve, in addition to --array");
+
+  std::string tileCacheSize;
+  app.add_option("--tile-cache-size", tileCacheSize,
+                 "TileDB tile cache shared by all arrays served with --serve, "
+                 "e.g. 1G");
+
+  std::string resultCacheSize;
+  app.add_option("--result-cache", resultCacheSize,
+                 "Cache decoded results of repeated reads up to this size, "
+                 "e.g. 512M. Invalidated when the array's fragments change");
+
   std::string writeFile;
   app.add_option("--write-file", writeFile,
                  "File to write csv format data from read");
 
+  std::string exportFormat = "csv";
+  app.add_set("--format", exportFormat, {"csv", "arrow", "arrow-stream"},
+              "Format of --write-file: delimited text, Arrow IPC file or Arrow "
+              "IPC stream",
+              true);
+
+  bool tiledbStats = false;
+  app.add_flag("--tiledb-stats", tiledbStats,
+               "Dump TileDB internal statistics for each fragment write, read "
+               "and consolidation");
+
+  bool perfCounters = false;
+  app.add_flag("--perf-counters", perfCounters,
+               "Report hardware performance counters per ingest stage and "
+               "thread (Linux only)");
+
+  std::string traceFile;
+  app.add_option("--trace", traceFile,
+                 "Write a Chrome trace-event JSON timeline of all tasks to "
+                 "this file");
+
   std::vector<std::string> coordinate_filters;
   app.add_option("--coordinate_filters", coordinate_filters,
                  "List of filters to apply to coordinates", false);
@@ -118,24 +388,78 @@ int main(int argc, char **argv) {
 
   CLI11_PARSE(app, argc, argv);
 
-  if (filename.empty() && !createArray && !readSample) {
-    std::cerr << "Filename is required unless --create or --read is passed"
+  if (filename.empty() && !createArray && !readSample &&
+      querySymbols.empty() && serveSocket.empty() && nbboArray.empty() &&
+      pyramidGroup.empty() && aggregateSeconds == 0 &&
+      volatilitySeconds.empty() && mostActive == 0 && !replay) {
+    std::cerr << "Filename is required unless --create, --read, --query, "
+                 "--aggregate, --realized-vol, --nbbo, --pyramid, "
+                 "--most-active, --replay or --serve is passed"
               << std::endl;
     return 1;
   }
 
   if (fileType == FileType::UNKNOWN) {
-    std::cerr
-        << "Unknown filetype passed, must be one of {Master, Quote, Trade}"
-        << std::endl;
+    std::cerr << "Unknown filetype passed, must be one of {Master, Quote, "
+                 "Trade, Bars, Nbbo, Metrics, Pyramid, Summary, Sketch}"
+              << std::endl;
     return 1;
   }
 
+  // Declared before the array so the trace is written after it is destroyed
+  nyse::TraceSession traceSession(traceFile);
+
+  if (!resultCacheSize.empty()) {
+    try {
+      nyse::ResultCache::instance().setCapacity(
+          nyse::parse_size(resultCacheSize));
+    } catch (const std::exception &) {
+      std::cerr << "Invalid --result-cache " << resultCacheSize << std::endl;
+      return 1;
+    }
+  }
+
+  if (!serveSocket.empty()) {
+    if (masterFilename.empty()) {
+      std::cerr << "--master_file is required for --serve" << std::endl;
+      return 1;
+    }
+    uint64_t cacheBytes = 0;
+    try {
+      if (!tileCacheSize.empty())
+        cacheBytes = nyse::parse_size(tileCacheSize);
+    } catch (const std::exception &) {
+      std::cerr << "Invalid --tile-cache-size " << tileCacheSize << std::endl;
+      return 1;
+    }
+
+    nyse::QueryServer server(serveSocket, masterFilename, delimiter, threads,
+                             cacheBytes);
+    if (!arrayUri.empty() && fileType != FileType::Master &&
+        !server.addArray(fileType, arrayUri))
+      return 1;
+    if (!serveQuoteArray.empty() &&
+        !server.addArray(FileType::Quote, serveQuoteArray))
+      return 1;
+    if (!serveTradeArray.empty() &&
+        !server.addArray(FileType::Trade, serveTradeArray))
+      return 1;
+    return server.run();
+  }
+
+  // Building the NBBO or a pyramid, aggregating or replaying all symbols does
+  // not resolve any symbol
+  bool needsMaster =
+      !createArray &&
+      (!filename.empty() || !querySymbols.empty() ||
+       (nbboArray.empty() && pyramidGroup.empty() && aggregateSeconds == 0 &&
+        volatilitySeconds.empty() && !replay));
+
   std::unique_ptr<nyse::Array> array;
   if (fileType == FileType::Master) {
     array = std::make_unique<nyse::Master>(arrayUri, delimiter.c_str()[0]);
   } else if (fileType == FileType::Quote) {
-    if (masterFilename.empty() && !createArray) {
+    if (masterFilename.empty() && needsMaster) {
       std::cerr << "--master_file is required for Quote array loading"
                 << std::endl;
       return 1;
@@ -143,15 +467,357 @@ int main(int argc, char **argv) {
     array = std::make_unique<nyse::Quote>(arrayUri, masterFilename,
                                           delimiter.c_str()[0]);
   } else if (fileType == FileType::Trade) {
-    if (masterFilename.empty() && !createArray) {
+    if (masterFilename.empty() && needsMaster) {
       std::cerr << "--master_file is required for Trade array loading"
                 << std::endl;
       return 1;
     }
-    array = std::make_unique<nyse::Trade>(arrayUri, masterFilename,
-                                          delimiter.c_str()[0]);
+    auto trade = std::make_unique<nyse::Trade>(arrayUri, masterFilename,
+                                               delimiter.c_str()[0]);
+    if (barSeconds > 0 && !createArray) {
+      if (barsArray.empty())
+        barsArray = arrayUri + "_bars_" + std::to_string(barSeconds) + "s";
+      trade->addLoadObserver(
+          std::make_shared<nyse::Bars>(barsArray, barSeconds));
+    }
+    array = std::move(trade);
+  } else if (fileType == FileType::Bars) {
+    if (barSeconds == 0) {
+      std::cerr << "--bars is required for Bars arrays" << std::endl;
+      return 1;
+    }
+    array = std::make_unique<nyse::Bars>(arrayUri, barSeconds);
+  } else if (fileType == FileType::Nbbo) {
+    array = std::make_unique<nyse::Nbbo>(arrayUri);
+  } else if (fileType == FileType::Metrics) {
+    array = std::make_unique<nyse::Metrics>(arrayUri);
+  } else if (fileType == FileType::Pyramid) {
+    std::string levelUri =
+        nyse::Pyramid(arrayUri).levelFor(resolution * 1000000);
+    if (levelUri.empty()) {
+      std::cerr << "Pyramid " << arrayUri << " has no level of at most "
+                << resolution << " ms" << std::endl;
+      return 1;
+    }
+    array = std::make_unique<nyse::PyramidLevel>(levelUri);
+  } else if (fileType == FileType::Summary) {
+    array = std::make_unique<nyse::Summary>(arrayUri);
+  } else if (fileType == FileType::Sketch) {
+    array = std::make_unique<nyse::Sketches>(arrayUri);
+  }
+
+  std::vector<nyse::SketchColumn> sketchColumns;
+  for (const std::string &name : sketchNames) {
+    nyse::SketchColumn column;
+    if (!nyse::parseSketchColumn(name, column)) {
+      std::cerr << "Unknown sketch column " << name << std::endl;
+      return 1;
+    }
+    sketchColumns.push_back(column);
+  }
+
+  if (!sketchColumns.empty() && !createArray &&
+      fileType != FileType::Sketch) {
+    if (fileType != FileType::Quote && fileType != FileType::Trade) {
+      std::cerr << "--sketch requires a Quote or Trade array" << std::endl;
+      return 1;
+    }
+    if (sketchArray.empty())
+      sketchArray = arrayUri + "_sketches";
+    auto sketches = std::make_shared<nyse::Sketches>(sketchArray);
+    sketches->setSketchColumns(sketchColumns);
+    array->addLoadObserver(sketches);
+  }
+
+  if (summarize && !createArray) {
+    if (fileType != FileType::Quote && fileType != FileType::Trade) {
+      std::cerr << "--summary requires a Quote or Trade array" << std::endl;
+      return 1;
+    }
+    if (summaryArray.empty())
+      summaryArray = arrayUri + "_summary";
+    array->addLoadObserver(std::make_shared<nyse::Summary>(summaryArray));
+  }
+
+  if (!nbboArray.empty() && fileType != FileType::Quote) {
+    std::cerr << "--nbbo requires a Quote array" << std::endl;
+    return 1;
   }
 
+  if (!pyramidGroup.empty() && fileType != FileType::Quote &&
+      fileType != FileType::Nbbo) {
+    std::cerr << "--pyramid requires a Quote or Nbbo array" << std::endl;
+    return 1;
+  }
+
+  uint64_t start = 0;
+  uint64_t end = std::numeric_limits<uint64_t>::max();
+  try {
+    if (!queryStart.empty())
+      start = nyse::parse_timestamp(queryStart);
+    if (!queryEnd.empty())
+      end = nyse::parse_timestamp(queryEnd);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  // Builds the NBBO of the given symbol_ids, all symbols if empty, between
+  // two datetimes
+  auto buildNbbo = [&](const std::vector<uint64_t> &symbolIds,
+                       uint64_t rangeStart, uint64_t rangeEnd) {
+    nyse::Nbbo nbbo(nbboArray);
+    nbbo.setTileDBStats(tiledbStats);
+    nbbo.createArray(tiledb::FilterList(*nbbo.getCtx()),
+                     tiledb::FilterList(*nbbo.getCtx()),
+                     tiledb::FilterList(*nbbo.getCtx()));
+    auto startTime = std::chrono::steady_clock::now();
+    uint64_t changes =
+        nbbo.build(arrayUri, symbolIds, rangeStart, rangeEnd, threads);
+    auto duration = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - startTime);
+    printf("wrote %lu NBBO changes in %.3f ms\n", changes, duration.count());
+    return 0;
+  };
+
+  // Builds the pyramid levels of the given symbol_ids, all symbols if empty,
+  // between two datetimes
+  auto buildPyramid = [&](const std::vector<uint64_t> &symbolIds,
+                          uint64_t rangeStart, uint64_t rangeEnd) {
+    nyse::Pyramid pyramid(pyramidGroup);
+    std::vector<uint64_t> widths;
+    for (uint64_t milliseconds : pyramidLevels)
+      widths.push_back(milliseconds * 1000000);
+    auto startTime = std::chrono::steady_clock::now();
+    uint64_t cells = 0;
+    try {
+      nyse::TileDBStatsScope statsScope(tiledbStats,
+                                        "pyramid of " + arrayUri);
+      cells = pyramid.build(arrayUri, fileType, widths, symbolIds, rangeStart,
+                            rangeEnd, threads);
+    } catch (const std::invalid_argument &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    auto duration = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - startTime);
+    printf("wrote %lu pyramid cells in %.3f ms\n", cells, duration.count());
+    return 0;
+  };
+
+  // Computes the selected metrics per bucket of the given symbols
+  auto aggregate =
+      [&](const std::vector<std::pair<std::string, uint64_t>> &symbolIds) {
+        if (fileType != FileType::Trade && fileType != FileType::Quote &&
+            fileType != FileType::Nbbo) {
+          std::cerr << "--aggregate requires a Trade, Quote or Nbbo array"
+                    << std::endl;
+          return 1;
+        }
+        std::vector<nyse::Metric> metrics;
+        for (const std::string &name : metricNames) {
+          nyse::Metric metric;
+          if (!nyse::parseMetric(name, metric)) {
+            std::cerr << "Unknown metric " << name << std::endl;
+            return 1;
+          }
+          metrics.push_back(metric);
+        }
+
+        nyse::Aggregation aggregation(array->getCtx(), arrayUri, fileType);
+        aggregation.setBucketWidth(aggregateSeconds * 1000000000);
+        aggregation.setTimeOfDay(timeOfDay);
+        aggregation.setThreads(threads);
+        if (!metrics.empty())
+          aggregation.setMetrics(metrics);
+
+        auto startTime = std::chrono::steady_clock::now();
+        std::vector<std::vector<nyse::AggregateBucket>> buckets;
+        try {
+          nyse::TileDBStatsScope statsScope(tiledbStats,
+                                            "aggregation of " + arrayUri);
+          buckets = aggregation.run(symbolIds, start, end);
+        } catch (const std::invalid_argument &e) {
+          std::cerr << e.what() << std::endl;
+          return 1;
+        }
+        auto duration = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - startTime);
+        if (!writeFile.empty()) {
+          std::ofstream output(writeFile, std::ios::binary);
+          aggregation.write(symbolIds, buckets, output, delimiter);
+        }
+        if (!metricsArray.empty()) {
+          nyse::Metrics metricsOutput(metricsArray);
+          metricsOutput.setTileDBStats(tiledbStats);
+          metricsOutput.createArray(
+              tiledb::FilterList(*metricsOutput.getCtx()),
+              tiledb::FilterList(*metricsOutput.getCtx()),
+              tiledb::FilterList(*metricsOutput.getCtx()));
+          metricsOutput.write(symbolIds, buckets,
+                              aggregation.selectedMetrics());
+        }
+        uint64_t bucketCount = 0;
+        for (const auto &symbolBuckets : buckets)
+          bucketCount += symbolBuckets.size();
+        printf("aggregated %lu rows into %lu buckets for %lu symbols in %.3f "
+               "ms\n",
+               aggregation.rows(), bucketCount, symbolIds.size(),
+               duration.count());
+        return 0;
+      };
+
+  // Realized volatility per day of the given symbols
+  auto realizedVolatility =
+      [&](const std::vector<std::pair<std::string, uint64_t>> &symbolIds) {
+        if (fileType != FileType::Trade && fileType != FileType::Quote &&
+            fileType != FileType::Nbbo) {
+          std::cerr << "--realized-vol requires a Trade, Quote or Nbbo array"
+                    << std::endl;
+          return 1;
+        }
+        uint64_t open, close;
+        try {
+          open = nyse::parse_time_of_day(sessionOpen);
+          close = nyse::parse_time_of_day(sessionClose);
+        } catch (const std::exception &) {
+          std::cerr << "Invalid --session-open or --session-close"
+                    << std::endl;
+          return 1;
+        }
+        std::vector<uint64_t> frequencies;
+        for (uint64_t seconds : volatilitySeconds)
+          frequencies.push_back(seconds * 1000000000);
+
+        nyse::RealizedVolatility volatility(array->getCtx(), arrayUri,
+                                            fileType);
+        volatility.setFrequencies(frequencies);
+        volatility.setSession(open, close);
+        volatility.setThreads(threads);
+
+        auto startTime = std::chrono::steady_clock::now();
+        std::vector<std::vector<nyse::VolatilityDay>> days;
+        {
+          nyse::TileDBStatsScope statsScope(tiledbStats,
+                                            "realized volatility of " +
+                                                arrayUri);
+          days = volatility.run(symbolIds, start, end);
+        }
+        auto duration = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - startTime);
+        if (!writeFile.empty()) {
+          std::ofstream output(writeFile, std::ios::binary);
+          volatility.write(symbolIds, days, output, delimiter);
+        }
+        uint64_t dayCount = 0;
+        for (const auto &symbolDays : days)
+          dayCount += symbolDays.size();
+        printf("sampled %lu rows into %lu symbol days for %lu symbols in "
+               "%.3f ms\n",
+               volatility.rows(), dayCount, symbolIds.size(),
+               duration.count());
+        return 0;
+      };
+
+  // Replays the trades and quotes of the given symbol_ids, all symbols if
+  // empty
+  auto replayEvents = [&](const std::vector<uint64_t> &symbolIds) {
+    if (fileType != FileType::Trade && fileType != FileType::Quote) {
+      std::cerr << "--replay requires a Trade or Quote array" << std::endl;
+      return 1;
+    }
+    if (!replayQuotes.empty() && fileType != FileType::Trade) {
+      std::cerr << "--replay-quotes requires a Trade array" << std::endl;
+      return 1;
+    }
+    nyse::Replay replayer(
+        array->getCtx(), fileType == FileType::Trade ? arrayUri : "",
+        fileType == FileType::Quote ? arrayUri : replayQuotes);
+    replayer.setSymbols(symbolIds);
+    replayer.setWindow(replayWindow * 1000000000);
+    replayer.setSpeed(replaySpeed);
+
+    nyse::ReplayRing ring;
+    if (!replayShm.empty() && !ring.create(replayShm, replayRing))
+      return 1;
+    std::ofstream output;
+    if (replayShm.empty() && !writeFile.empty())
+      output.open(writeFile, std::ios::binary);
+    nyse::CsvWriter writer(delimiter);
+
+    nyse::Replay::Callback callback;
+    if (!replayShm.empty()) {
+      callback = [&](const nyse::ReplayEvent &event) {
+        ring.push(event);
+        return true;
+      };
+    } else if (output.is_open()) {
+      callback = [&](const nyse::ReplayEvent &event) {
+        writer.appendValue(event.type);
+        writer.appendDelimiter();
+        writer.appendValue(event.datetime);
+        writer.appendDelimiter();
+        writer.appendValue(event.sequence);
+        writer.appendDelimiter();
+        writer.appendValue(event.symbolId);
+        writer.appendDelimiter();
+        writer.appendValue(event.exchange);
+        writer.appendDelimiter();
+        writer.appendValue(event.price);
+        writer.appendDelimiter();
+        writer.appendValue(event.size);
+        if (event.type == 'Q') {
+          writer.appendDelimiter();
+          writer.appendValue(event.offerPrice);
+          writer.appendDelimiter();
+          writer.appendValue(event.offerSize);
+        }
+        writer.appendNewline();
+        if (writer.size() >= 1 << 20) {
+          writer.writeTo(output);
+          writer.clear();
+        }
+        return true;
+      };
+    } else {
+      callback = [](const nyse::ReplayEvent &) { return true; };
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    uint64_t events = 0;
+    try {
+      nyse::TileDBStatsScope statsScope(tiledbStats, "replay of " + arrayUri);
+      events = replayer.run(start, end, callback);
+    } catch (const std::exception &e) {
+      std::cerr << "Replay failed: " << e.what() << std::endl;
+      return 1;
+    }
+    if (output.is_open())
+      writer.writeTo(output);
+    auto duration = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - startTime);
+    printf("replayed %lu events in %.3f ms\n", events, duration.count());
+    return 0;
+  };
+
+  array->setTileDBStats(tiledbStats);
+  array->setReadThreads(threads);
+  array->setParallelRead(parallelRead, !unordered);
+  if (exportFormat == "arrow")
+    array->setExportFormat(nyse::ExportFormat::ArrowFile);
+  else if (exportFormat == "arrow-stream")
+    array->setExportFormat(nyse::ExportFormat::ArrowStream);
+  if (!maxMemory.empty()) {
+    try {
+      array->setMaxMemory(nyse::parse_size(maxMemory));
+    } catch (const std::exception &) {
+      std::cerr << "Invalid --max-memory " << maxMemory << std::endl;
+      return 1;
+    }
+  }
+  if (perfCounters)
+    nyse::PerfCounters::instance().enable();
+
   if (createArray) {
     tiledb::FilterList coordinate_filter_list(*array->getCtx());
     tiledb::FilterList offset_filter_list(*array->getCtx());
@@ -185,8 +851,7 @@ int main(int argc, char **argv) {
 
   if (consolidate) {
     auto startTime = std::chrono::steady_clock::now();
-    tiledb::Context ctx;
-    tiledb::Array::consolidate(ctx, arrayUri);
+    array->consolidate();
 
     auto duration = std::chrono::duration_cast<std::chrono::seconds>(
         std::chrono::steady_clock::now() - startTime);
@@ -194,9 +859,18 @@ int main(int argc, char **argv) {
     return 0;
   }
 
+  if (!columns.empty() && (readSample || !querySymbols.empty())) {
+    if (!array->setColumns(columns))
+      return 1;
+  }
+
   if (readSample) {
     auto startTime = std::chrono::steady_clock::now();
-    uint64_t rows = array->readSample(writeFile, delimiter);
+    uint64_t rows = 0;
+    {
+      nyse::TileDBStatsScope statsScope(tiledbStats, "read of " + arrayUri);
+      rows = array->readSample(writeFile, delimiter);
+    }
 
     auto duration = std::chrono::duration_cast<std::chrono::seconds>(
         std::chrono::steady_clock::now() - startTime);
@@ -207,5 +881,216 @@ int main(int argc, char **argv) {
     return 0;
   }
 
-  return array->load(filename, delimiter.c_str()[0], batchSize, threads);
+  if (mostActive > 0) {
+    if (fileType != FileType::Summary) {
+      std::cerr << "--most-active requires a Summary array" << std::endl;
+      return 1;
+    }
+    // Symbols are named by the master file when one is passed
+    std::unordered_map<uint64_t, std::string> symbolNames;
+    if (!masterFilename.empty()) {
+      for (const auto &symbol : nyse::Master::buildSymbolIds(
+               *array->getCtx(), masterFilename, delimiter.c_str()[0]))
+        symbolNames.emplace(std::stoull(symbol.second), symbol.first);
+    }
+    std::vector<nyse::SymbolSummary> totals =
+        static_cast<nyse::Summary &>(*array).totals(start, end);
+    std::ofstream output;
+    if (!writeFile.empty())
+      output.open(writeFile, std::ios::binary);
+    std::ostream &out = output.is_open() ? output : std::cout;
+    out << "symbol" << delimiter << "rows" << delimiter << "bytes" << delimiter
+        << "first_datetime" << delimiter << "last_datetime" << std::endl;
+    for (uint64_t i = 0; i < totals.size() && i < mostActive; i++) {
+      const nyse::SymbolSummary &total = totals[i];
+      auto name = symbolNames.find(total.symbolId);
+      if (name != symbolNames.end())
+        out << name->second;
+      else
+        out << total.symbolId;
+      out << delimiter << total.rows << delimiter << total.bytes << delimiter
+          << total.firstDatetime << delimiter << total.lastDatetime << "\n";
+    }
+    return 0;
+  }
+
+  if (!nbboArray.empty() && filename.empty() && querySymbols.empty())
+    return buildNbbo({}, start, end);
+
+  if (!pyramidGroup.empty() && filename.empty() && querySymbols.empty())
+    return buildPyramid({}, start, end);
+
+  if (replay && querySymbols.empty())
+    return replayEvents({});
+
+  if ((aggregateSeconds > 0 || !volatilitySeconds.empty()) &&
+      querySymbols.empty()) {
+    // All symbols of the array, named by their symbol_id
+    std::vector<std::pair<std::string, uint64_t>> symbolIds;
+    tiledb::Array domainArray(*array->getCtx(), arrayUri, TILEDB_READ);
+    for (const auto &dimension : domainArray.non_empty_domain<uint64_t>()) {
+      if (dimension.first != "symbol_id")
+        continue;
+      for (uint64_t s = dimension.second.first; s <= dimension.second.second;
+           s++)
+        symbolIds.emplace_back(std::to_string(s), s);
+    }
+    domainArray.close();
+    if (aggregateSeconds > 0)
+      return aggregate(symbolIds);
+    return realizedVolatility(symbolIds);
+  }
+
+  if (!querySymbols.empty()) {
+    if (fileType == FileType::Master) {
+      std::cerr << "--query is only supported for Quote and Trade arrays"
+                << std::endl;
+      return 1;
+    }
+
+    auto symbolMapping = nyse::Master::buildSymbolIds(
+        *array->getCtx(), masterFilename, delimiter.c_str()[0]);
+    std::vector<std::pair<std::string, uint64_t>> symbolIds;
+    for (const auto &symbol : querySymbols) {
+      auto symbolId = symbolMapping.find(symbol);
+      if (symbolId == symbolMapping.end()) {
+        std::cerr << "Symbol " << symbol << " not found in master file "
+                  << masterFilename << std::endl;
+        return 1;
+      }
+      symbolIds.emplace_back(symbol, std::stoull(symbolId->second));
+    }
+
+    if (!nbboArray.empty() && filename.empty()) {
+      std::vector<uint64_t> ids;
+      for (const auto &symbolId : symbolIds)
+        ids.push_back(symbolId.second);
+      return buildNbbo(ids, start, end);
+    }
+
+    if (!pyramidGroup.empty() && filename.empty()) {
+      std::vector<uint64_t> ids;
+      for (const auto &symbolId : symbolIds)
+        ids.push_back(symbolId.second);
+      return buildPyramid(ids, start, end);
+    }
+
+    if (replay) {
+      std::vector<uint64_t> ids;
+      for (const auto &symbolId : symbolIds)
+        ids.push_back(symbolId.second);
+      return replayEvents(ids);
+    }
+
+    if (!joinQuotes.empty()) {
+      if (fileType != FileType::Trade) {
+        std::cerr << "--join-quotes requires a Trade array" << std::endl;
+        return 1;
+      }
+      std::ofstream output;
+      if (!writeFile.empty())
+        output.open(writeFile, std::ios::binary);
+
+      nyse::AsOfJoin join(array->getCtx(), arrayUri, joinQuotes);
+      join.setLatency(quoteLatency);
+      join.setQuoteLookback(quoteLookback);
+      join.setTradeColumns(columns);
+      join.setThreads(threads);
+
+      auto startTime = std::chrono::steady_clock::now();
+      uint64_t rows = 0;
+      {
+        nyse::TileDBStatsScope statsScope(tiledbStats, "join of " + arrayUri);
+        rows = join.run(symbolIds, start, end,
+                        output.is_open() ? &output : nullptr, delimiter);
+      }
+      auto duration = std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - startTime);
+      printf("joined %lu trades for %lu symbols in %.3f ms\n", rows,
+             symbolIds.size(), duration.count());
+      return 0;
+    }
+
+    if (aggregateSeconds > 0)
+      return aggregate(symbolIds);
+
+    if (!volatilitySeconds.empty())
+      return realizedVolatility(symbolIds);
+
+    if (!quantiles.empty()) {
+      if (fileType != FileType::Sketch || sketchColumns.empty()) {
+        std::cerr << "--quantiles requires a Sketch array and --sketch columns"
+                  << std::endl;
+        return 1;
+      }
+      auto &sketches = static_cast<nyse::Sketches &>(*array);
+      std::ofstream output;
+      if (!writeFile.empty())
+        output.open(writeFile, std::ios::binary);
+      std::ostream &out = output.is_open() ? output : std::cout;
+
+      auto startTime = std::chrono::steady_clock::now();
+      out << "symbol" << delimiter << "column" << delimiter << "count"
+          << delimiter << "quantile" << delimiter << "value" << std::endl;
+      for (const auto &symbolId : symbolIds) {
+        for (nyse::SketchColumn column : sketchColumns) {
+          nyse::TDigest digest =
+              sketches.digest(symbolId.second, column, start, end);
+          for (double q : quantiles)
+            out << symbolId.first << delimiter
+                << nyse::sketchColumns()[static_cast<int>(column)]
+                << delimiter << uint64_t(digest.count()) << delimiter << q
+                << delimiter << digest.quantile(q) << "\n";
+        }
+      }
+      out.flush();
+      auto duration = std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - startTime);
+      printf("quantiles of %lu symbols in %.3f ms\n", symbolIds.size(),
+             duration.count());
+      return 0;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    uint64_t rows = 0;
+    {
+      nyse::TileDBStatsScope statsScope(tiledbStats, "query of " + arrayUri);
+      rows = array->querySymbols(symbolIds, start, end, writeFile, delimiter);
+    }
+
+    auto duration = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - startTime);
+    printf("query returned %lu rows for %lu symbols in %.3f ms\n", rows,
+           symbolIds.size(), duration.count());
+    nyse::ResultCache::instance().report();
+
+    return 0;
+  }
+
+  int status = array->load(filename, delimiter.c_str()[0], batchSize, threads);
+  if (status == 0 && !nbboArray.empty()) {
+    // Only the days just loaded are rebuilt, books start empty every day
+    std::pair<uint64_t, uint64_t> loaded = array->loadedRange();
+    uint64_t firstDay = nyse::exchange_day(loaded.first);
+    uint64_t lastDay = nyse::exchange_day(loaded.second);
+    uint64_t rangeStart = std::max(start, nyse::exchange_day_start(firstDay));
+    uint64_t rangeEnd =
+        std::min(end, nyse::exchange_day_start(lastDay + 1) - 1);
+    if (loaded.first <= loaded.second && rangeStart <= rangeEnd)
+      status = buildNbbo({}, rangeStart, rangeEnd);
+  }
+  if (status == 0 && !pyramidGroup.empty()) {
+    // Only the range just loaded is rebuilt, widened to whole buckets of the
+    // coarsest level so no bucket is rewritten from part of its quotes
+    uint64_t width = 1;
+    for (uint64_t milliseconds : pyramidLevels)
+      width = std::max(width, milliseconds * 1000000);
+    std::pair<uint64_t, uint64_t> loaded = array->loadedRange();
+    uint64_t rangeStart = std::max(start, loaded.first / width * width);
+    uint64_t rangeEnd =
+        std::min(end, loaded.second / width * width + width - 1);
+    if (loaded.first <= loaded.second && rangeStart <= rangeEnd)
+      status = buildPyramid({}, rangeStart, rangeEnd);
+  }
+  return status;
 }
\ No newline at end of file
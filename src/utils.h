@@ -34,9 +34,15 @@
 #ifndef NYSE_INGESTOR_UTILS_H
 #define NYSE_INGESTOR_UTILS_H
 
+#include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <date/tz.h>
 #include <iomanip>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <tiledb/tiledb>
 
@@ -89,6 +95,128 @@ static std::string beautify_duration(std::chrono::seconds input_seconds) {
   return ss.str();
 }
 
+/**
+ * Parse a human readable size such as 512M or 64G into bytes. A plain number
+ * is taken as bytes, suffixes K, M, G and T are powers of 1024.
+ * @param size
+ * @return bytes
+ */
+static uint64_t parse_size(const std::string &size) {
+  size_t end = 0;
+  double value = std::stod(size, &end);
+  std::string suffix = size.substr(end);
+  uint64_t multiplier = 1;
+  if (suffix == "K" || suffix == "k" || suffix == "KB") {
+    multiplier = 1024ULL;
+  } else if (suffix == "M" || suffix == "m" || suffix == "MB") {
+    multiplier = 1024ULL * 1024;
+  } else if (suffix == "G" || suffix == "g" || suffix == "GB") {
+    multiplier = 1024ULL * 1024 * 1024;
+  } else if (suffix == "T" || suffix == "t" || suffix == "TB") {
+    multiplier = 1024ULL * 1024 * 1024 * 1024;
+  } else if (!suffix.empty() && suffix != "B") {
+    throw std::invalid_argument("Unknown size suffix in " + size);
+  }
+  double bytes = value * multiplier;
+  // 2^64, the first value that does not fit
+  if (!std::isfinite(bytes) || value < 0 || bytes >= 18446744073709551616.0)
+    throw std::invalid_argument("Size out of range in " + size);
+  return static_cast<uint64_t>(bytes);
+}
+
+/**
+ * Parse an exchange local time of day "HH:MM[:SS]"
+ * @param time
+ * @return nanoseconds since midnight
+ */
+static uint64_t parse_time_of_day(const std::string &time) {
+  unsigned hours = 0, minutes = 0, seconds = 0;
+  int fields = sscanf(time.c_str(), "%u:%u:%u", &hours, &minutes, &seconds);
+  if (fields < 2 || hours > 24 || minutes > 59 || seconds > 59)
+    throw std::invalid_argument("invalid time of day " + time);
+  return ((hours * 60ULL + minutes) * 60 + seconds) * 1000000000ULL;
+}
+
+/**
+ * Parse a query timestamp into nanoseconds since epoch UTC. Either a plain
+ * number of nanoseconds since epoch or "YYYY-MM-DD HH:MM:SS[.fffffffff]" in
+ * exchange local time, taken as -0400 the same as ingested Time fields.
+ * @param timestamp
+ * @return nanoseconds since epoch
+ */
+static uint64_t parse_timestamp(const std::string &timestamp) {
+  if (!timestamp.empty() &&
+      std::all_of(timestamp.begin(), timestamp.end(),
+                  [](char c) { return std::isdigit(c); }))
+    return std::stoull(timestamp);
+
+  std::string seconds = timestamp;
+  uint64_t fraction = 0;
+  size_t dot = timestamp.find('.');
+  if (dot != std::string::npos) {
+    seconds = timestamp.substr(0, dot);
+    // Right pad the fraction to nanoseconds
+    std::string digits = timestamp.substr(dot + 1);
+    if (digits.empty() || digits.size() > 9)
+      throw std::invalid_argument("invalid fraction in timestamp " +
+                                  timestamp);
+    fraction = std::stoull(digits + std::string(9 - digits.size(), '0'));
+  }
+
+  date::sys_time<std::chrono::seconds> t;
+  std::istringstream stream{seconds + "-0400"};
+  stream >> date::parse("%Y-%m-%d %H:%M:%S%z", t);
+  if (stream.fail())
+    throw std::invalid_argument("failed to parse timestamp " + timestamp);
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+             .count() +
+         fraction;
+}
+
+// Exchange local time is taken as -0400, the same as ingested Time fields
+static const uint64_t exchange_utc_offset = 4 * 3600000000000ULL;
+static const uint64_t nanoseconds_per_day = 86400000000000ULL;
+
+/**
+ * Index of the exchange local day of a datetime, days being split at the
+ * exchange's midnight rather than UTC's
+ * @param datetime nanoseconds since epoch
+ * @return days since epoch
+ */
+static uint64_t exchange_day(uint64_t datetime) {
+  uint64_t local =
+      datetime >= exchange_utc_offset ? datetime - exchange_utc_offset : 0;
+  return local / nanoseconds_per_day;
+}
+
+/**
+ * First datetime of an exchange local day
+ * @param day days since epoch
+ * @return nanoseconds since epoch of the exchange's midnight
+ */
+static uint64_t exchange_day_start(uint64_t day) {
+  return day * nanoseconds_per_day + exchange_utc_offset;
+}
+
+/**
+ * Stable id of a loaded file, the FNV-1a hash of its name without the
+ * directory so the same file loaded again from elsewhere gets the same id
+ * @param file_uri
+ * @return id below UINT64_MAX, usable as a coordinate of a uint64 dimension
+ */
+static uint64_t source_id(const std::string &file_uri) {
+  size_t slash = file_uri.find_last_of('/');
+  std::string name =
+      slash == std::string::npos ? file_uri : file_uri.substr(slash + 1);
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : name) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  return hash % UINT64_MAX;
+}
+
 /**
  * Create a filter list from a csv string
  * @param ctx